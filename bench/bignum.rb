@@ -0,0 +1,32 @@
+require 'viiite'
+require 'msgpack'
+
+values = {
+  128 => Array.new(100) {|i| 2**127 + i },
+  256 => Array.new(100) {|i| -(2**255) - i },
+}
+
+Viiite.bench do |b|
+  b.range_over([128, 256], :bits) do |bits|
+    ints = values[bits]
+    strs = ints.map {|i| i.to_s }
+    data_ext = MessagePack.pack(ints, :bignum_exttype => 1)
+    data_str = MessagePack.pack(strs)
+
+    b.report(:pack_to_s) do
+      10_000.times { MessagePack.pack(ints.map {|i| i.to_s }) }
+    end
+
+    b.report(:pack_exttype) do
+      10_000.times { MessagePack.pack(ints, :bignum_exttype => 1) }
+    end
+
+    b.report(:unpack_to_i) do
+      10_000.times { MessagePack.unpack(data_str).map {|s| s.to_i } }
+    end
+
+    b.report(:unpack_exttype) do
+      10_000.times { MessagePack.unpack(data_ext, :bignum_exttype => 1) }
+    end
+  end
+end
@@ -0,0 +1,36 @@
+require 'viiite'
+require 'msgpack'
+
+message = {
+  "type" => "order.created",
+  "payload" => {
+    "items" => (1..20).map {|i| {"sku" => "sku-#{i}", "qty" => i, "price" => i * 1.5} },
+    "note" => "n" * 500,
+  },
+  "meta" => {"tenant_id" => 42, "trace" => "t" * 32},
+}
+data = MessagePack.pack(message)
+
+Viiite.bench do |b|
+  b.range_over([10_000, 100_000], :runs) do |runs|
+    b.report(:unpack) do
+      runs.times do
+        m = MessagePack.unpack(data)
+        [m["meta"]["tenant_id"], m["type"]]
+      end
+    end
+
+    b.report(:unpack_lazy) do
+      runs.times do
+        m = MessagePack.unpack_lazy(data)
+        [m.dig("meta", "tenant_id"), m["type"]]
+      end
+    end
+
+    b.report(:extract) do
+      runs.times do
+        MessagePack.extract(data, ["meta", "tenant_id"], ["type"])
+      end
+    end
+  end
+end
@@ -0,0 +1,29 @@
+require 'viiite'
+require 'msgpack'
+
+# streams of records split into chunks as a socket would return them
+small = MessagePack.pack({"id" => 12345, "name" => "msgpack", "tags" => ["a", "b"], "body" => "x" * 30}) * 200_000
+large = MessagePack.pack({"id" => 12345, "body" => "x" * 3000}) * 20_000
+
+Viiite.bench do |b|
+  b.range_over([1024, 4096, 16384, 65536], :feed_size) do |feed_size|
+    {:small => small, :large => large}.each_pair do |name, stream|
+      chunks = (0...stream.bytesize).step(feed_size).map {|i| stream.byteslice(i, feed_size) }
+
+      b.report(:"#{name}_feed_each") do
+        unpacker = MessagePack::Unpacker.new
+        chunks.each do |chunk|
+          unpacker.feed_each(chunk) {|obj| }
+        end
+      end
+
+      b.report(:"#{name}_feed_and_each") do
+        unpacker = MessagePack::Unpacker.new
+        chunks.each do |chunk|
+          unpacker.feed(chunk)
+          unpacker.each {|obj| }
+        end
+      end
+    end
+  end
+end
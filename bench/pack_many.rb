@@ -0,0 +1,31 @@
+require 'viiite'
+require 'msgpack'
+
+messages = {
+  10 => ['event', 1, nil],
+  100 => {'type' => 'event', 'id' => 12345, 'body' => 'x' * 64, 'tags' => ['a', 'b']},
+  1000 => {'type' => 'event', 'id' => 12345, 'body' => 'x' * 900, 'tags' => Array.new(20) {|i| i }},
+}
+
+Viiite.bench do |b|
+  b.range_over([10, 100, 1000], :bytes) do |bytes|
+    objs = [messages[bytes]] * 10_000
+
+    b.report(:pack) do
+      10.times { objs.map {|o| MessagePack.pack(o) } }
+    end
+
+    b.report(:pack_many) do
+      10.times { MessagePack.pack_many(objs) }
+    end
+
+    b.report(:pack_many_join) do
+      10.times { MessagePack.pack_many(objs, :join => true) }
+    end
+
+    b.report(:pack_each) do
+      pk = MessagePack::Packer.new
+      10.times { pk.pack_each(objs) }
+    end
+  end
+end
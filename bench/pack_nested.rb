@@ -0,0 +1,32 @@
+require 'viiite'
+require 'msgpack'
+
+deep = (1..1000).inject([]) {|a, i| [i, a] }
+deep_hash = (1..1000).inject({}) {|h, i| {'v' => i, 'next' => h} }
+wide = Array.new(10_000) {|i| i }
+wide_hash = Hash[Array.new(10_000) {|i| [i.to_s, i] }]
+records = Array.new(1000) {|i| {'id' => i, 'name' => 'name', 'tags' => ['a', 'b'], 'attrs' => {'x' => 1.0}} }
+
+Viiite.bench do |b|
+  b.range_over([1_000, 10_000], :runs) do |runs|
+    b.report(:deep_array) do
+      runs.times { MessagePack.pack(deep) }
+    end
+
+    b.report(:deep_hash) do
+      runs.times { MessagePack.pack(deep_hash) }
+    end
+
+    b.report(:wide_array) do
+      runs.times { MessagePack.pack(wide) }
+    end
+
+    b.report(:wide_hash) do
+      (runs / 10).times { MessagePack.pack(wide_hash) }
+    end
+
+    b.report(:records) do
+      (runs / 10).times { MessagePack.pack(records) }
+    end
+  end
+end
@@ -0,0 +1,32 @@
+require 'viiite'
+require 'msgpack'
+
+row = { 'id' => 1, 'name' => 'msgpack', 'tags' => ['a', 'b', 'c'] }
+class Rows
+  include Enumerable
+  def initialize(size, row)
+    @size = size
+    @row = row
+  end
+  def each
+    @size.times { yield @row }
+  end
+end
+
+Viiite.bench do |b|
+  b.range_over([1_000, 100_000], :runs) do |runs|
+    rows = Rows.new(runs, row)
+
+    b.report(:to_a) do
+      MessagePack.pack(rows.to_a)
+    end
+
+    b.report(:write_array_stream) do
+      MessagePack::Packer.new.write_array_stream(rows).to_s
+    end
+
+    b.report(:write_array_stream_block) do
+      MessagePack::Packer.new.write_array_stream {|w| rows.each {|r| w << r } }.to_s
+    end
+  end
+end
@@ -0,0 +1,39 @@
+require 'viiite'
+require 'msgpack'
+
+record = {
+  "id" => 12345,
+  "name" => "msgpack " * 10,
+  "scores" => (1..50).map {|i| i * 0.5 },
+  "tags" => (1..20).map {|i| "tag#{i}" },
+}
+data = MessagePack.pack(record) * 10_000
+
+Viiite.bench do |b|
+  b.range_over([10, 100], :runs) do |runs|
+    b.report(:feed_each) do
+      runs.times do
+        MessagePack::Unpacker.new.feed_each(data) {|obj| }
+      end
+    end
+
+    b.report(:skip) do
+      runs.times do
+        unpacker = MessagePack::Unpacker.new
+        unpacker.feed(data)
+        begin
+          while true
+            unpacker.skip
+          end
+        rescue EOFError
+        end
+      end
+    end
+
+    b.report(:scan_offsets) do
+      runs.times do
+        MessagePack.scan_offsets(data)
+      end
+    end
+  end
+end
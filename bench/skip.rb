@@ -0,0 +1,31 @@
+require 'viiite'
+require 'msgpack'
+
+record = {
+  "id" => 12345,
+  "name" => "msgpack " * 10,
+  "scores" => (1..50).map {|i| i * 0.5 },
+  "tags" => (1..20).map {|i| "tag#{i}" },
+  "children" => (1..10).map {|i| {"id" => i, "name" => "child#{i}", "values" => [i, i * 2**40, nil, true]} },
+}
+data = MessagePack.pack([record] * 100)
+
+Viiite.bench do |b|
+  b.range_over([100, 1_000], :runs) do |runs|
+    b.report(:read) do
+      unpacker = MessagePack::Unpacker.new
+      runs.times do
+        unpacker.feed(data)
+        unpacker.read
+      end
+    end
+
+    b.report(:skip) do
+      unpacker = MessagePack::Unpacker.new
+      runs.times do
+        unpacker.feed(data)
+        unpacker.skip
+      end
+    end
+  end
+end
@@ -0,0 +1,37 @@
+require 'viiite'
+require 'msgpack'
+
+# ported from spec/jruby/benchmarks/symbolize_keys_bm.rb
+data = MessagePack.pack(:hello => 'world', :nested => ['structure', {:value => 42}])
+data_stream = data * 100
+
+Viiite.bench do |b|
+  b.range_over([10_000, 100_000], :runs) do |runs|
+    b.report(:strings) do
+      runs.times do
+        MessagePack.unpack(data)
+      end
+    end
+
+    b.report(:symbols) do
+      options = {:symbolize_keys => true}
+      runs.times do
+        MessagePack.unpack(data, options)
+      end
+    end
+
+    b.report(:strings_stream) do
+      unpacker = MessagePack::Unpacker.new
+      (runs / 100).times do
+        unpacker.feed_each(data_stream) {|obj| }
+      end
+    end
+
+    b.report(:symbols_stream) do
+      unpacker = MessagePack::Unpacker.new(:symbolize_keys => true)
+      (runs / 100).times do
+        unpacker.feed_each(data_stream) {|obj| }
+      end
+    end
+  end
+end
@@ -2,6 +2,7 @@ require 'viiite'
 require 'msgpack'
 
 data = MessagePack.pack(:hello => 'world', :nested => ['structure', {:value => 42}])
+numbers = MessagePack.pack([300, -300, 70_000, -70_000, 2**40, 0.5])
 
 Viiite.bench do |b|
   b.range_over([10_000, 100_000, 1000_000], :runs) do |runs|
@@ -17,5 +18,11 @@ Viiite.bench do |b|
         MessagePack.unpack(data, options)
       end
     end
+
+    b.report(:numbers) do
+      runs.times do
+        MessagePack.unpack(numbers)
+      end
+    end
   end
 end
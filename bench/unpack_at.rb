@@ -0,0 +1,42 @@
+require 'viiite'
+require 'msgpack'
+
+record = {
+  "id" => 12345,
+  "name" => "msgpack " * 10,
+  "scores" => (1..50).map {|i| i * 0.5 },
+  "tags" => (1..20).map {|i| "tag#{i}" },
+}
+data = MessagePack.pack(record) * 10_000
+size = MessagePack.pack(record).bytesize
+
+Viiite.bench do |b|
+  b.range_over([1, 10], :runs) do |runs|
+    b.report(:byteslice) do
+      runs.times do
+        offset = 0
+        while offset < data.bytesize
+          MessagePack.unpack(data.byteslice(offset, size))
+          offset += size
+        end
+      end
+    end
+
+    b.report(:unpack_at) do
+      runs.times do
+        offset = 0
+        while offset < data.bytesize
+          obj, offset = MessagePack.unpack_at(data, offset)
+        end
+      end
+    end
+
+    b.report(:feed_reference) do
+      runs.times do
+        unpacker = MessagePack::Unpacker.new
+        unpacker.feed_reference(data)
+        unpacker.each {|obj| }
+      end
+    end
+  end
+end
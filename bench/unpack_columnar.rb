@@ -0,0 +1,24 @@
+require 'viiite'
+require 'msgpack'
+
+rows = (1..100_000).map {|i| {"ts" => 1_500_000_000 + i, "v" => i * 0.5, "host" => "web#{i % 8}"} }
+data = MessagePack.pack(rows)
+keys = rows.first.keys
+
+Viiite.bench do |b|
+  b.range_over([1, 5], :runs) do |runs|
+    b.report(:unpack_then_pivot) do
+      runs.times do
+        records = MessagePack.unpack(data)
+        columns = {}
+        keys.each {|k| columns[k] = records.map {|r| r[k] } }
+      end
+    end
+
+    b.report(:unpack_columnar) do
+      runs.times do
+        MessagePack.unpack_columnar(data)
+      end
+    end
+  end
+end
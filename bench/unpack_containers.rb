@@ -0,0 +1,29 @@
+require 'viiite'
+require 'msgpack'
+
+maps = [10, 100, 10_000].map do |n|
+  [n, MessagePack.pack(Hash[(1..n).map {|i| ["key#{i}", i] }])]
+end
+arrays = [10, 100, 10_000].map do |n|
+  [n, MessagePack.pack((1..n).map {|i| "value#{i}" })]
+end
+
+Viiite.bench do |b|
+  b.range_over([1_000_000], :entries) do |entries|
+    maps.each do |n, data|
+      b.report(:"map_#{n}") do
+        (entries / n).times do
+          MessagePack.unpack(data)
+        end
+      end
+    end
+
+    arrays.each do |n, data|
+      b.report(:"array_#{n}") do
+        (entries / n).times do
+          MessagePack.unpack(data)
+        end
+      end
+    end
+  end
+end
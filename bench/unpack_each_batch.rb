@@ -0,0 +1,36 @@
+require 'viiite'
+require 'msgpack'
+
+data = (1..10_000).map {|i| MessagePack.pack([i, "e"]) }.join
+
+Viiite.bench do |b|
+  b.range_over([10, 100], :runs) do |runs|
+    b.report(:each) do
+      unpacker = MessagePack::Unpacker.new
+      runs.times do
+        out = []
+        unpacker.feed_each(data) {|obj| out << obj }
+      end
+    end
+
+    b.report(:each_batch) do
+      unpacker = MessagePack::Unpacker.new
+      runs.times do
+        unpacker.feed(data)
+        out = []
+        unpacker.each_batch(1000) {|ary| out.concat(ary) }
+      end
+    end
+
+    b.report(:read_many) do
+      unpacker = MessagePack::Unpacker.new
+      runs.times do
+        unpacker.feed(data)
+        out = []
+        until (ary = unpacker.read_many(1000)).empty?
+          out.concat(ary)
+        end
+      end
+    end
+  end
+end
@@ -0,0 +1,33 @@
+require 'viiite'
+require 'msgpack'
+
+data = MessagePack.pack((1..10_000).map {|i| {"id" => i, "tags" => ["a", "b"], "score" => i * 0.5} })
+
+Viiite.bench do |b|
+  b.range_over([10, 100], :runs) do |runs|
+    b.report(:read) do
+      unpacker = MessagePack::Unpacker.new
+      runs.times do
+        unpacker.feed(data)
+        unpacker.read
+      end
+    end
+
+    b.report(:each_event) do
+      unpacker = MessagePack::Unpacker.new
+      runs.times do
+        unpacker.feed(data)
+        n = 0
+        unpacker.each_event {|e| n += 1 }
+      end
+    end
+
+    b.report(:skip) do
+      unpacker = MessagePack::Unpacker.new
+      runs.times do
+        unpacker.feed(data)
+        unpacker.skip
+      end
+    end
+  end
+end
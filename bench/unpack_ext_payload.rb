@@ -0,0 +1,18 @@
+require 'viiite'
+require 'msgpack'
+
+data = MessagePack.pack((1..100).map {|i| MessagePack::ExtType.new(1, "x" * 100_000) })
+
+Viiite.bench do |b|
+  b.range_over([10, 100], :runs) do |runs|
+    [:string, :shared, :buffer].each do |payload|
+      b.report(payload) do
+        unpacker = MessagePack::Unpacker.new
+        unpacker.register_exttype(1, :payload => payload) {|type, data| data.size }
+        runs.times do
+          unpacker.feed_each(data) {|obj| }
+        end
+      end
+    end
+  end
+end
@@ -0,0 +1,49 @@
+require 'viiite'
+require 'msgpack'
+
+class Point
+  def self.from_exttype(type, data)
+    data
+  end
+end
+
+data = MessagePack.pack((1..10_000).map {|i| MessagePack::ExtType.new(1, [i].pack("N")) })
+
+Viiite.bench do |b|
+  b.range_over([10, 100], :runs) do |runs|
+    b.report(:class) do
+      unpacker = MessagePack::Unpacker.new
+      unpacker.register_exttype(1, Point)
+      runs.times do
+        unpacker.feed(data)
+        unpacker.read
+      end
+    end
+
+    b.report(:proc) do
+      unpacker = MessagePack::Unpacker.new
+      unpacker.register_exttype(1) {|type, data| data }
+      runs.times do
+        unpacker.feed(data)
+        unpacker.read
+      end
+    end
+
+    b.report(:method) do
+      unpacker = MessagePack::Unpacker.new
+      unpacker.register_exttype(1, Point.method(:from_exttype))
+      runs.times do
+        unpacker.feed(data)
+        unpacker.read
+      end
+    end
+
+    b.report(:class_level_default) do
+      unpacker = MessagePack::Unpacker.new
+      runs.times do
+        unpacker.feed(data)
+        unpacker.read
+      end
+    end
+  end
+end
@@ -0,0 +1,42 @@
+require 'viiite'
+require 'msgpack'
+
+config = {
+  "name" => "service",
+  "servers" => (1..20).map {|i| {"host" => "10.0.0.#{i}", "port" => 8000 + i, "tags" => ["web", "zone-#{i % 3}"]} },
+  "limits" => {"connections" => 1024, "timeout" => 2.5, "retry" => [1, 2, 4, 8]},
+}
+data = MessagePack.pack(config)
+
+def deep_freeze(obj)
+  case obj
+  when Array
+    obj.each {|e| deep_freeze(e) }
+  when Hash
+    obj.each_value {|v| deep_freeze(v) }
+  end
+  obj.freeze
+end
+
+Viiite.bench do |b|
+  b.range_over([10_000, 100_000], :runs) do |runs|
+    b.report(:unpack) do
+      runs.times do
+        MessagePack.unpack(data)
+      end
+    end
+
+    b.report(:unpack_deep_freeze) do
+      runs.times do
+        deep_freeze(MessagePack.unpack(data))
+      end
+    end
+
+    b.report(:unpack_freeze_option) do
+      options = {:freeze => true}
+      runs.times do
+        MessagePack.unpack(data, options)
+      end
+    end
+  end
+end
@@ -0,0 +1,42 @@
+require 'viiite'
+require 'msgpack'
+
+# same record as bench/unpack_log.rb
+data_structure = MessagePack.pack({
+  'remote_host' => '127.0.0.1',
+  'remote_user' => '-',
+  'date' => '10/Oct/2000:13:55:36 -0700',
+  'request' => 'GET /apache_pb.gif HTTP/1.0',
+  'method' => 'GET',
+  'path' => '/apache_pb.gif',
+  'protocol' => 'HTTP/1.0',
+  'status' => 200,
+  'bytes' => 2326,
+  'referer' => 'http://www.example.com/start.html',
+  'agent' => 'Mozilla/4.08 [en] (Win98; I ;Nav)',
+})
+
+# a stream of 1000 records
+data_stream = data_structure * 1000
+
+def unpack_stream(data, runs, options)
+  unpacker = MessagePack::Unpacker.new(options)
+  before = GC.stat(:total_allocated_objects)
+  runs.times do
+    unpacker.feed_each(data) {|obj| }
+  end
+  allocated = GC.stat(:total_allocated_objects) - before
+  $stderr.puts "#{options.inspect}: #{allocated / (runs * 1000)} objects per record"
+end
+
+Viiite.bench do |b|
+  b.range_over([100, 1_000], :runs) do |runs|
+    b.report(:structure) do
+      unpack_stream(data_stream, runs, {})
+    end
+
+    b.report(:structure_key_cache) do
+      unpack_stream(data_stream, runs, {:key_cache => true})
+    end
+  end
+end
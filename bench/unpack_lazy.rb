@@ -0,0 +1,30 @@
+require 'viiite'
+require 'msgpack'
+
+record = {}
+50.times do |i|
+  record["field#{i}"] = i.even? ? "value #{i} " * 16 : {"id" => i, "list" => (1..10).to_a, "ok" => true}
+end
+record["id"] = 12345
+record["name"] = "msgpack"
+record["meta"] = {"score" => 0.5}
+
+data = MessagePack.pack(record)  # about 5KB
+
+Viiite.bench do |b|
+  b.range_over([10_000, 100_000], :runs) do |runs|
+    b.report(:unpack) do
+      runs.times do
+        h = MessagePack.unpack(data)
+        h["id"]; h["name"]; h["meta"]["score"]
+      end
+    end
+
+    b.report(:unpack_lazy) do
+      runs.times do
+        m = MessagePack.unpack_lazy(data)
+        m["id"]; m["name"]; m.dig("meta", "score")
+      end
+    end
+  end
+end
@@ -0,0 +1,49 @@
+require 'viiite'
+require 'msgpack'
+
+Point = Struct.new(:ts, :v, :host)
+
+class Sample
+  attr_reader :ts, :v, :host
+  def initialize(ts, v, host)
+    @ts = ts
+    @v = v
+    @host = host
+  end
+end
+
+data = MessagePack.pack((1..10_000).map {|i| {"ts" => 1_500_000_000 + i, "v" => i * 0.5, "host" => "web"} })
+
+Viiite.bench do |b|
+  b.range_over([10, 100], :runs) do |runs|
+    b.report(:hash_then_struct) do
+      runs.times do
+        MessagePack.unpack(data).map {|h| Point.new(h["ts"], h["v"], h["host"]) }
+      end
+    end
+
+    b.report(:shape_struct) do
+      unpacker = MessagePack::Unpacker.new
+      unpacker.register_shape(Point)
+      runs.times do
+        unpacker.feed(data)
+        unpacker.read
+      end
+    end
+
+    b.report(:hash_then_object) do
+      runs.times do
+        MessagePack.unpack(data).map {|h| Sample.new(h["ts"], h["v"], h["host"]) }
+      end
+    end
+
+    b.report(:shape_object) do
+      unpacker = MessagePack::Unpacker.new
+      unpacker.register_shape(Sample, :keys => [:ts, :v, :host])
+      runs.times do
+        unpacker.feed(data)
+        unpacker.read
+      end
+    end
+  end
+end
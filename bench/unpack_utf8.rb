@@ -0,0 +1,50 @@
+require 'viiite'
+require 'msgpack'
+
+ascii = ['127.0.0.1 - - [10/Oct/2000:13:55:36 -0700] "GET /apache_pb.gif HTTP/1.0" 200 2326'] * 100
+multibyte = ['メッセージパックは効率の良いバイナリ形式のオブジェクト・シリアライズ・フォーマットです'] * 100
+
+data_ascii = MessagePack.pack(ascii)
+data_multibyte = MessagePack.pack(multibyte)
+
+Viiite.bench do |b|
+  b.range_over([10_000, 100_000], :runs) do |runs|
+    b.report(:ascii) do
+      runs.times do
+        MessagePack.unpack(data_ascii)
+      end
+    end
+
+    b.report(:ascii_validate_utf8) do
+      options = {:validate_utf8 => :raise}
+      runs.times do
+        MessagePack.unpack(data_ascii, options)
+      end
+    end
+
+    b.report(:ascii_valid_encoding_p) do
+      runs.times do
+        MessagePack.unpack(data_ascii).each {|s| raise unless s.valid_encoding? }
+      end
+    end
+
+    b.report(:multibyte) do
+      runs.times do
+        MessagePack.unpack(data_multibyte)
+      end
+    end
+
+    b.report(:multibyte_validate_utf8) do
+      options = {:validate_utf8 => :raise}
+      runs.times do
+        MessagePack.unpack(data_multibyte, options)
+      end
+    end
+
+    b.report(:multibyte_valid_encoding_p) do
+      runs.times do
+        MessagePack.unpack(data_multibyte).each {|s| raise unless s.valid_encoding? }
+      end
+    end
+  end
+end
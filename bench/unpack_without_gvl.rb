@@ -0,0 +1,16 @@
+require 'viiite'
+require 'msgpack'
+
+data = MessagePack.pack((1..20_000).map {|i| [i, "v#{i}", {"k" => i.to_f}] })
+
+Viiite.bench do |b|
+  b.range_over([1, 4], :threads) do |threads|
+    b.report(:unpack) do
+      (1..threads).map { Thread.new { 10.times { MessagePack.unpack(data) } } }.each(&:join)
+    end
+
+    b.report(:unpack_without_gvl) do
+      (1..threads).map { Thread.new { 10.times { MessagePack.unpack_without_gvl(data) } } }.each(&:join)
+    end
+  end
+end
@@ -38,6 +38,27 @@ module MessagePack
   def self.pack(obj)
   end
 
+  #
+  # Serializes each object in an Array into a separate String.
+  # This is faster than calling pack for each object because one Packer
+  # and its buffer are reused.
+  #
+  # @overload pack_many(objects, options={})
+  #   @param objects [Array] objects to be serialized
+  #   @param options [Hash]
+  #   @return [Array<String>] serialized data of each object
+  #
+  # @overload pack_many(objects, options={:join => true})
+  #   @param objects [Array] objects to be serialized
+  #   @param options [Hash]
+  #   @return [Array] a String which contains all serialized objects, and
+  #     an Array of the offsets where each object starts
+  #
+  # See Packer#initialize for supported options.
+  #
+  def self.pack_many(objects, options={})
+  end
+
   #
   # Deserializes an object from an IO or String.
   #
@@ -73,5 +94,144 @@ module MessagePack
   #
   def self.unpack(src, options={})
   end
+
+  #
+  # Deserializes an array or map lazily. It returns a LazyArray or LazyMap which
+  # deserializes entries only when they are accessed. Other types are deserialized
+  # as _unpack_ does.
+  #
+  # @overload unpack_lazy(string, options={})
+  #   @param string [String] data to deserialize
+  #   @param options [Hash]
+  #
+  # @overload unpack_lazy(io, options={})
+  #   @param io [IO]
+  #   @param options [Hash]
+  #
+  # @return [LazyArray,LazyMap,Object]
+  #
+  # See Unpacker#initialize for supported options.
+  #
+  def self.unpack_lazy(src, options={})
+  end
+
+  #
+  # Deserializes an Array of Hashes into a Hash of columns as Unpacker#read_columns does.
+  #
+  # @overload unpack_columnar(string, options={})
+  #   @param string [String] data to deserialize
+  #   @param options [Hash]
+  #
+  # @overload unpack_columnar(io, options={})
+  #   @param io [IO]
+  #   @param options [Hash]
+  #
+  # @return [Hash] key to Array of values
+  #
+  # See Unpacker#initialize for supported options.
+  #
+  def self.unpack_columnar(src, options={})
+  end
+
+  #
+  # Deserializes a String in two stages. The first stage scans the data into
+  # a flat tape of tags, numbers and offsets without creating Ruby objects.
+  # The second stage builds the objects from the tape. For Strings larger than
+  # 64KB, the first stage runs without the GVL so that other threads can run
+  # while large messages are scanned.
+  #
+  # @param string [String] data to deserialize
+  # @param options [Hash]
+  #
+  # @return [Object] deserialized object
+  #
+  # See Unpacker#initialize for supported options.
+  #
+  def self.unpack_without_gvl(string, options={})
+  end
+
+  #
+  # Deserializes an object which starts at _offset_ of a String, and returns
+  # it with the offset of the next byte. Bytes after the object are not
+  # read, so concatenated objects can be read one by one without slicing
+  # the String.
+  #
+  # @param string [String] data to deserialize
+  # @param offset [Integer] byte offset of the object
+  # @param options [Hash]
+  # @return [Array] deserialized object and offset of the next object
+  #
+  # See Unpacker#initialize for supported options.
+  #
+  def self.unpack_at(string, offset, options={})
+  end
+
+  #
+  # Returns byte offsets of objects in a String of concatenated objects.
+  # Objects are skipped without deserializing them. An incomplete object at the end
+  # is ignored.
+  #
+  # @param src [String, Buffer] concatenated objects. A Buffer is not consumed.
+  # @return [Array<Integer>]
+  #
+  # See StreamIndex to deserialize objects by their indexes.
+  #
+  def self.scan_offsets(src)
+  end
+
+  #
+  # Checks that a String is a serialized object without deserializing it.
+  # No objects are created.
+  #
+  # @param string [String] data to check
+  # @param options [Hash]
+  # @return [Boolean]
+  #
+  # Supported options:
+  #
+  # * *:validate_utf8* rejects strings which are not valid UTF-8
+  # * *:max_depth*, *:max_array_size*, *:max_map_size*, *:max_str_size* and *:max_ext_size* work as they do for Unpacker#initialize
+  # * *:multiple* accepts one or more concatenated objects instead of exactly one object
+  #
+  def self.valid?(string, options={})
+  end
+
+  #
+  # Checks a String as valid? does, and returns the byte offset of the first error.
+  # The offset points to the header of the invalid or truncated object, or to extra bytes
+  # after the object.
+  #
+  # @param string [String] data to check
+  # @param options [Hash] same as valid?
+  # @return [Integer, nil] offset of the first error, or nil if the string is valid
+  #
+  def self.validate(string, options={})
+  end
+
+  #
+  # Deserializes only the objects at the given paths. A path is an Array of map keys
+  # and array indexes, or a single key. Other entries are skipped without creating objects.
+  #
+  # If keys are duplicated in a map, the last one is used as Hash does.
+  #
+  # @example
+  #   type, tenant = MessagePack.extract(data, ["type"], ["meta", "tenant_id"])
+  #
+  # @overload extract(string, *paths, options={})
+  #   @param string [String] data to deserialize
+  #   @param paths [Array]
+  #   @param options [Hash]
+  #
+  # @overload extract(io, *paths, options={})
+  #   @param io [IO]
+  #   @param paths [Array]
+  #   @param options [Hash]
+  #
+  # @return [Array] deserialized objects for each path, or nil if the path doesn't exist
+  #
+  # See Unpacker#initialize for supported options.
+  #
+  def self.extract(src, *paths)
+  end
 end
 
@@ -9,6 +9,9 @@ module MessagePack
   class StackError < UnpackError
   end
 
+  class LimitError < UnpackError
+  end
+
   class TypeError < StandardError
   end
 end
@@ -0,0 +1,133 @@
+module MessagePack
+
+  #
+  # LazyArray refers to a serialized array and deserializes its elements when they are accessed.
+  # Nested arrays and maps are returned as LazyArray and LazyMap.
+  #
+  # Returned by MessagePack.unpack_lazy and Unpacker#read_lazy.
+  #
+  class LazyArray
+    include Enumerable
+
+    #
+    # Returns the element at _index_, or nil if _index_ is out of range.
+    #
+    # @param index [Integer]
+    # @return [Object]
+    #
+    def [](index)
+    end
+
+    #
+    # Retrieves the element at a sequence of indexes or keys like Array#dig.
+    #
+    # @return [Object]
+    #
+    def dig(index, *rest)
+    end
+
+    #
+    # @yieldparam element [Object]
+    # @return [LazyArray] self
+    #
+    def each(&block)
+    end
+
+    #
+    # @return [Integer] number of elements
+    #
+    def size
+    end
+
+    alias length size
+
+    #
+    # @return [Boolean]
+    #
+    def empty?
+    end
+
+    #
+    # Deserializes all elements including nested ones.
+    #
+    # @return [Array]
+    #
+    def to_a
+    end
+  end
+
+  #
+  # LazyMap refers to a serialized map and deserializes its entries when they are accessed.
+  # String (or Symbol with :symbolize_keys option) keys are compared without deserializing them.
+  # Nested arrays and maps are returned as LazyArray and LazyMap.
+  #
+  # Returned by MessagePack.unpack_lazy and Unpacker#read_lazy.
+  #
+  class LazyMap
+    include Enumerable
+
+    #
+    # Returns the value for _key_, or nil if _key_ is not found.
+    #
+    # @param key [Object]
+    # @return [Object]
+    #
+    def [](key)
+    end
+
+    #
+    # Retrieves the value at a sequence of keys or indexes like Hash#dig.
+    #
+    # @return [Object]
+    #
+    def dig(key, *rest)
+    end
+
+    #
+    # @yieldparam pair [Array] key and value
+    # @return [LazyMap] self
+    #
+    def each(&block)
+    end
+
+    alias each_pair each
+
+    #
+    # @return [Integer] number of entries
+    #
+    def size
+    end
+
+    alias length size
+
+    #
+    # @return [Boolean]
+    #
+    def empty?
+    end
+
+    #
+    # @return [Boolean]
+    #
+    def key?(key)
+    end
+
+    alias has_key? key?
+    alias include? key?
+
+    #
+    # @return [Array] deserialized keys
+    #
+    def keys
+    end
+
+    #
+    # Deserializes all entries including nested ones.
+    #
+    # @return [Hash]
+    #
+    def to_h
+    end
+  end
+
+end
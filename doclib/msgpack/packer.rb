@@ -24,6 +24,12 @@ module MessagePack
     #   * +nil+:(default) proceed with the default behavior, call +to_msgpack+(packer) on the packed object.
     #   * +false+: raise a TypeError exception.
     #
+    # * *:max_depth* maximum nesting level of Arrays and Hashes. ArgumentError is raised if an object is nested deeper. Default is 65536.
+    #
+    # * *:bignum_exttype* exttype typecode (0..127) used to serialize Integers which don't fit in 64-bit.
+    #   The payload is a sign byte (0 for positive, 1 for negative) followed by big-endian magnitude.
+    #   Without this option, such Integers raise RangeError.
+    #
     # See also {Buffer#initialize} for further options.
     #
     def initialize(*args)
@@ -82,6 +88,64 @@ module MessagePack
     def write_exttype_header(n, typenr)
     end
 
+    #
+    # Write an array whose size is not known in advance.
+    # Elements are written through a {StreamWriter} yielded to the block, or
+    # taken from _enumerable_ using its _each_ method. The header is written
+    # in the 32-bit form and its count is filled when the block returns.
+    #
+    # While the stream is open, written data is kept in the internal buffer
+    # even if an IO is set, so that the header can be updated. Reading or
+    # clearing the buffer (e.g. buffer.read, clear or write_to) raises
+    # RuntimeError until the stream is closed.
+    #
+    # @example
+    #   packer.write_array_stream do |w|
+    #     cursor.each {|row| w << row }
+    #   end
+    #
+    # @overload write_array_stream {|writer| ... }
+    # @overload write_array_stream(enumerable)
+    #
+    # @return [Packer] self
+    #
+    def write_array_stream(enumerable=nil, &block)
+    end
+
+    #
+    # Write a map whose size is not known in advance. Same as
+    # {#write_array_stream} but entries are written by _writer[key] = value_
+    # or _writer.write(key, value)_, and _enumerable_ should yield
+    # [key, value] pairs.
+    #
+    # @overload write_map_stream {|writer| ... }
+    # @overload write_map_stream(enumerable)
+    #
+    # @return [Packer] self
+    #
+    def write_map_stream(enumerable=nil, &block)
+    end
+
+    #
+    # Serializes each object in _objects_ into a separate String using
+    # this packer's settings and registered types.
+    # If _:join_ option is true, returns one String which contains all
+    # serialized objects and an Array of the offsets where each object starts.
+    #
+    # The internal buffer must be empty. It is empty again when this method
+    # returns, and data is not written to the internal IO.
+    #
+    # @example
+    #   packer.pack_each([1, "a"])                  #=> ["\x01", "\xA1a"]
+    #   packer.pack_each([1, "a"], :join => true)   #=> ["\x01\xA1a", [0, 1]]
+    #
+    # @param objects [Array]
+    # @param options [Hash]
+    # @return [Array<String>] or [String, Array<Integer>]
+    #
+    def pack_each(objects, options={})
+    end
+
     #
     # Flushes data in the internal buffer to the internal IO. Same as _buffer.flush.
     # If internal IO is not set, it does nothing.
@@ -265,5 +329,61 @@ module MessagePack
     def resolve_exttype klass
     end
 
+    #
+    # Writer object yielded by {Packer#write_array_stream} and
+    # {Packer#write_map_stream}. It can't be used after the block returns.
+    #
+    class StreamWriter
+      #
+      # Writes an element of an array stream, or an entry of a map stream.
+      #
+      # @overload write(value)
+      # @overload write(key, value)
+      #
+      # @return [StreamWriter] self
+      #
+      def write(*args)
+      end
+
+      #
+      # Writes an element of an array stream.
+      #
+      # @return [StreamWriter] self
+      #
+      def <<(value)
+      end
+
+      #
+      # Writes an entry of a map stream.
+      #
+      def []=(key, value)
+      end
+
+      #
+      # Returns number of elements (or entries) written so far.
+      #
+      # @return [Integer]
+      #
+      def size
+      end
+      alias count size
+
+      #
+      # Returns _true_ if this writer writes a map.
+      #
+      # @return [Boolean]
+      #
+      def map?
+      end
+
+      #
+      # Returns _true_ after the stream is closed.
+      #
+      # @return [Boolean]
+      #
+      def closed?
+      end
+    end
+
   end
 end
@@ -0,0 +1,105 @@
+module MessagePack
+
+  #
+  # StreamIndex keeps offsets of objects in a String of concatenated objects
+  # so that an object can be deserialized by its index without deserializing
+  # the preceding objects. Offsets are scanned without creating objects.
+  #
+  # An incomplete object at the end of the source is not indexed. end_offset
+  # returns the end of the last indexed object.
+  #
+  class StreamIndex
+    include Enumerable
+
+    #
+    # Scans _source_ and indexes the objects in it.
+    #
+    # @param source [String, Buffer] concatenated objects. A Buffer is not consumed.
+    # @param options [Hash] options of Unpacker used to deserialize objects
+    #
+    # See Unpacker#initialize for supported options.
+    #
+    def initialize(source, options={})
+    end
+
+    #
+    # Restores an index which was created by #dump without scanning _source_.
+    #
+    # @param source [String, Buffer] same data as the source of the dumped index
+    # @param index [String] return value of #dump
+    # @param options [Hash] options of Unpacker used to deserialize objects
+    # @return [StreamIndex]
+    #
+    def self.load(source, index, options={})
+    end
+
+    #
+    # Deserializes the object at _index_, or returns nil if _index_ is out of range.
+    #
+    # @param index [Integer]
+    # @return [Object]
+    #
+    def [](index)
+    end
+
+    #
+    # Deserializes objects from _start_ in order.
+    #
+    # @param start [Integer] index of the first object
+    # @yieldparam object [Object]
+    # @return [StreamIndex] self
+    #
+    def each(start=0, &block)
+    end
+
+    #
+    # @return [Integer] number of objects
+    #
+    def size
+    end
+
+    alias length size
+
+    #
+    # @return [Boolean]
+    #
+    def empty?
+    end
+
+    #
+    # Returns the byte offset of the object at _index_, or nil if _index_ is out of range.
+    #
+    # @param index [Integer]
+    # @return [Integer]
+    #
+    def offset(index)
+    end
+
+    #
+    # @return [Array<Integer>] byte offsets of the objects
+    #
+    def offsets
+    end
+
+    #
+    # @return [Integer] byte offset of the end of the last object
+    #
+    def end_offset
+    end
+
+    #
+    # @return [String] frozen source
+    #
+    def source
+    end
+
+    #
+    # Serializes the offsets as 64-bit little-endian integers followed by end_offset.
+    #
+    # @return [String]
+    #
+    def dump
+    end
+  end
+
+end
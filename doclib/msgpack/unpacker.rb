@@ -18,8 +18,34 @@ module MessagePack
     #
     # Supported options:
     #
-    # * *:symbolize_keys* deserialize keys of Hash objects as Symbol instead of String
+    # * *:symbolize_keys* deserialize keys of Hash objects as Symbol instead of String.
+    #   Keys of existing Symbols are looked up from their bytes without creating a String. An Unpacker created with this
+    #   option also caches Symbols of recent keys (see :key_cache) unless :key_cache is false.
+    # * *:freeze* [Boolean] return deeply frozen objects. Strings, Arrays and Hashes are frozen when they're created.
+    #   Objects returned by extended type handlers are left as they are, and their payloads aren't frozen either; freeze
+    #   them in the handler if needed. Results without extended types can be shared with other threads or Ractors without
+    #   freezing them again.
     # * *:default_exttype* [nil,false,Class,Method,Proc] How to deal with unregistered exttype numbers. See {#default_exttype=} for details.
+    # * *:validate_utf8* [nil,:raise,:binary,:scrub] check that deserialized strings are valid UTF-8.
+    #   With :raise, an invalid string raises MessagePack::MalformedFormatError. With :binary, it is returned as an ASCII-8BIT
+    #   String. With :scrub, invalid bytes are replaced with U+FFFD. Valid strings are marked as such so that Ruby doesn't scan them again.
+    # * *:key_cache* [Boolean] reuse frozen Strings for map keys which appeared before. Keys up to 64 bytes are cached
+    #   in a table of 256 entries indexed by hash of their bytes. It reduces allocations when the same keys repeat in a stream.
+    # * *:bignum_exttype* [Integer] exttype typecode (0..127) written by the Packer with the same option. Objects of this exttype
+    #   are deserialized as Integer.
+    #
+    # Limits for untrusted input. Sizes declared in headers are checked before their bodies are read, and
+    # MessagePack::LimitError is raised if they exceed the limits. All sizes are unlimited by default.
+    #
+    # * *:max_depth* [Integer] maximum depth of nested Arrays and Hashes (default: 128). MessagePack::StackError is raised beyond it.
+    # * *:max_array_size* [Integer] maximum number of elements of an Array
+    # * *:max_map_size* [Integer] maximum number of pairs of a Hash
+    # * *:max_str_size* [Integer] maximum size of a String in bytes, applied to both str and bin types
+    # * *:max_ext_size* [Integer] maximum size of the payload of an extended type in bytes
+    # * *:max_buffer_size* [Integer] maximum bytes buffered but not consumed. #feed and #feed_each raise MessagePack::LimitError
+    #   instead of appending data beyond it.
+    #
+    # _skip_ doesn't create objects and checks only max_depth. Entries of lazy views are deserialized with the limits.
     #
     # See also Buffer#initialize for other options.
     #
@@ -53,7 +79,35 @@ module MessagePack
     alias unpack read
 
     #
-    # Deserializes an object and ignores it. This method is faster than _read_.
+    # Reads an array or map without deserializing its entries and returns a LazyArray or LazyMap.
+    # Entries are deserialized using the options and extended types of this unpacker when they are accessed.
+    # Other types are deserialized as _read_ does.
+    #
+    # This method can't be called while an object is partially read using read_array_header or read_map_header.
+    #
+    # This method could raise the same errors with _read_.
+    #
+    # @return [LazyArray,LazyMap,Object]
+    #
+    def read_lazy
+    end
+
+    #
+    # Reads an object and deserializes only the object at the path of map keys and
+    # array indexes as MessagePack.extract does. The whole object is consumed.
+    #
+    # This method could raise the same errors with _read_.
+    #
+    # @return [Object] the deserialized object, or nil if the path doesn't exist
+    #
+    def dig(*path)
+    end
+
+    #
+    # Deserializes an object and ignores it. This method is faster than _read_
+    # because it only advances the buffer and doesn't create objects.
+    # Nested objects are counted without using the stack of _read_ but
+    # MessagePack::StackError is raised at the same depth.
     #
     # This method could raise the same errors with _read_.
     #
@@ -62,6 +116,37 @@ module MessagePack
     def skip
     end
 
+    #
+    # Deserializes up to _max_ objects from the internal buffer and returns them.
+    # This method doesn't read data from the io. It returns fewer objects, or an
+    # empty Array, if the buffer doesn't have enough data. A partially read object
+    # is kept and completed when more data is fed.
+    #
+    # This method could raise the same errors with _read_ excepting EOFError.
+    #
+    # @param max [Integer]
+    # @return [Array] deserialized objects
+    #
+    def read_many(max)
+    end
+
+    #
+    # Deserializes an Array of Hashes, such as a list of records, into a Hash of columns.
+    # It returns a Hash of each key to an Array of its values in the order of the Hashes.
+    # The Hashes themselves are not created and each key is created only once.
+    # Values of Hashes without a key are nil.
+    #
+    #   unpacker.feed(MessagePack.pack([{"ts" => 1, "v" => 2.5}, {"ts" => 2}]))
+    #   unpacker.read_columns  #=> {"ts" => [1, 2], "v" => [2.5, nil]}
+    #
+    # If the object is not an Array of Hashes, it raises MessagePack::TypeError.
+    # This method could raise the same errors with _read_.
+    #
+    # @return [Hash] key to Array of values
+    #
+    def read_columns
+    end
+
     #
     # Deserializes a nil value if it exists and returns _true_.
     # Otherwise, if a byte exists but the byte doesn't represent nil value,
@@ -108,6 +193,17 @@ module MessagePack
     def feed(data)
     end
 
+    #
+    # Appends data into the internal buffer without copying it. Data of 4KB or
+    # larger is referred to until all of its bytes are read, so it must not be
+    # modified until then. Shorter data is copied as feed does.
+    #
+    # @param data [String]
+    # @return [Unpacker] self
+    #
+    def feed_reference(data)
+    end
+
     #
     # Repeats to deserialize objects.
     #
@@ -124,10 +220,51 @@ module MessagePack
     def each(&block)
     end
 
+    #
+    # Repeats to deserialize objects as _each_ does, and yields them in Arrays of _size_ objects.
+    # Objects deserialized before the end of data are yielded in a shorter Array.
+    # This method reduces calls of the block for streams of small objects.
+    #
+    # This method could raise same errors with _read_ excepting EOFError.
+    #
+    # @param size [Integer]
+    # @yieldparam objects [Array] deserialized objects
+    # @return nil
+    #
+    def each_batch(size, &block)
+    end
+
+    #
+    # Repeats to read tokens of objects from the buffer and the io, and yields them as events
+    # instead of deserializing Arrays and Hashes. Memory usage doesn't grow with size of documents.
+    #
+    #   [:array_start, n]     beginning of an Array of n elements
+    #   [:map_start, n]       beginning of a Hash of n pairs (keys and values follow alternately)
+    #   [:value, object]      nil, true, false, Integer, Float or String
+    #   [:ext, type, data]    extended type with its payload as is; registered types are not applied
+    #   [:end]                end of the innermost Array or Hash
+    #
+    # Options symbolize_keys, freeze, max_depth and the limits of sizes are applied.
+    # Switching between this method and _read_ in the middle of an object raises UnpackError.
+    #
+    # C extensions can read events without calling blocks through
+    # msgpack_unpacker_read_event and msgpack_unpacker_each_event declared in unpacker.h.
+    #
+    # This method could raise same errors with _read_ excepting EOFError.
+    #
+    # @yieldparam event [Array] event
+    # @return nil
+    #
+    def each_event(&block)
+    end
+
     #
     # Appends data into the internal buffer and repeats to deserialize objects.
     # This method is equivalent to unpacker.feed(data) && unpacker.each { ... }.
     #
+    # Unless an io is set, data of 4KB or larger is referred to instead of being copied into the
+    # buffer, and the reference is dropped once all of its bytes are read.
+    #
     # @param data [String]
     # @yieldparam object [Object] deserialized object
     # @return nil
@@ -184,7 +321,48 @@ module MessagePack
     # @overload register_exttype(typenr, false)
     #   Prohibit unpacking of extended type _typenr_. UnpackerError exception will be raised if extended type _typenr_ is encountered.
     #
-    def register_exttype typenr, arg
+    # A Hash of options can be given after _typenr_ and the target in all variants.
+    # Registering _typenr_ again without options resets them.
+    #
+    # Supported options:
+    #
+    # * *:payload* how _data_ is passed to the target: +:string+ (default) is a new String,
+    #   +:shared+ is a frozen String which refers to the memory of the fed String without copying it
+    #   where possible, and +:buffer+ is a MessagePack::Buffer which holds the payload by reference
+    #   even if it's split in multiple fed chunks. Large payloads don't need to be copied with
+    #   +:shared+ or +:buffer+.
+    #
+    #   unpacker.register_exttype(1, :payload => :buffer) {|type, data| data.read(4) }
+    #
+    def register_exttype typenr, arg, options={}
+    end
+
+    #
+    # Registers a class to deserialize maps with exactly the given set of keys into, instead of Hashes.
+    # Keys are compared with names of String or Symbol keys, regardless of their order in maps.
+    #
+    # The object is allocated without calling _initialize_, so _klass_ must have an allocator;
+    # classes such as Integer raise TypeError. If _klass_ is a Struct,
+    # the value of each key is set to the member of the same name. Otherwise it's set to
+    # the instance variable of the name prefixed with @.
+    #
+    # Maps matching with no registered shape are deserialized into Hashes.
+    # A shape registered later takes precedence over ones registered before with the same keys.
+    #
+    #   Point = Struct.new(:x, :y)
+    #   unpacker.register_shape(Point)
+    #   unpacker.feed(MessagePack.pack({"y" => 2, "x" => 1})).read  #=> #<struct Point x=1, y=2>
+    #
+    # @param klass [Class]
+    # @param options [Hash]
+    #
+    # Supported options:
+    #
+    # * *:keys* Array of Symbols or Strings. Required unless _klass_ is a Struct, for which the members are used by default.
+    #
+    # @return nil
+    #
+    def register_shape(klass, options={})
     end
 
     #
@@ -154,6 +154,17 @@ void msgpack_buffer_clear(msgpack_buffer_t* b)
     }
 }
 
+void msgpack_buffer_rewind(msgpack_buffer_t* b)
+{
+    if(b->head == &b->tail && b->tail.mapped_string == NO_MAPPED_STRING) {
+        /* keep the memory to write again */
+        b->tail.last = b->tail.first;
+        b->read_buffer = b->tail.first;
+        return;
+    }
+    msgpack_buffer_clear(b);
+}
+
 size_t msgpack_buffer_read_to_string_nonblock(msgpack_buffer_t* b, VALUE string, size_t length)
 {
     size_t avail = msgpack_buffer_top_readable_size(b);
@@ -244,6 +255,30 @@ size_t msgpack_buffer_all_readable_size(const msgpack_buffer_t* b)
     }
 }
 
+char* msgpack_buffer_readable_pointer_at(msgpack_buffer_t* b, size_t offset, size_t length)
+{
+    /* returns NULL unless length bytes at offset are contiguous */
+    char* first = b->read_buffer;
+    msgpack_buffer_chunk_t* c = b->head;
+
+    while(true) {
+        size_t avail = c->last - first;
+        if(offset < avail) {
+            if(avail - offset < length) {
+                return NULL;
+            }
+            return first + offset;
+        }
+        offset -= avail;
+
+        if(c == &b->tail) {
+            return NULL;
+        }
+        c = c->next;
+        first = c->first;
+    }
+}
+
 bool _msgpack_buffer_read_all2(msgpack_buffer_t* b, char* buffer, size_t length)
 {
     if(!msgpack_buffer_ensure_readable(b, length)) {
@@ -335,7 +370,7 @@ void _msgpack_buffer_append_long_string(msgpack_buffer_t* b, VALUE string)
 {
     size_t length = RSTRING_LEN(string);
 
-    if(b->io != Qnil) {
+    if(msgpack_buffer_can_flush_to_io(b)) {
         msgpack_buffer_flush(b);
 #ifdef COMPAT_HAVE_ENCODING
         if (ENCODING_GET(string) == msgpack_rb_encindex_ascii8bit) {
@@ -359,6 +394,28 @@ void _msgpack_buffer_append_long_string(msgpack_buffer_t* b, VALUE string)
     }
 }
 
+size_t msgpack_buffer_append_string_reference(msgpack_buffer_t* b, VALUE string)
+{
+    size_t length = RSTRING_LEN(string);
+
+    if(length < MSGPACK_BUFFER_STRING_FEED_REFERENCE_MINIMUM || STR_DUP_LIKELY_DOES_COPY(string)) {
+        msgpack_buffer_append(b, RSTRING_PTR(string), length);
+        return length;
+    }
+
+    msgpack_buffer_release_read_references(b);
+    _msgpack_buffer_append_reference(b, string);
+
+    return length;
+}
+
+void msgpack_buffer_release_read_references(msgpack_buffer_t* b)
+{
+    if(b->head->mapped_string != NO_MAPPED_STRING && msgpack_buffer_all_readable_size(b) == 0) {
+        msgpack_buffer_clear(b);
+    }
+}
+
 static inline void* _msgpack_buffer_chunk_malloc(
         msgpack_buffer_t* b, msgpack_buffer_chunk_t* c,
         size_t required_size, size_t* allocated_size)
@@ -429,7 +486,7 @@ static inline void* _msgpack_buffer_chunk_realloc(
 
 void _msgpack_buffer_expand(msgpack_buffer_t* b, const char* data, size_t length, bool flush_to_io)
 {
-    if(flush_to_io && b->io != Qnil) {
+    if(flush_to_io && msgpack_buffer_can_flush_to_io(b)) {
         msgpack_buffer_flush(b);
         if(msgpack_buffer_writable_size(b) >= length) {
             /* data == NULL means ensure_writable */
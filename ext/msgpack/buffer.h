@@ -39,6 +39,11 @@
 #define MSGPACK_BUFFER_STRING_READ_REFERENCE_MINIMUM 256
 #endif
 
+/* shorter Strings are copied by msgpack_buffer_append_string_reference */
+#ifndef MSGPACK_BUFFER_STRING_FEED_REFERENCE_MINIMUM
+#define MSGPACK_BUFFER_STRING_FEED_REFERENCE_MINIMUM (4*1024)
+#endif
+
 #ifndef MSGPACK_BUFFER_IO_BUFFER_SIZE_DEFAULT
 #define MSGPACK_BUFFER_IO_BUFFER_SIZE_DEFAULT (32*1024)
 #endif
@@ -115,6 +120,12 @@ struct msgpack_buffer_t {
     size_t read_reference_threshold;
     size_t io_buffer_size;
 
+    /* while > 0, written data stays in the buffer even if io is set */
+    unsigned int io_flush_locks;
+
+    /* while > 0, readable data can't be read or cleared by Ruby methods */
+    unsigned int read_locks;
+
     VALUE owner;
 };
 
@@ -133,6 +144,9 @@ void msgpack_buffer_mark(msgpack_buffer_t* b);
 
 void msgpack_buffer_clear(msgpack_buffer_t* b);
 
+/* same as msgpack_buffer_clear but keeps the tail chunk memory if possible */
+void msgpack_buffer_rewind(msgpack_buffer_t* b);
+
 static inline void msgpack_buffer_set_write_reference_threshold(msgpack_buffer_t* b, size_t length)
 {
     if(length < MSGPACK_BUFFER_STRING_WRITE_REFERENCE_MINIMUM) {
@@ -173,6 +187,38 @@ static inline void msgpack_buffer_reset(msgpack_buffer_t* b)
     msgpack_buffer_reset_io(b);
 }
 
+static inline void msgpack_buffer_lock_io_flush(msgpack_buffer_t* b)
+{
+    b->io_flush_locks++;
+}
+
+static inline void msgpack_buffer_unlock_io_flush(msgpack_buffer_t* b)
+{
+    b->io_flush_locks--;
+}
+
+static inline bool msgpack_buffer_can_flush_to_io(msgpack_buffer_t* b)
+{
+    return b->io != Qnil && b->io_flush_locks == 0;
+}
+
+static inline void msgpack_buffer_lock_read(msgpack_buffer_t* b)
+{
+    b->read_locks++;
+}
+
+static inline void msgpack_buffer_unlock_read(msgpack_buffer_t* b)
+{
+    b->read_locks--;
+}
+
+static inline void msgpack_buffer_check_read_lock(msgpack_buffer_t* b)
+{
+    if(b->read_locks > 0) {
+        rb_raise(rb_eRuntimeError, "buffer can't be read while a stream is being written");
+    }
+}
+
 
 /*
  * writer functions
@@ -183,6 +229,17 @@ static inline size_t msgpack_buffer_writable_size(const msgpack_buffer_t* b)
     return b->tail_buffer_end - b->tail.last;
 }
 
+/* to write data directly after msgpack_buffer_ensure_writable */
+static inline char* msgpack_buffer_writable_pointer(msgpack_buffer_t* b)
+{
+    return b->tail.last;
+}
+
+static inline void msgpack_buffer_written(msgpack_buffer_t* b, size_t length)
+{
+    b->tail.last += length;
+}
+
 static inline void msgpack_buffer_write_1(msgpack_buffer_t* b, int byte)
 {
     (*b->tail.last++) = (char) byte;
@@ -208,7 +265,7 @@ size_t msgpack_buffer_flush_to_io(msgpack_buffer_t* b, VALUE io, ID write_method
 
 static inline size_t msgpack_buffer_flush(msgpack_buffer_t* b)
 {
-    if(b->io == Qnil) {
+    if(!msgpack_buffer_can_flush_to_io(b)) {
         return 0;
     }
     return msgpack_buffer_flush_to_io(b, b->io, b->io_write_all_method, true);
@@ -262,6 +319,19 @@ static inline size_t msgpack_buffer_append_string(msgpack_buffer_t* b, VALUE str
     return length;
 }
 
+/*
+ * Appends a String to be read without copying its bytes unless it's short.
+ * The buffer refers to the String until msgpack_buffer_clear is called or
+ * the bytes are consumed.
+ */
+size_t msgpack_buffer_append_string_reference(msgpack_buffer_t* b, VALUE string);
+
+/*
+ * Drops chunks referring to Strings if all bytes are read, so that the
+ * Strings aren't kept until the next append.
+ */
+void msgpack_buffer_release_read_references(msgpack_buffer_t* b);
+
 
 /*
  * IO functions
@@ -282,8 +352,15 @@ static inline size_t msgpack_buffer_top_readable_size(const msgpack_buffer_t* b)
     return b->head->last - b->read_buffer;
 }
 
+static inline const char* msgpack_buffer_top_readable_pointer(const msgpack_buffer_t* b)
+{
+    return b->read_buffer;
+}
+
 size_t msgpack_buffer_all_readable_size(const msgpack_buffer_t* b);
 
+char* msgpack_buffer_readable_pointer_at(msgpack_buffer_t* b, size_t offset, size_t length);
+
 bool _msgpack_buffer_shift_chunk(msgpack_buffer_t* b);
 
 static inline void _msgpack_buffer_consumed(msgpack_buffer_t* b, size_t length)
@@ -379,6 +456,23 @@ static inline union msgpack_buffer_cast_block_t* msgpack_buffer_read_cast_block(
     return &b->cast_block;
 }
 
+/* reads n bytes into *cb, which is usually a local variable. Bytes in the top chunk are
+ * loaded directly, and bytes across chunks are copied through b->cast_block so that
+ * the address of cb doesn't escape and compilers can keep it in registers. */
+static inline bool msgpack_buffer_read_cast_block_to(msgpack_buffer_t* b, union msgpack_buffer_cast_block_t* cb, size_t n)
+{
+    if(msgpack_buffer_top_readable_size(b) >= n) {
+        memcpy(cb->buffer, b->read_buffer, n);
+        _msgpack_buffer_consumed(b, n);
+        return true;
+    }
+    if(!_msgpack_buffer_read_all2(b, b->cast_block.buffer, n)) {
+        return false;
+    }
+    *cb = b->cast_block;
+    return true;
+}
+
 size_t msgpack_buffer_read_to_string_nonblock(msgpack_buffer_t* b, VALUE string, size_t length);
 
 static inline size_t msgpack_buffer_read_to_string(msgpack_buffer_t* b, VALUE string, size_t length)
@@ -151,6 +151,7 @@ static VALUE Buffer_initialize(int argc, VALUE* argv, VALUE self)
 static VALUE Buffer_clear(VALUE self)
 {
     BUFFER(self, b);
+    msgpack_buffer_check_read_lock(b);
     msgpack_buffer_clear(b);
     return Qnil;
 }
@@ -292,6 +293,7 @@ static inline VALUE read_all(msgpack_buffer_t* b, VALUE out)
 static VALUE Buffer_skip(VALUE self, VALUE sn)
 {
     BUFFER(self, b);
+    msgpack_buffer_check_read_lock(b);
 
     unsigned long n = FIX2ULONG(sn);
 
@@ -307,6 +309,7 @@ static VALUE Buffer_skip(VALUE self, VALUE sn)
 static VALUE Buffer_skip_all(VALUE self, VALUE sn)
 {
     BUFFER(self, b);
+    msgpack_buffer_check_read_lock(b);
 
     unsigned long n = FIX2ULONG(sn);
 
@@ -345,6 +348,7 @@ static VALUE Buffer_read_all(int argc, VALUE* argv, VALUE self)
     }
 
     BUFFER(self, b);
+    msgpack_buffer_check_read_lock(b);
 
     if(out != Qnil) {
         CHECK_STRING_TYPE(out);
@@ -391,6 +395,7 @@ static VALUE Buffer_read(int argc, VALUE* argv, VALUE self)
     }
 
     BUFFER(self, b);
+    msgpack_buffer_check_read_lock(b);
 
     if(out != Qnil) {
         CHECK_STRING_TYPE(out);
@@ -468,6 +473,7 @@ static VALUE Buffer_close(VALUE self)
 static VALUE Buffer_write_to(VALUE self, VALUE io)
 {
     BUFFER(self, b);
+    msgpack_buffer_check_read_lock(b);
     size_t sz = msgpack_buffer_flush_to_io(b, io, s_write, true);
     return ULONG2NUM(sz);
 }
@@ -110,5 +110,22 @@
 #endif
 
 
+/*
+ * RARRAY_AREF
+ */
+#ifndef RARRAY_AREF  /* MRI < 2.1 */
+#  define RARRAY_AREF(a, i) (RARRAY_PTR(a)[i])
+#endif
+
+
+/*
+ * RB_BLOCK_CALL_FUNC_ARGLIST
+ */
+#ifndef RB_BLOCK_CALL_FUNC_ARGLIST  /* MRI < 2.1 */
+#  define RB_BLOCK_CALL_FUNC_ARGLIST(yielded_arg, callback_arg) \
+    VALUE yielded_arg, VALUE callback_arg, int argc, VALUE* argv
+#endif
+
+
 #endif
 
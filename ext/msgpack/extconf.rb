@@ -2,10 +2,19 @@ require 'mkmf'
 
 have_header("ruby/st.h")
 have_header("st.h")
+have_header("ruby/thread.h")
 have_func("rb_str_replace", ["ruby.h"])
 have_func("rb_intern_str", ["ruby.h"])
 have_func("rb_sym2str", ["ruby.h"])
 have_func("rb_str_intern", ["ruby.h"])
+have_func("rb_check_symbol_cstr", ["ruby.h"])
+have_func("rb_str_scrub", ["ruby.h"])
+have_func("rb_ary_new_from_values", ["ruby.h"])
+have_func("rb_hash_new_capa", ["ruby.h"])
+have_func("rb_hash_bulk_insert", ["ruby.h"])
+have_func("rb_integer_pack", ["ruby.h"])
+have_func("rb_integer_unpack", ["ruby.h"])
+have_func("rb_thread_call_without_gvl", ["ruby/thread.h"])
 
 unless RUBY_PLATFORM.include? 'mswin'
   $CFLAGS << %[ -I.. -Wall -O3 -g -std=c99]
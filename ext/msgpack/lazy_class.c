@@ -0,0 +1,520 @@
+/*
+ * MessagePack for Ruby
+ *
+ * Copyright (C) 2008-2013 Sadayuki Furuhashi
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include "lazy_class.h"
+#include "unpacker_class.h"
+#include "scan.h"
+
+VALUE cMessagePack_LazyArray;
+VALUE cMessagePack_LazyMap;
+
+static ID s_dig;
+
+/*
+ * A LazyArray or LazyMap refers to bytes of a serialized array or map.
+ * Offsets of entries are indexed when an entry is accessed for the first time.
+ * Keys and values of a map are stored as separated entries (2 entries per pair).
+ */
+typedef struct {
+    VALUE source;    /* frozen String */
+    VALUE decoder;   /* Unpacker */
+    size_t start;    /* offset of the header */
+    size_t offset;   /* offset of the first entry */
+    size_t end;
+    size_t count;    /* number of entries */
+    size_t* index;   /* offsets of entries followed by end, or NULL */
+    VALUE* cache;    /* deserialized entries or Qundef */
+    bool map;
+} msgpack_lazy_t;
+
+#define LAZY(from, name) \
+    msgpack_lazy_t *name = NULL; \
+    Data_Get_Struct(from, msgpack_lazy_t, name); \
+    if(name == NULL) { \
+        rb_raise(rb_eArgError, "NULL found for " # name " when shouldn't be."); \
+    }
+
+static void Lazy_mark(msgpack_lazy_t* lz)
+{
+    rb_gc_mark(lz->source);
+    rb_gc_mark(lz->decoder);
+    if(lz->cache != NULL) {
+        size_t i;
+        for(i=0; i < lz->count; i++) {
+            if(lz->cache[i] != Qundef) {
+                rb_gc_mark(lz->cache[i]);
+            }
+        }
+    }
+}
+
+static void Lazy_free(msgpack_lazy_t* lz)
+{
+    if(lz == NULL) {
+        return;
+    }
+    xfree(lz->index);
+    xfree(lz->cache);
+    xfree(lz);
+}
+
+VALUE MessagePack_Lazy_new(VALUE source, VALUE decoder, size_t offset, size_t size)
+{
+    msgpack_scan_header_t h;
+    int r = msgpack_scan_header(RSTRING_PTR(source) + offset, size, &h);
+    if(r < 0) {
+        raise_unpacker_error(r);
+    }
+
+    msgpack_lazy_t* lz = ALLOC_N(msgpack_lazy_t, 1);
+    memset(lz, 0, sizeof(msgpack_lazy_t));
+    lz->source = source;
+    lz->decoder = decoder;
+    lz->start = offset;
+    lz->offset = offset + h.header_size;
+    lz->end = offset + size;
+    lz->map = h.type == TYPE_MAP;
+    lz->count = lz->map ? h.count * 2 : h.count;
+
+    VALUE klass = lz->map ? cMessagePack_LazyMap : cMessagePack_LazyArray;
+    return Data_Wrap_Struct(klass, Lazy_mark, Lazy_free, lz);
+}
+
+static void _lazy_build_index(msgpack_lazy_t* lz)
+{
+    size_t* index = ALLOC_N(size_t, lz->count + 1);
+    VALUE* cache = ALLOC_N(VALUE, lz->count == 0 ? 1 : lz->count);
+
+    const char* p = RSTRING_PTR(lz->source);
+    size_t pos = lz->offset;
+    size_t i;
+    for(i=0; i < lz->count; i++) {
+        size_t size;
+        int r = msgpack_scan_skip(p + pos, lz->end - pos, &size);
+        if(r < 0) {
+            xfree(index);
+            xfree(cache);
+            raise_unpacker_error(r);
+        }
+        index[i] = pos;
+        cache[i] = Qundef;
+        pos += size;
+    }
+    index[lz->count] = pos;
+
+    lz->index = index;
+    lz->cache = cache;
+}
+
+static inline void _lazy_ensure_index(msgpack_lazy_t* lz)
+{
+    if(lz->index == NULL) {
+        _lazy_build_index(lz);
+    }
+}
+
+static VALUE _lazy_decode(VALUE decoder, VALUE source, size_t pos, size_t length)
+{
+    msgpack_unpacker_t* uk;
+    Data_Get_Struct(decoder, msgpack_unpacker_t, uk);
+    msgpack_buffer_t* b = UNPACKER_BUFFER_(uk);
+
+    _msgpack_unpacker_reset(uk);
+
+    if(length >= MSGPACK_BUFFER_STRING_WRITE_REFERENCE_MINIMUM) {
+        /* refers the source instead of copying long strings */
+        msgpack_buffer_append_string(b, rb_str_substr(source, pos, length));
+    } else {
+        msgpack_buffer_append(b, RSTRING_PTR(source) + pos, length);
+    }
+
+    int r = msgpack_unpacker_read(uk, 0);
+    if(r < 0) {
+        _msgpack_unpacker_reset(uk);
+        raise_unpacker_error(r);
+    }
+
+    return msgpack_unpacker_get_last_object(uk);
+}
+
+static VALUE _lazy_decode_key(VALUE decoder, VALUE source, size_t pos, size_t length)
+{
+    VALUE v = _lazy_decode(decoder, source, pos, length);
+    if(rb_type(v) == T_STRING) {
+        msgpack_unpacker_t* uk;
+        Data_Get_Struct(decoder, msgpack_unpacker_t, uk);
+        if(uk->symbolize_keys) {
+            v = msgpack_unpacker_symbolize_key(v);
+        }
+    }
+    return v;
+}
+
+static VALUE _lazy_entry(msgpack_lazy_t* lz, size_t i)
+{
+    _lazy_ensure_index(lz);
+
+    VALUE v = lz->cache[i];
+    if(v != Qundef) {
+        return v;
+    }
+
+    size_t pos = lz->index[i];
+    size_t length = lz->index[i+1] - pos;
+
+    msgpack_scan_header_t h;
+    int r = msgpack_scan_header(RSTRING_PTR(lz->source) + pos, length, &h);
+    if(r < 0) {
+        raise_unpacker_error(r);
+    }
+
+    if(lz->map && i % 2 == 0) {
+        v = _lazy_decode_key(lz->decoder, lz->source, pos, length);
+    } else if(msgpack_scan_header_is_container(&h)) {
+        v = MessagePack_Lazy_new(lz->source, lz->decoder, pos, length);
+    } else {
+        v = _lazy_decode(lz->decoder, lz->source, pos, length);
+    }
+
+    lz->cache[i] = v;
+    return v;
+}
+
+static inline bool _lazy_string_is_ascii(VALUE str)
+{
+#ifdef COMPAT_HAVE_ENCODING
+    return rb_enc_str_asciionly_p(str);
+#else
+    return true;
+#endif
+}
+
+/*
+ * Returns bytes of the key if the key can be equal to deserialized strings,
+ * which are Symbols if symbolize_keys is set. Otherwise, returns Qnil.
+ */
+static VALUE _lazy_key_name(VALUE decoder, VALUE key)
+{
+    msgpack_unpacker_t* uk;
+    Data_Get_Struct(decoder, msgpack_unpacker_t, uk);
+
+    if(uk->symbolize_keys) {
+        if(SYMBOL_P(key)) {
+#ifdef HAVE_RB_SYM2STR
+            return rb_sym2str(key);
+#else
+            return rb_id2str(SYM2ID(key));
+#endif
+        }
+    } else if(rb_type(key) == T_STRING) {
+        return key;
+    }
+    return Qnil;
+}
+
+/* compares a serialized key with _key_. _name_ is the result of _lazy_key_name */
+static bool _lazy_key_match(VALUE decoder, VALUE source, size_t pos, size_t length, VALUE key, VALUE name)
+{
+    const char* p = RSTRING_PTR(source) + pos;
+    msgpack_scan_header_t h;
+    if(msgpack_scan_header(p, length, &h) < 0) {
+        return false;
+    }
+    bool raw = h.type == TYPE_STRING || h.type == TYPE_BINARY;
+
+    if(name == Qnil) {
+        /* raw keys are deserialized to Strings or Symbols */
+        if(raw) {
+            return false;
+        }
+    } else {
+        if(!raw) {
+            return false;
+        }
+        /* compares bytes without deserializing the key */
+        if(h.count != (size_t) RSTRING_LEN(name) ||
+                memcmp(p + h.header_size, RSTRING_PTR(name), h.count) != 0) {
+            return false;
+        }
+        if(_lazy_string_is_ascii(name)) {
+            return true;
+        }
+        /* encodings of non-ASCII strings affect equality */
+    }
+
+    return rb_eql(_lazy_decode_key(decoder, source, pos, length), key);
+}
+
+static bool _lazy_map_find(msgpack_lazy_t* lz, VALUE key, size_t* result)
+{
+    _lazy_ensure_index(lz);
+
+    VALUE name = _lazy_key_name(lz->decoder, key);
+
+    /* the last one wins if keys are duplicated as Hash does */
+    size_t i = lz->count;
+    while(i > 0) {
+        i -= 2;
+        bool match;
+        if(lz->cache[i] != Qundef) {
+            match = rb_eql(lz->cache[i], key);
+        } else {
+            match = _lazy_key_match(lz->decoder, lz->source,
+                    lz->index[i], lz->index[i+1] - lz->index[i], key, name);
+        }
+        if(match) {
+            *result = i + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void _lazy_skip(VALUE source, size_t pos, size_t end, size_t* size)
+{
+    int r = msgpack_scan_skip(RSTRING_PTR(source) + pos, end - pos, size);
+    if(r < 0) {
+        raise_unpacker_error(r);
+    }
+}
+
+/* moves *pos and *length to the entry of the container. returns false if it's not found */
+static bool _lazy_find_entry(VALUE decoder, VALUE source, size_t* pos, size_t* length, VALUE key)
+{
+    size_t end = *pos + *length;
+
+    msgpack_scan_header_t h;
+    int r = msgpack_scan_header(RSTRING_PTR(source) + *pos, *length, &h);
+    if(r < 0) {
+        raise_unpacker_error(r);
+    }
+    size_t e = *pos + h.header_size;
+
+    if(h.type == TYPE_ARRAY) {
+        if(!rb_obj_is_kind_of(key, rb_cInteger)) {
+            return false;
+        }
+        long n = NUM2LONG(key);
+        if(n < 0) {
+            n += (long) h.count;
+        }
+        if(n < 0 || (size_t) n >= h.count) {
+            return false;
+        }
+        size_t size;
+        for(; n > 0; n--) {
+            _lazy_skip(source, e, end, &size);
+            e += size;
+        }
+        _lazy_skip(source, e, end, &size);
+        *pos = e;
+        *length = size;
+        return true;
+
+    } else if(h.type == TYPE_MAP) {
+        VALUE name = _lazy_key_name(decoder, key);
+        bool found = false;
+        size_t i;
+        for(i=0; i < h.count; i++) {
+            size_t ksize, vsize;
+            _lazy_skip(source, e, end, &ksize);
+            _lazy_skip(source, e + ksize, end, &vsize);
+            /* the last one wins if keys are duplicated as Hash does */
+            if(_lazy_key_match(decoder, source, e, ksize, key, name)) {
+                found = true;
+                *pos = e + ksize;
+                *length = vsize;
+            }
+            e += ksize + vsize;
+        }
+        return found;
+    }
+
+    return false;
+}
+
+VALUE MessagePack_Lazy_extract(VALUE source, VALUE decoder, size_t offset, size_t size, int pathc, const VALUE* path)
+{
+    size_t pos = offset;
+    size_t length = size;
+    int i;
+    for(i=0; i < pathc; i++) {
+        if(!_lazy_find_entry(decoder, source, &pos, &length, path[i])) {
+            return Qnil;
+        }
+    }
+    return _lazy_decode(decoder, source, pos, length);
+}
+
+static VALUE _lazy_aref(VALUE self, VALUE key)
+{
+    LAZY(self, lz);
+
+    if(lz->map) {
+        size_t i;
+        if(!_lazy_map_find(lz, key, &i)) {
+            return Qnil;
+        }
+        return _lazy_entry(lz, i);
+    }
+
+    long n = NUM2LONG(key);
+    if(n < 0) {
+        n += (long) lz->count;
+        if(n < 0) {
+            return Qnil;
+        }
+    }
+    if((size_t) n >= lz->count) {
+        return Qnil;
+    }
+    return _lazy_entry(lz, (size_t) n);
+}
+
+static inline bool _lazy_p(VALUE v)
+{
+    return rb_obj_class(v) == cMessagePack_LazyArray || rb_obj_class(v) == cMessagePack_LazyMap;
+}
+
+static VALUE Lazy_aref(VALUE self, VALUE key)
+{
+    return _lazy_aref(self, key);
+}
+
+static VALUE Lazy_dig(int argc, VALUE* argv, VALUE self)
+{
+    if(argc == 0) {
+        rb_raise(rb_eArgError, "wrong number of arguments (0 for 1+)");
+    }
+
+    VALUE v = self;
+    int i;
+    for(i=0; i < argc; i++) {
+        if(!_lazy_p(v)) {
+            return rb_funcall2(v, s_dig, argc - i, argv + i);
+        }
+        v = _lazy_aref(v, argv[i]);
+        if(v == Qnil) {
+            return Qnil;
+        }
+    }
+    return v;
+}
+
+static VALUE Lazy_size(VALUE self)
+{
+    LAZY(self, lz);
+    return SIZET2NUM(lz->map ? lz->count / 2 : lz->count);
+}
+
+static VALUE Lazy_empty_p(VALUE self)
+{
+    LAZY(self, lz);
+    return lz->count == 0 ? Qtrue : Qfalse;
+}
+
+static VALUE Lazy_materialize(VALUE self)
+{
+    LAZY(self, lz);
+    return _lazy_decode(lz->decoder, lz->source, lz->start, lz->end - lz->start);
+}
+
+static VALUE LazyArray_each(VALUE self)
+{
+    LAZY(self, lz);
+
+#ifdef RETURN_ENUMERATOR
+    RETURN_ENUMERATOR(self, 0, 0);
+#endif
+
+    size_t i;
+    for(i=0; i < lz->count; i++) {
+        rb_yield(_lazy_entry(lz, i));
+    }
+    return self;
+}
+
+static VALUE LazyMap_each(VALUE self)
+{
+    LAZY(self, lz);
+
+#ifdef RETURN_ENUMERATOR
+    RETURN_ENUMERATOR(self, 0, 0);
+#endif
+
+    size_t i;
+    for(i=0; i < lz->count; i += 2) {
+        VALUE k = _lazy_entry(lz, i);
+        VALUE v = _lazy_entry(lz, i+1);
+        rb_yield(rb_assoc_new(k, v));
+    }
+    return self;
+}
+
+static VALUE LazyMap_key_p(VALUE self, VALUE key)
+{
+    LAZY(self, lz);
+    size_t i;
+    return _lazy_map_find(lz, key, &i) ? Qtrue : Qfalse;
+}
+
+static VALUE LazyMap_keys(VALUE self)
+{
+    LAZY(self, lz);
+
+    VALUE keys = rb_ary_new2(lz->count / 2);
+    size_t i;
+    for(i=0; i < lz->count; i += 2) {
+        rb_ary_push(keys, _lazy_entry(lz, i));
+    }
+    return keys;
+}
+
+void MessagePack_Lazy_module_init(VALUE mMessagePack)
+{
+    s_dig = rb_intern("dig");
+
+    cMessagePack_LazyArray = rb_define_class_under(mMessagePack, "LazyArray", rb_cObject);
+    rb_undef_alloc_func(cMessagePack_LazyArray);
+    rb_include_module(cMessagePack_LazyArray, rb_mEnumerable);
+
+    rb_define_method(cMessagePack_LazyArray, "[]", Lazy_aref, 1);
+    rb_define_method(cMessagePack_LazyArray, "dig", Lazy_dig, -1);
+    rb_define_method(cMessagePack_LazyArray, "each", LazyArray_each, 0);
+    rb_define_method(cMessagePack_LazyArray, "size", Lazy_size, 0);
+    rb_define_alias(cMessagePack_LazyArray, "length", "size");
+    rb_define_method(cMessagePack_LazyArray, "empty?", Lazy_empty_p, 0);
+    rb_define_method(cMessagePack_LazyArray, "to_a", Lazy_materialize, 0);
+
+    cMessagePack_LazyMap = rb_define_class_under(mMessagePack, "LazyMap", rb_cObject);
+    rb_undef_alloc_func(cMessagePack_LazyMap);
+    rb_include_module(cMessagePack_LazyMap, rb_mEnumerable);
+
+    rb_define_method(cMessagePack_LazyMap, "[]", Lazy_aref, 1);
+    rb_define_method(cMessagePack_LazyMap, "dig", Lazy_dig, -1);
+    rb_define_method(cMessagePack_LazyMap, "each", LazyMap_each, 0);
+    rb_define_alias(cMessagePack_LazyMap, "each_pair", "each");
+    rb_define_method(cMessagePack_LazyMap, "size", Lazy_size, 0);
+    rb_define_alias(cMessagePack_LazyMap, "length", "size");
+    rb_define_method(cMessagePack_LazyMap, "empty?", Lazy_empty_p, 0);
+    rb_define_method(cMessagePack_LazyMap, "key?", LazyMap_key_p, 1);
+    rb_define_alias(cMessagePack_LazyMap, "has_key?", "key?");
+    rb_define_alias(cMessagePack_LazyMap, "include?", "key?");
+    rb_define_method(cMessagePack_LazyMap, "keys", LazyMap_keys, 0);
+    rb_define_method(cMessagePack_LazyMap, "to_h", Lazy_materialize, 0);
+}
@@ -0,0 +1,43 @@
+/*
+ * MessagePack for Ruby
+ *
+ * Copyright (C) 2008-2013 Sadayuki Furuhashi
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+#ifndef MSGPACK_RUBY_LAZY_CLASS_H__
+#define MSGPACK_RUBY_LAZY_CLASS_H__
+
+#include "unpacker.h"
+
+extern VALUE cMessagePack_LazyArray;
+extern VALUE cMessagePack_LazyMap;
+
+void MessagePack_Lazy_module_init(VALUE mMessagePack);
+
+/*
+ * Creates a LazyArray or LazyMap which refers to the serialized array or map
+ * at _offset_ of the frozen _source_ string. _decoder_ is an Unpacker used to
+ * deserialize elements.
+ */
+VALUE MessagePack_Lazy_new(VALUE source, VALUE decoder, size_t offset, size_t size);
+
+/*
+ * Deserializes the object at the path of keys and indexes from the object
+ * at _offset_ of _source_. Other entries are skipped without deserializing
+ * them. Returns nil if the path doesn't exist.
+ */
+VALUE MessagePack_Lazy_extract(VALUE source, VALUE decoder, size_t offset, size_t size, int pathc, const VALUE* path);
+
+#endif
+
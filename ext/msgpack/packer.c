@@ -49,10 +49,22 @@ void msgpack_packer_init(msgpack_packer_t* pk)
     pk->io = Qnil;
 
     pk->extended_types = Qnil;
+
+    pk->stack = pk->stack_embedded;
+    pk->stack_capacity = MSGPACK_PACKER_EMBEDDED_STACK_CAPACITY;
+    pk->entries = pk->entries_embedded;
+    pk->entries_capacity = MSGPACK_PACKER_EMBEDDED_ENTRIES_CAPACITY;
+    pk->max_depth = MSGPACK_PACKER_DEFAULT_MAX_DEPTH;
 }
 
 void msgpack_packer_destroy(msgpack_packer_t* pk)
 {
+    if(pk->stack != pk->stack_embedded) {
+        xfree(pk->stack);
+    }
+    if(pk->entries != pk->entries_embedded) {
+        xfree(pk->entries);
+    }
     msgpack_buffer_destroy(PACKER_BUFFER_(pk));
 }
 
@@ -64,12 +76,23 @@ void msgpack_packer_mark(msgpack_packer_t* pk)
     /* msgpack_buffer_mark(PACKER_BUFFER_(pk)); */
     rb_gc_mark(pk->buffer_ref);
     rb_gc_mark(pk->extended_types);
+
+    size_t i;
+    for(i=0; i < pk->stack_depth; ++i) {
+        rb_gc_mark(pk->stack[i].object);
+    }
+    for(i=0; i < pk->entries_size; ++i) {
+        rb_gc_mark(pk->entries[i]);
+    }
 }
 
 void msgpack_packer_reset(msgpack_packer_t* pk)
 {
     msgpack_buffer_clear(PACKER_BUFFER_(pk));
 
+    pk->stack_depth = 0;
+    pk->entries_size = 0;
+
     pk->io = Qnil;
     pk->io_write_all_method = 0;
     pk->buffer_ref = Qnil;
@@ -106,58 +129,71 @@ void msgpack_packer_set_extended_type(msgpack_packer_t* pk, VALUE klass, VALUE t
     }
 }
 
-
-void msgpack_packer_write_array_value(msgpack_packer_t* pk, VALUE v)
+size_t msgpack_packer_begin_stream_header(msgpack_packer_t* pk, bool map)
 {
-    /* actual return type of RARRAY_LEN is long */
-    unsigned long len = RARRAY_LEN(v);
-    if(len > 0xffffffffUL) {
-        rb_raise(rb_eArgError, "size of array is too long to pack: %lu entries, should be <= %lu", len, 0xffffffffUL);
-    }
-    unsigned int len32 = (unsigned int)len;
-    msgpack_packer_write_array_header(pk, len32);
+    msgpack_buffer_t* b = PACKER_BUFFER_(pk);
 
-    unsigned int i;
-    for(i=0; i < len32; ++i) {
-        VALUE e = rb_ary_entry(v, i);
-        msgpack_packer_write_value(pk, e);
-    }
+    /* keep the header in the buffer and at the same offset until the count is known */
+    msgpack_buffer_lock_io_flush(b);
+    msgpack_buffer_lock_read(b);
+
+    /* header bytes must be contiguous so that it can be patched later */
+    msgpack_buffer_ensure_writable(b, 5);
+    size_t offset = msgpack_buffer_all_readable_size(b);
+
+    uint32_t be = 0;
+    msgpack_buffer_write_byte_and_data(b, map ? 0xdf : 0xdd, (const void*)&be, 4);
+
+    return offset;
 }
 
-static int write_hash_foreach(VALUE key, VALUE value, VALUE pk_value)
+void msgpack_packer_end_stream_header(msgpack_packer_t* pk, size_t offset, uint32_t n)
 {
-    if (key == Qundef) {
-        return ST_CONTINUE;
+    msgpack_buffer_t* b = PACKER_BUFFER_(pk);
+
+    msgpack_buffer_unlock_io_flush(b);
+    msgpack_buffer_unlock_read(b);
+
+    char* p = msgpack_buffer_readable_pointer_at(b, offset, 5);
+    if(p == NULL || ((unsigned char) p[0] != 0xdd && (unsigned char) p[0] != 0xdf)) {
+        rb_raise(rb_eRuntimeError, "header of the stream is not in the buffer any longer");
     }
-    msgpack_packer_t* pk = (msgpack_packer_t*) pk_value;
-    msgpack_packer_write_value(pk, key);
-    msgpack_packer_write_value(pk, value);
-    return ST_CONTINUE;
+
+    uint32_t be = _msgpack_be32(n);
+    memcpy(p + 1, &be, 4);
 }
 
-void msgpack_packer_write_hash_value(msgpack_packer_t* pk, VALUE v)
+
+#ifdef HAVE_RB_INTEGER_PACK
+void msgpack_packer_write_bignum_exttype_value(msgpack_packer_t* pk, VALUE v)
 {
-    /* actual return type of RHASH_SIZE is long (if SIZEOF_LONG == SIZEOF_VOIDP
-     * or long long (if SIZEOF_LONG_LONG == SIZEOF_VOIDP. See st.h. */
-    unsigned long len = RHASH_SIZE(v);
-    if(len > 0xffffffffUL) {
-        rb_raise(rb_eArgError, "size of hash is too long to pack: %ld entries, should be <= %lu", len, 0xffffffffUL);
+    int nlz_bits;
+    size_t size = rb_absint_size(v, &nlz_bits);
+    bool positive = RBIGNUM_POSITIVE_P(v);
+
+    /* Integers in the 64-bit range are packed as int 64 or uint 64 */
+    if(positive && size <= 8) {
+        msgpack_packer_write_u64(pk, rb_big2ull(v));
+        return;
+    }
+    if(!positive && (size < 8 || (size == 8 && (nlz_bits > 0 || rb_absint_singlebit_p(v))))) {
+        msgpack_packer_write_long_long(pk, rb_big2ll(v));
+        return;
     }
-    unsigned int len32 = (unsigned int)len;
-    msgpack_packer_write_map_header(pk, len32);
 
-#ifdef RUBINIUS
-    VALUE iter = rb_funcall(v, s_to_iter, 0);
-    VALUE entry = Qnil;
-    while(RTEST(entry = rb_funcall(iter, s_next, 1, entry))) {
-        VALUE key = rb_funcall(entry, s_key, 0);
-        VALUE val = rb_funcall(entry, s_value, 0);
-        write_hash_foreach(key, val, (VALUE) pk);
+    /* payload is a sign byte (0: positive, 1: negative) and big-endian magnitude */
+    if(size > 0xfffffffeUL) {
+        rb_raise(rb_eArgError, "size of integer is too long to pack: %lu bytes", (unsigned long) size);
     }
-#else
-    rb_hash_foreach(v, write_hash_foreach, (VALUE) pk);
-#endif
+    msgpack_packer_write_exttype_header(pk, size + 1, pk->bignum_exttype);
+
+    msgpack_buffer_t* b = PACKER_BUFFER_(pk);
+    msgpack_buffer_ensure_writable(b, size + 1);
+    msgpack_buffer_write_1(b, positive ? 0 : 1);
+    rb_integer_pack(v, msgpack_buffer_writable_pointer(b), size, 1, 0, INTEGER_PACK_BIG_ENDIAN);
+    msgpack_buffer_written(b, size);
 }
+#endif
 
 static void _msgpack_packer_write_other_value(msgpack_packer_t* pk, VALUE v)
 {
@@ -229,7 +265,49 @@ static void _msgpack_packer_write_other_value(msgpack_packer_t* pk, VALUE v)
     rb_funcall(v, pk->to_msgpack_method, 1, pk->to_msgpack_arg);
 }
 
-void msgpack_packer_write_value(msgpack_packer_t* pk, VALUE v)
+/*
+ * Nested Arrays and Hashes are packed using an explicit stack instead of
+ * recursion. Each frame refers to an Array or to key-value pairs of a Hash
+ * copied into pk->entries. Leading pairs of a Hash which don't contain
+ * nested objects are written while iterating it and not copied.
+ */
+
+static inline void _msgpack_packer_stack_push(msgpack_packer_t* pk, VALUE object, size_t entries, size_t count)
+{
+    if(pk->stack_depth == pk->stack_capacity) {
+        size_t capacity = pk->stack_capacity * 2;
+        if(pk->stack == pk->stack_embedded) {
+            pk->stack = ALLOC_N(msgpack_packer_stack_t, capacity);
+            memcpy(pk->stack, pk->stack_embedded, sizeof(pk->stack_embedded));
+        } else {
+            REALLOC_N(pk->stack, msgpack_packer_stack_t, capacity);
+        }
+        pk->stack_capacity = capacity;
+    }
+    msgpack_packer_stack_t* next = &pk->stack[pk->stack_depth];
+    next->object = object;
+    next->entries = entries;
+    next->index = 0;
+    next->count = count;
+    pk->stack_depth++;
+}
+
+static inline void _msgpack_packer_entries_push(msgpack_packer_t* pk, VALUE v)
+{
+    if(pk->entries_size == pk->entries_capacity) {
+        size_t capacity = pk->entries_capacity * 2;
+        if(pk->entries == pk->entries_embedded) {
+            pk->entries = ALLOC_N(VALUE, capacity);
+            memcpy(pk->entries, pk->entries_embedded, sizeof(pk->entries_embedded));
+        } else {
+            REALLOC_N(pk->entries, VALUE, capacity);
+        }
+        pk->entries_capacity = capacity;
+    }
+    pk->entries[pk->entries_size++] = v;
+}
+
+static inline void _msgpack_packer_write_scalar_value(msgpack_packer_t* pk, VALUE v)
 {
     switch(rb_type(v)) {
     case T_NIL:
@@ -250,12 +328,6 @@ void msgpack_packer_write_value(msgpack_packer_t* pk, VALUE v)
     case T_STRING:
         msgpack_packer_write_string_value(pk, v);
         break;
-    case T_ARRAY:
-        msgpack_packer_write_array_value(pk, v);
-        break;
-    case T_HASH:
-        msgpack_packer_write_hash_value(pk, v);
-        break;
     case T_BIGNUM:
         msgpack_packer_write_bignum_value(pk, v);
         break;
@@ -267,3 +339,194 @@ void msgpack_packer_write_value(msgpack_packer_t* pk, VALUE v)
     }
 }
 
+static inline bool _msgpack_packer_is_nested(VALUE v)
+{
+    int type = rb_type(v);
+    return type == T_ARRAY || type == T_HASH;
+}
+
+struct msgpack_packer_hash_args {
+    msgpack_packer_t* pk;
+    size_t entries;
+};
+
+static int _msgpack_packer_hash_foreach_i(VALUE key, VALUE value, VALUE arg)
+{
+    if (key == Qundef) {
+        return ST_CONTINUE;
+    }
+    struct msgpack_packer_hash_args* args = (struct msgpack_packer_hash_args*) arg;
+    msgpack_packer_t* pk = args->pk;
+
+    /* pairs are written directly until a nested object appears. The pair
+     * and all following pairs are deferred to the stack. */
+    if(pk->entries_size == args->entries && !_msgpack_packer_is_nested(key) && !_msgpack_packer_is_nested(value)) {
+        _msgpack_packer_write_scalar_value(pk, key);
+        _msgpack_packer_write_scalar_value(pk, value);
+    } else {
+        _msgpack_packer_entries_push(pk, key);
+        _msgpack_packer_entries_push(pk, value);
+    }
+    return ST_CONTINUE;
+}
+
+static inline void _msgpack_packer_check_depth(msgpack_packer_t* pk)
+{
+    if(pk->stack_depth >= pk->max_depth) {
+        rb_raise(rb_eArgError, "depth of nested objects is too deep to pack: should be <= %lu levels",
+                (unsigned long) pk->max_depth);
+    }
+}
+
+static inline VALUE _msgpack_packer_array_entry(VALUE ary, size_t index)
+{
+    /* the array may be shrunk by to_msgpack methods */
+    if((long) index < RARRAY_LEN(ary)) {
+        return RARRAY_AREF(ary, index);
+    }
+    return Qnil;
+}
+
+static inline void _msgpack_packer_begin_array(msgpack_packer_t* pk, VALUE v)
+{
+    _msgpack_packer_check_depth(pk);
+
+    /* actual return type of RARRAY_LEN is long */
+    unsigned long len = RARRAY_LEN(v);
+    if(len > 0xffffffffUL) {
+        rb_raise(rb_eArgError, "size of array is too long to pack: %lu entries, should be <= %lu", len, 0xffffffffUL);
+    }
+    msgpack_packer_write_array_header(pk, (unsigned int)len);
+    if(len > 0) {
+        _msgpack_packer_stack_push(pk, v, 0, len);
+    }
+}
+
+static inline void _msgpack_packer_begin_hash(msgpack_packer_t* pk, VALUE v)
+{
+    _msgpack_packer_check_depth(pk);
+
+    /* actual return type of RHASH_SIZE is long (if SIZEOF_LONG == SIZEOF_VOIDP
+     * or long long (if SIZEOF_LONG_LONG == SIZEOF_VOIDP. See st.h. */
+    unsigned long len = RHASH_SIZE(v);
+    if(len > 0xffffffffUL) {
+        rb_raise(rb_eArgError, "size of hash is too long to pack: %ld entries, should be <= %lu", len, 0xffffffffUL);
+    }
+    msgpack_packer_write_map_header(pk, (unsigned int)len);
+    if(len == 0) {
+        return;
+    }
+
+    struct msgpack_packer_hash_args args = { pk, pk->entries_size };
+#ifdef RUBINIUS
+    VALUE iter = rb_funcall(v, s_to_iter, 0);
+    VALUE entry = Qnil;
+    while(RTEST(entry = rb_funcall(iter, s_next, 1, entry))) {
+        VALUE key = rb_funcall(entry, s_key, 0);
+        VALUE val = rb_funcall(entry, s_value, 0);
+        _msgpack_packer_hash_foreach_i(key, val, (VALUE) &args);
+    }
+#else
+    rb_hash_foreach(v, _msgpack_packer_hash_foreach_i, (VALUE) &args);
+#endif
+    if(pk->entries_size > args.entries) {
+        _msgpack_packer_stack_push(pk, Qnil, args.entries, pk->entries_size - args.entries);
+    }
+}
+
+struct msgpack_packer_nested_args {
+    msgpack_packer_t* pk;
+    VALUE object;
+    size_t stack_depth;
+    size_t entries_size;
+};
+
+static VALUE _msgpack_packer_write_nested(VALUE arg)
+{
+    struct msgpack_packer_nested_args* args = (struct msgpack_packer_nested_args*) arg;
+    msgpack_packer_t* pk = args->pk;
+    size_t base = args->stack_depth;
+
+    if(rb_type(args->object) == T_ARRAY) {
+        _msgpack_packer_begin_array(pk, args->object);
+    } else {
+        _msgpack_packer_begin_hash(pk, args->object);
+    }
+
+    while(pk->stack_depth > base) {
+        /* pk->stack may be reallocated by push or by to_msgpack calls */
+        msgpack_packer_stack_t* top = &pk->stack[pk->stack_depth - 1];
+        VALUE e = Qnil;
+        bool nested = false;
+
+        while(top->index < top->count) {
+            if(top->object != Qnil) {
+                e = _msgpack_packer_array_entry(top->object, top->index);
+            } else {
+                e = pk->entries[top->entries + top->index];
+            }
+            top->index++;
+
+            if(_msgpack_packer_is_nested(e)) {
+                nested = true;
+                break;
+            }
+            _msgpack_packer_write_scalar_value(pk, e);
+            top = &pk->stack[pk->stack_depth - 1];
+        }
+
+        if(nested) {
+            if(rb_type(e) == T_ARRAY) {
+                _msgpack_packer_begin_array(pk, e);
+            } else {
+                _msgpack_packer_begin_hash(pk, e);
+            }
+        } else {
+            if(top->object == Qnil) {
+                pk->entries_size = top->entries;
+            }
+            pk->stack_depth--;
+        }
+    }
+
+    return Qnil;
+}
+
+static VALUE _msgpack_packer_write_nested_ensure(VALUE arg)
+{
+    /* discards frames left by an exception */
+    struct msgpack_packer_nested_args* args = (struct msgpack_packer_nested_args*) arg;
+    args->pk->stack_depth = args->stack_depth;
+    args->pk->entries_size = args->entries_size;
+    return Qnil;
+}
+
+static void _msgpack_packer_write_nested_value(msgpack_packer_t* pk, VALUE v)
+{
+    struct msgpack_packer_nested_args args = { pk, v, pk->stack_depth, pk->entries_size };
+    rb_ensure(_msgpack_packer_write_nested, (VALUE) &args,
+            _msgpack_packer_write_nested_ensure, (VALUE) &args);
+}
+
+void msgpack_packer_write_array_value(msgpack_packer_t* pk, VALUE v)
+{
+    _msgpack_packer_write_nested_value(pk, v);
+}
+
+void msgpack_packer_write_hash_value(msgpack_packer_t* pk, VALUE v)
+{
+    _msgpack_packer_write_nested_value(pk, v);
+}
+
+void msgpack_packer_write_value(msgpack_packer_t* pk, VALUE v)
+{
+    switch(rb_type(v)) {
+    case T_ARRAY:
+    case T_HASH:
+        _msgpack_packer_write_nested_value(pk, v);
+        break;
+    default:
+        _msgpack_packer_write_scalar_value(pk, v);
+    }
+}
+
@@ -24,12 +24,44 @@
 #define MSGPACK_PACKER_IO_FLUSH_THRESHOLD_TO_WRITE_STRING_BODY (1024)
 #endif
 
+/* stack and entries are embedded in msgpack_packer_t until they grow */
+#ifndef MSGPACK_PACKER_EMBEDDED_STACK_CAPACITY
+#define MSGPACK_PACKER_EMBEDDED_STACK_CAPACITY 4
+#endif
+
+#ifndef MSGPACK_PACKER_EMBEDDED_ENTRIES_CAPACITY
+#define MSGPACK_PACKER_EMBEDDED_ENTRIES_CAPACITY 8
+#endif
+
+#ifndef MSGPACK_PACKER_DEFAULT_MAX_DEPTH
+#define MSGPACK_PACKER_DEFAULT_MAX_DEPTH 65536
+#endif
+
 struct msgpack_packer_t;
 typedef struct msgpack_packer_t msgpack_packer_t;
 
+typedef struct {
+    VALUE object;    /* Array being packed, or Qnil if elements are in entries */
+    size_t entries;  /* offset of the elements in msgpack_packer_t::entries */
+    size_t index;
+    size_t count;
+} msgpack_packer_stack_t;
+
 struct msgpack_packer_t {
     msgpack_buffer_t buffer;
 
+    msgpack_packer_stack_t* stack;
+    size_t stack_depth;
+    size_t stack_capacity;
+    size_t max_depth;
+
+    VALUE* entries;  /* keys and values of Hashes being packed */
+    size_t entries_size;
+    size_t entries_capacity;
+
+    msgpack_packer_stack_t stack_embedded[MSGPACK_PACKER_EMBEDDED_STACK_CAPACITY];
+    VALUE entries_embedded[MSGPACK_PACKER_EMBEDDED_ENTRIES_CAPACITY];
+
     VALUE io;
     ID io_write_all_method;
 
@@ -40,6 +72,10 @@ struct msgpack_packer_t {
 
     ID to_exttype_method;
     VALUE extended_types;  // how to pack arbitrary classes. Can be Qnil or a hash
+
+    /* options */
+    bool bignum_exttype_enabled;
+    int8_t bignum_exttype;  // Integers beyond 64-bit are packed using this exttype if enabled
 };
 
 #define PACKER_BUFFER_(pk) (&(pk)->buffer)
@@ -69,6 +105,17 @@ static inline void msgpack_packer_set_io(msgpack_packer_t* pk, VALUE io, ID io_w
 
 void msgpack_packer_reset(msgpack_packer_t* pk);
 
+static inline void msgpack_packer_set_max_depth(msgpack_packer_t* pk, size_t max_depth)
+{
+    pk->max_depth = max_depth;
+}
+
+static inline void msgpack_packer_set_bignum_exttype(msgpack_packer_t* pk, int8_t typenr)
+{
+    pk->bignum_exttype_enabled = true;
+    pk->bignum_exttype = typenr;
+}
+
 static inline void msgpack_packer_write_nil(msgpack_packer_t* pk)
 {
     msgpack_buffer_ensure_writable(PACKER_BUFFER_(pk), 1);
@@ -339,6 +386,16 @@ static inline void msgpack_packer_write_map_header(msgpack_packer_t* pk, unsigne
     }
 }
 
+/*
+ * Streaming array/map: writes an array32/map32 header with a placeholder
+ * count and returns its offset in the buffer. Data written to the buffer is
+ * not flushed to the IO, and Ruby methods can't read or clear the buffer,
+ * until msgpack_packer_end_stream_header patches the count.
+ */
+size_t msgpack_packer_begin_stream_header(msgpack_packer_t* pk, bool map);
+
+void msgpack_packer_end_stream_header(msgpack_packer_t* pk, size_t offset, uint32_t n);
+
 #define MSGPACK_PACKER_WRITE_EXTTYPE_HEADER_DRY(code, len) \
         msgpack_buffer_ensure_writable(PACKER_BUFFER_(pk), len + 2); \
         msgpack_buffer_write_byte_and_data(PACKER_BUFFER_(pk), code, (const void*)&be, len);
@@ -456,8 +513,18 @@ static inline void msgpack_packer_write_fixnum_value(msgpack_packer_t* pk, VALUE
 #endif
 }
 
+#ifdef HAVE_RB_INTEGER_PACK
+void msgpack_packer_write_bignum_exttype_value(msgpack_packer_t* pk, VALUE v);
+#endif
+
 static inline void msgpack_packer_write_bignum_value(msgpack_packer_t* pk, VALUE v)
 {
+#ifdef HAVE_RB_INTEGER_PACK
+    if(pk->bignum_exttype_enabled) {
+        msgpack_packer_write_bignum_exttype_value(pk, v);
+        return;
+    }
+#endif
     if(RBIGNUM_POSITIVE_P(v)) {
         msgpack_packer_write_u64(pk, rb_big2ull(v));
     } else {
@@ -24,6 +24,7 @@
 #include "exttype_class.h"
 
 VALUE cMessagePack_Packer;
+VALUE cMessagePack_Packer_StreamWriter;
 
 static ID s_to_msgpack;
 static ID s_to_exttype;
@@ -31,6 +32,7 @@ static ID s_write;
 static ID s_instance_method;
 static VALUE v_to_exttype;
 static ID s_call;
+static ID s_each;
 
 //static VALUE s_packer_value;
 //static msgpack_packer_t* s_packer;
@@ -82,6 +84,30 @@ static VALUE _packer_check_exttype_set_args(int argc, VALUE klass, VALUE handler
     return handler;
 }
 
+/* options shared by Packer.new and MessagePack.pack */
+static void _packer_set_options(msgpack_packer_t* pk, VALUE options)
+{
+    VALUE v;
+
+    v = rb_hash_aref(options, ID2SYM(rb_intern("max_depth")));
+    if(v != Qnil) {
+        long n = NUM2LONG(v);
+        if(n <= 0) {
+            rb_raise(rb_eArgError, "max_depth must be positive but %ld found", n);
+        }
+        msgpack_packer_set_max_depth(pk, (size_t) n);
+    }
+
+    v = rb_hash_aref(options, ID2SYM(rb_intern("bignum_exttype")));
+    if(v != Qnil) {
+#ifdef HAVE_RB_INTEGER_PACK
+        msgpack_packer_set_bignum_exttype(pk, _exttype_check_typecode(v));
+#else
+        rb_raise(rb_eNotImpError, ":bignum_exttype option is not supported on this platform");
+#endif
+    }
+}
+
 static void Packer_free(msgpack_packer_t* pk)
 {
     if(pk == NULL) {
@@ -146,6 +172,8 @@ static VALUE Packer_initialize(int argc, VALUE* argv, VALUE self)
         } else {
             msgpack_packer_set_default_extended_type(pk, v);
         }
+
+        _packer_set_options(pk, options);
     }
 
     // TODO MessagePack_Unpacker_initialize and options
@@ -248,6 +276,7 @@ static VALUE Packer_resolve_exttype(VALUE self, VALUE klass)
 static VALUE Packer_clear(VALUE self)
 {
     PACKER(self, pk);
+    msgpack_buffer_check_read_lock(PACKER_BUFFER_(pk));
     msgpack_buffer_clear(PACKER_BUFFER_(pk));
     return Qnil;
 }
@@ -284,10 +313,262 @@ static VALUE Packer_to_a(VALUE self)
 static VALUE Packer_write_to(VALUE self, VALUE io)
 {
     PACKER(self, pk);
+    msgpack_buffer_check_read_lock(PACKER_BUFFER_(pk));
     size_t sz = msgpack_buffer_flush_to_io(PACKER_BUFFER_(pk), io, s_write, true);
     return ULONG2NUM(sz);
 }
 
+typedef struct {
+    VALUE packer;
+    size_t offset;
+    unsigned long count;
+    bool map;
+    bool closed;
+} msgpack_packer_stream_t;
+
+#define STREAM_WRITER(from, name) \
+    msgpack_packer_stream_t* name; \
+    Data_Get_Struct(from, msgpack_packer_stream_t, name); \
+    if(name == NULL) { \
+        rb_raise(rb_eArgError, "NULL found for " # name " when shouldn't be."); \
+    }
+
+static void StreamWriter_mark(msgpack_packer_stream_t* sw)
+{
+    rb_gc_mark(sw->packer);
+}
+
+static VALUE StreamWriter_alloc(VALUE klass)
+{
+    msgpack_packer_stream_t* sw = ALLOC_N(msgpack_packer_stream_t, 1);
+    memset(sw, 0, sizeof(msgpack_packer_stream_t));
+    sw->packer = Qnil;
+    sw->closed = true;
+    return Data_Wrap_Struct(klass, StreamWriter_mark, RUBY_DEFAULT_FREE, sw);
+}
+
+static inline msgpack_packer_t* _stream_writer_entry(msgpack_packer_stream_t* sw)
+{
+    if(sw->closed) {
+        rb_raise(rb_eRuntimeError, "stream is already closed");
+    }
+    if(sw->count >= 0xffffffffUL) {
+        rb_raise(rb_eArgError, "size of %s is too long to pack: should be <= %lu entries",
+                sw->map ? "map" : "array", 0xffffffffUL);
+    }
+    PACKER(sw->packer, pk);
+    return pk;
+}
+
+static VALUE StreamWriter_write(int argc, VALUE* argv, VALUE self)
+{
+    STREAM_WRITER(self, sw);
+
+    if(sw->map) {
+        if(argc != 2) {
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 2)", argc);
+        }
+        msgpack_packer_t* pk = _stream_writer_entry(sw);
+        msgpack_packer_write_value(pk, argv[0]);
+        msgpack_packer_write_value(pk, argv[1]);
+    } else {
+        if(argc != 1) {
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 1)", argc);
+        }
+        msgpack_packer_t* pk = _stream_writer_entry(sw);
+        msgpack_packer_write_value(pk, argv[0]);
+    }
+
+    sw->count++;
+    return self;
+}
+
+static VALUE StreamWriter_append(VALUE self, VALUE v)
+{
+    return StreamWriter_write(1, &v, self);
+}
+
+static VALUE StreamWriter_aset(VALUE self, VALUE k, VALUE v)
+{
+    VALUE argv[2] = { k, v };
+    StreamWriter_write(2, argv, self);
+    return v;
+}
+
+static VALUE StreamWriter_size(VALUE self)
+{
+    STREAM_WRITER(self, sw);
+    return ULONG2NUM(sw->count);
+}
+
+static VALUE StreamWriter_map_p(VALUE self)
+{
+    STREAM_WRITER(self, sw);
+    return sw->map ? Qtrue : Qfalse;
+}
+
+static VALUE StreamWriter_closed_p(VALUE self)
+{
+    STREAM_WRITER(self, sw);
+    return sw->closed ? Qtrue : Qfalse;
+}
+
+static VALUE StreamWriter_each_i(RB_BLOCK_CALL_FUNC_ARGLIST(yielded, writer))
+{
+    STREAM_WRITER(writer, sw);
+
+    if(!sw->map) {
+        VALUE v = argc > 1 ? rb_ary_new4(argc, argv) : yielded;
+        return StreamWriter_write(1, &v, writer);
+    }
+
+    /* Hash#each and most pair enumerables yield [key, value] */
+    if(argc == 2) {
+        return StreamWriter_write(2, (VALUE*) argv, writer);
+    }
+    if(rb_type(yielded) != T_ARRAY || RARRAY_LEN(yielded) != 2) {
+        rb_raise(rb_eArgError, "expected [key, value] pair but found %s", rb_obj_classname(yielded));
+    }
+    VALUE pair[2] = { rb_ary_entry(yielded, 0), rb_ary_entry(yielded, 1) };
+    return StreamWriter_write(2, pair, writer);
+}
+
+static VALUE StreamWriter_run(VALUE args)
+{
+    VALUE writer = rb_ary_entry(args, 0);
+    VALUE enumerable = rb_ary_entry(args, 1);
+
+    if(enumerable != Qnil) {
+        rb_block_call(enumerable, s_each, 0, NULL, StreamWriter_each_i, writer);
+    }
+    if(rb_block_given_p()) {
+        rb_yield(writer);
+    }
+    return Qnil;
+}
+
+static VALUE StreamWriter_close(VALUE writer)
+{
+    STREAM_WRITER(writer, sw);
+    sw->closed = true;
+
+    /* the count is patched even when an exception is raised so that the
+     * buffer never contains a broken header */
+    PACKER(sw->packer, pk);
+    msgpack_packer_end_stream_header(pk, sw->offset, (uint32_t) sw->count);
+    return Qnil;
+}
+
+static VALUE Packer_write_stream(int argc, VALUE* argv, VALUE self, bool map)
+{
+    VALUE enumerable;
+    rb_scan_args(argc, argv, "01", &enumerable);
+
+    if(enumerable == Qnil && !rb_block_given_p()) {
+        rb_raise(rb_eArgError, "block or enumerable is required");
+    }
+
+    PACKER(self, pk);
+
+    VALUE writer = StreamWriter_alloc(cMessagePack_Packer_StreamWriter);
+    STREAM_WRITER(writer, sw);
+    sw->packer = self;
+    sw->map = map;
+    sw->offset = msgpack_packer_begin_stream_header(pk, map);
+    sw->closed = false;
+
+    rb_ensure(StreamWriter_run, rb_assoc_new(writer, enumerable), StreamWriter_close, writer);
+
+    return self;
+}
+
+static VALUE Packer_write_array_stream(int argc, VALUE* argv, VALUE self)
+{
+    return Packer_write_stream(argc, argv, self, false);
+}
+
+static VALUE Packer_write_map_stream(int argc, VALUE* argv, VALUE self)
+{
+    return Packer_write_stream(argc, argv, self, true);
+}
+
+struct packer_pack_many_args {
+    msgpack_packer_t* pk;
+    VALUE objects;
+    VALUE result;
+    bool join;
+};
+
+static VALUE _packer_pack_many(VALUE arg)
+{
+    struct packer_pack_many_args* args = (struct packer_pack_many_args*) arg;
+    msgpack_packer_t* pk = args->pk;
+    msgpack_buffer_t* b = PACKER_BUFFER_(pk);
+
+    VALUE joined = args->join ? rb_str_buf_new(0) : Qnil;
+
+    long i;
+    for(i=0; i < RARRAY_LEN(args->objects); ++i) {
+        msgpack_packer_write_value(pk, rb_ary_entry(args->objects, i));
+
+        if(args->join) {
+            rb_ary_push(args->result, LONG2NUM(RSTRING_LEN(joined)));
+            msgpack_buffer_read_to_string_nonblock(b, joined, msgpack_buffer_all_readable_size(b));
+        } else {
+            rb_ary_push(args->result, msgpack_buffer_all_as_string(b));
+        }
+        msgpack_buffer_rewind(b);
+    }
+
+    if(args->join) {
+        return rb_assoc_new(joined, args->result);
+    }
+    return args->result;
+}
+
+static VALUE _packer_pack_many_ensure(VALUE arg)
+{
+    struct packer_pack_many_args* args = (struct packer_pack_many_args*) arg;
+    msgpack_buffer_t* b = PACKER_BUFFER_(args->pk);
+    msgpack_buffer_unlock_io_flush(b);
+    msgpack_buffer_clear(b);
+    return Qnil;
+}
+
+static VALUE _packer_pack_objects(msgpack_packer_t* pk, VALUE objects, VALUE options)
+{
+    Check_Type(objects, T_ARRAY);
+
+    if(msgpack_buffer_top_readable_size(PACKER_BUFFER_(pk)) != 0) {
+        rb_raise(rb_eRuntimeError, "internal buffer of the packer is not empty");
+    }
+
+    bool join = false;
+    if(options != Qnil) {
+        join = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("join"))));
+    }
+
+    struct packer_pack_many_args args = { pk, objects, rb_ary_new2(RARRAY_LEN(objects)), join };
+
+    /* written data should not go to the IO while packing */
+    msgpack_buffer_lock_io_flush(PACKER_BUFFER_(pk));
+
+    return rb_ensure(_packer_pack_many, (VALUE) &args, _packer_pack_many_ensure, (VALUE) &args);
+}
+
+static VALUE Packer_pack_each(int argc, VALUE* argv, VALUE self)
+{
+    VALUE objects, options;
+    rb_scan_args(argc, argv, "11", &objects, &options);
+
+    if(options != Qnil && rb_type(options) != T_HASH) {
+        rb_raise(rb_eArgError, "expected Hash but found %s.", rb_obj_classname(options));
+    }
+
+    PACKER(self, pk);
+    return _packer_pack_objects(pk, objects, options);
+}
+
 //static VALUE Packer_append(VALUE self, VALUE string_or_buffer)
 //{
 //    PACKER(self, pk);
@@ -336,6 +617,9 @@ VALUE MessagePack_pack(int argc, VALUE* argv)
 
     MessagePack_Buffer_initialize(PACKER_BUFFER_(pk), io, options);
     // TODO MessagePack_Unpacker_initialize and options
+    if(options != Qnil) {
+        _packer_set_options(pk, options);
+    }
 
     msgpack_packer_write_value(pk, v);
 
@@ -358,6 +642,30 @@ VALUE MessagePack_pack(int argc, VALUE* argv)
     return retval;
 }
 
+static VALUE MessagePack_pack_many_module_method(int argc, VALUE* argv, VALUE mod)
+{
+    UNUSED(mod);
+
+    VALUE objects, options;
+    rb_scan_args(argc, argv, "11", &objects, &options);
+
+    if(options != Qnil && rb_type(options) != T_HASH) {
+        rb_raise(rb_eArgError, "expected Hash but found %s.", rb_obj_classname(options));
+    }
+
+    VALUE self = Packer_alloc(cMessagePack_Packer);
+    Packer_initialize(argc - 1, argv + 1, self);
+
+    PACKER(self, pk);
+    VALUE retval = _packer_pack_objects(pk, objects, options);
+
+#ifdef RB_GC_GUARD
+    RB_GC_GUARD(self);
+#endif
+
+    return retval;
+}
+
 static VALUE MessagePack_dump_module_method(int argc, VALUE* argv, VALUE mod)
 {
     UNUSED(mod);
@@ -376,6 +684,7 @@ void MessagePack_Packer_module_init(VALUE mMessagePack)
     s_to_exttype = rb_intern("to_exttype");
     s_write = rb_intern("write");
     s_call = rb_intern("call");
+    s_each = rb_intern("each");
     s_instance_method = rb_intern("instance_method");
     v_to_exttype = rb_str_new2("to_exttype");
     rb_gc_register_address(&v_to_exttype);
@@ -394,6 +703,9 @@ void MessagePack_Packer_module_init(VALUE mMessagePack)
     rb_define_method(cMessagePack_Packer, "write_array_header", Packer_write_array_header, 1);
     rb_define_method(cMessagePack_Packer, "write_map_header", Packer_write_map_header, 1);
     rb_define_method(cMessagePack_Packer, "write_exttype_header", Packer_write_exttype_header, 2);
+    rb_define_method(cMessagePack_Packer, "write_array_stream", Packer_write_array_stream, -1);
+    rb_define_method(cMessagePack_Packer, "write_map_stream", Packer_write_map_stream, -1);
+    rb_define_method(cMessagePack_Packer, "pack_each", Packer_pack_each, -1);
     rb_define_method(cMessagePack_Packer, "flush", Packer_flush, 0);
     rb_define_method(cMessagePack_Packer, "register_exttype", Packer_register_exttype, -1);
     rb_define_method(cMessagePack_Packer, "register_lowlevel", Packer_register_lowlevel, -1);
@@ -413,6 +725,16 @@ void MessagePack_Packer_module_init(VALUE mMessagePack)
     //rb_define_method(cMessagePack_Packer, "append", Packer_append, 1);
     //rb_define_alias(cMessagePack_Packer, "<<", "append");
 
+    cMessagePack_Packer_StreamWriter = rb_define_class_under(cMessagePack_Packer, "StreamWriter", rb_cObject);
+    rb_undef_alloc_func(cMessagePack_Packer_StreamWriter);
+    rb_define_method(cMessagePack_Packer_StreamWriter, "write", StreamWriter_write, -1);
+    rb_define_method(cMessagePack_Packer_StreamWriter, "<<", StreamWriter_append, 1);
+    rb_define_method(cMessagePack_Packer_StreamWriter, "[]=", StreamWriter_aset, 2);
+    rb_define_method(cMessagePack_Packer_StreamWriter, "size", StreamWriter_size, 0);
+    rb_define_alias(cMessagePack_Packer_StreamWriter, "count", "size");
+    rb_define_method(cMessagePack_Packer_StreamWriter, "map?", StreamWriter_map_p, 0);
+    rb_define_method(cMessagePack_Packer_StreamWriter, "closed?", StreamWriter_closed_p, 0);
+
     //s_packer_value = Packer_alloc(cMessagePack_Packer);
     //rb_gc_register_address(&s_packer_value);
     //Data_Get_Struct(s_packer_value, msgpack_packer_t, s_packer);
@@ -420,5 +742,6 @@ void MessagePack_Packer_module_init(VALUE mMessagePack)
     /* MessagePack.pack(x) */
     rb_define_module_function(mMessagePack, "pack", MessagePack_pack_module_method, -1);
     rb_define_module_function(mMessagePack, "dump", MessagePack_dump_module_method, -1);
+    rb_define_module_function(mMessagePack, "pack_many", MessagePack_pack_many_module_method, -1);
 }
 
@@ -21,6 +21,7 @@
 #include "packer.h"
 
 extern VALUE cMessagePack_Packer;
+extern VALUE cMessagePack_Packer_StreamWriter;
 
 void MessagePack_Packer_module_init(VALUE mMessagePack);
 
@@ -20,6 +20,8 @@
 #include "packer_class.h"
 #include "unpacker_class.h"
 #include "exttype_class.h"
+#include "lazy_class.h"
+#include "stream_index_class.h"
 #include "core_ext.h"
 
 void Init_msgpack(void)
@@ -30,6 +32,8 @@ void Init_msgpack(void)
     MessagePack_ExtType_module_init(mMessagePack);
     MessagePack_Packer_module_init(mMessagePack);
     MessagePack_Unpacker_module_init(mMessagePack);
+    MessagePack_Lazy_module_init(mMessagePack);
+    MessagePack_StreamIndex_module_init(mMessagePack);
     MessagePack_core_ext_module_init();
 }
 
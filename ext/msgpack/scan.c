@@ -0,0 +1,490 @@
+/*
+ * MessagePack for Ruby
+ *
+ * Copyright (C) 2008-2013 Sadayuki Furuhashi
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include "scan.h"
+#include "utf8.h"
+
+static inline uint16_t _msgpack_scan_load16(const char* p)
+{
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return _msgpack_be16(v);
+}
+
+static inline uint32_t _msgpack_scan_load32(const char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return _msgpack_be32(v);
+}
+
+size_t msgpack_scan_header_size(unsigned char b)
+{
+    if(b <= 0xbf || b >= 0xe0) {
+        /* fixint, fixmap, fixarray and fixstr */
+        return 1;
+    }
+    switch(b) {
+    case 0xc0:
+    case 0xc2:
+    case 0xc3:
+        return 1;
+    case 0xc4:
+    case 0xcc:
+    case 0xd0:
+    case 0xd9:
+        return 2;
+    case 0xd4:
+    case 0xd5:
+    case 0xd6:
+    case 0xd7:
+    case 0xd8:
+        return 2;  /* fixext; includes the type byte */
+    case 0xc5:
+    case 0xc7:
+    case 0xcd:
+    case 0xd1:
+    case 0xda:
+    case 0xdc:
+    case 0xde:
+        return 3;
+    case 0xc8:
+        return 4;
+    case 0xc6:
+    case 0xca:
+    case 0xce:
+    case 0xd2:
+    case 0xdb:
+    case 0xdd:
+    case 0xdf:
+        return 5;
+    case 0xc9:
+        return 6;
+    case 0xcb:
+    case 0xcf:
+    case 0xd3:
+        return 9;
+    default:
+        /* 0xc1 */
+        return 0;
+    }
+}
+
+#define SCAN_HEADER(t, hsize, n) \
+    do { \
+        if(length < (hsize)) { \
+            return PRIMITIVE_EOF; \
+        } \
+        h->type = (t); \
+        h->header_size = (hsize); \
+        h->count = (n); \
+    } while(0)
+
+int msgpack_scan_header(const char* p, size_t length, msgpack_scan_header_t* h)
+{
+    if(length == 0) {
+        return PRIMITIVE_EOF;
+    }
+
+    unsigned char b = (unsigned char) p[0];
+    h->exttype = 0;
+
+    if(b <= 0x7f) {
+        SCAN_HEADER(TYPE_INTEGER, 1, 0);
+    } else if(b <= 0x8f) {
+        SCAN_HEADER(TYPE_MAP, 1, b & 0x0f);
+    } else if(b <= 0x9f) {
+        SCAN_HEADER(TYPE_ARRAY, 1, b & 0x0f);
+    } else if(b <= 0xbf) {
+        SCAN_HEADER(TYPE_STRING, 1, b & 0x1f);
+    } else if(b >= 0xe0) {
+        SCAN_HEADER(TYPE_INTEGER, 1, 0);
+    } else {
+        switch(b) {
+        case 0xc0:
+            SCAN_HEADER(TYPE_NIL, 1, 0);
+            break;
+        case 0xc2:
+        case 0xc3:
+            SCAN_HEADER(TYPE_BOOLEAN, 1, 0);
+            break;
+        case 0xc4:
+            SCAN_HEADER(TYPE_BINARY, 2, (unsigned char) p[1]);
+            break;
+        case 0xc5:
+            SCAN_HEADER(TYPE_BINARY, 3, _msgpack_scan_load16(p + 1));
+            break;
+        case 0xc6:
+            SCAN_HEADER(TYPE_BINARY, 5, _msgpack_scan_load32(p + 1));
+            break;
+        case 0xc7:
+            SCAN_HEADER(TYPE_EXT, 3, (unsigned char) p[1]);
+            h->exttype = (int8_t) p[2];
+            break;
+        case 0xc8:
+            SCAN_HEADER(TYPE_EXT, 4, _msgpack_scan_load16(p + 1));
+            h->exttype = (int8_t) p[3];
+            break;
+        case 0xc9:
+            SCAN_HEADER(TYPE_EXT, 6, _msgpack_scan_load32(p + 1));
+            h->exttype = (int8_t) p[5];
+            break;
+        case 0xca:
+            SCAN_HEADER(TYPE_FLOAT, 5, 0);
+            break;
+        case 0xcb:
+            SCAN_HEADER(TYPE_FLOAT, 9, 0);
+            break;
+        case 0xcc:
+        case 0xd0:
+            SCAN_HEADER(TYPE_INTEGER, 2, 0);
+            break;
+        case 0xcd:
+        case 0xd1:
+            SCAN_HEADER(TYPE_INTEGER, 3, 0);
+            break;
+        case 0xce:
+        case 0xd2:
+            SCAN_HEADER(TYPE_INTEGER, 5, 0);
+            break;
+        case 0xcf:
+        case 0xd3:
+            SCAN_HEADER(TYPE_INTEGER, 9, 0);
+            break;
+        case 0xd4:
+        case 0xd5:
+        case 0xd6:
+        case 0xd7:
+        case 0xd8:
+            /* fixext 1, 2, 4, 8, 16 */
+            SCAN_HEADER(TYPE_EXT, 2, 1 << (b - 0xd4));
+            h->exttype = (int8_t) p[1];
+            break;
+        case 0xd9:
+            SCAN_HEADER(TYPE_STRING, 2, (unsigned char) p[1]);
+            break;
+        case 0xda:
+            SCAN_HEADER(TYPE_STRING, 3, _msgpack_scan_load16(p + 1));
+            break;
+        case 0xdb:
+            SCAN_HEADER(TYPE_STRING, 5, _msgpack_scan_load32(p + 1));
+            break;
+        case 0xdc:
+            SCAN_HEADER(TYPE_ARRAY, 3, _msgpack_scan_load16(p + 1));
+            break;
+        case 0xdd:
+            SCAN_HEADER(TYPE_ARRAY, 5, _msgpack_scan_load32(p + 1));
+            break;
+        case 0xde:
+            SCAN_HEADER(TYPE_MAP, 3, _msgpack_scan_load16(p + 1));
+            break;
+        case 0xdf:
+            SCAN_HEADER(TYPE_MAP, 5, _msgpack_scan_load32(p + 1));
+            break;
+        default:
+            /* 0xc1 */
+            return PRIMITIVE_INVALID_BYTE;
+        }
+    }
+
+    return PRIMITIVE_OBJECT_COMPLETE;
+}
+
+int msgpack_scan_skip(const char* p, size_t length, size_t* size)
+{
+    size_t offset = 0;
+    size_t remaining = 1;  /* objects to skip including nested ones */
+
+    while(remaining > 0) {
+        /* each object takes one byte at least */
+        if(length - offset < remaining) {
+            return PRIMITIVE_EOF;
+        }
+
+        /* fast path for fixint, fixstr, fixarray, fixmap and fixed-width scalars */
+        unsigned char b = (unsigned char) p[offset];
+        if(b <= 0x7f || b >= 0xe0) {
+            offset++;
+            remaining--;
+            continue;
+        } else if(0xa0 <= b && b <= 0xbf) {
+            size_t n = b & 0x1f;
+            if(length - offset <= n) {
+                return PRIMITIVE_EOF;
+            }
+            offset += 1 + n;
+            remaining--;
+            continue;
+        } else if(0x90 <= b && b <= 0x9f) {
+            offset++;
+            remaining = remaining - 1 + (b & 0x0f);
+            continue;
+        } else if(0x80 <= b && b <= 0x8f) {
+            offset++;
+            remaining = remaining - 1 + (b & 0x0f) * 2;
+            continue;
+        } else if((0xca <= b && b <= 0xd3) || b == 0xc0 || b == 0xc2 || b == 0xc3) {
+            /* nil, booleans, floats and integers */
+            size_t n = msgpack_scan_header_size(b);
+            if(length - offset < n) {
+                return PRIMITIVE_EOF;
+            }
+            offset += n;
+            remaining--;
+            continue;
+        }
+
+        msgpack_scan_header_t h;
+        int r = msgpack_scan_header(p + offset, length - offset, &h);
+        if(r < 0) {
+            return r;
+        }
+        offset += h.header_size;
+        remaining--;
+
+        switch(h.type) {
+        case TYPE_ARRAY:
+            remaining += h.count;
+            break;
+        case TYPE_MAP:
+            remaining += h.count * 2;
+            break;
+        case TYPE_STRING:
+        case TYPE_BINARY:
+        case TYPE_EXT:
+            if(length - offset < h.count) {
+                return PRIMITIVE_EOF;
+            }
+            offset += h.count;
+            break;
+        default:
+            break;
+        }
+    }
+
+    *size = offset;
+    return PRIMITIVE_OBJECT_COMPLETE;
+}
+
+/* copies n bytes from p in chunk c to dst; returns false if the buffer ends before */
+static bool _msgpack_scan_buffer_copy(msgpack_buffer_t* b, msgpack_buffer_chunk_t* c, const char* p, char* dst, size_t n)
+{
+    while(n > 0) {
+        size_t avail = c->last - p;
+        if(avail == 0) {
+            if(c == &b->tail) {
+                return false;
+            }
+            c = c->next;
+            p = c->first;
+            continue;
+        }
+        size_t k = avail < n ? avail : n;
+        memcpy(dst, p, k);
+        dst += k;
+        p += k;
+        n -= k;
+    }
+    return true;
+}
+
+int msgpack_scan_skip_buffer(msgpack_buffer_t* b, msgpack_scan_buffer_state_t* s)
+{
+    if(msgpack_buffer_all_readable_size(b) <= s->offset) {
+        return PRIMITIVE_EOF;
+    }
+
+    /* finds the position of s->offset; chunks may have moved since the last call */
+    msgpack_buffer_chunk_t* c = b->head;
+    const char* p = b->read_buffer;
+    size_t skip = s->offset;
+    while(skip >= (size_t) (c->last - p)) {
+        skip -= c->last - p;
+        c = c->next;
+        p = c->first;
+    }
+    p += skip;
+
+    while(s->remaining > 0 || s->raw_remaining > 0) {
+        size_t avail = c->last - p;
+        if(avail == 0) {
+            if(c == &b->tail) {
+                return PRIMITIVE_EOF;
+            }
+            c = c->next;
+            p = c->first;
+            continue;
+        }
+
+        if(s->raw_remaining > 0) {
+            size_t n = avail < s->raw_remaining ? avail : s->raw_remaining;
+            p += n;
+            s->offset += n;
+            s->raw_remaining -= n;
+            continue;
+        }
+
+        size_t header_size = msgpack_scan_header_size((unsigned char) *p);
+        if(header_size == 0) {
+            return PRIMITIVE_INVALID_BYTE;
+        }
+        const char* hp = p;
+        char header[9];
+        if(avail < header_size) {
+            /* the header is split into chunks */
+            if(!_msgpack_scan_buffer_copy(b, c, p, header, header_size)) {
+                return PRIMITIVE_EOF;
+            }
+            hp = header;
+        }
+
+        msgpack_scan_header_t h;
+        int r = msgpack_scan_header(hp, header_size, &h);
+        if(r < 0) {
+            return r;
+        }
+
+        /* the state is updated only after the whole header is read */
+        s->remaining--;
+        switch(h.type) {
+        case TYPE_ARRAY:
+            s->remaining += h.count;
+            break;
+        case TYPE_MAP:
+            s->remaining += h.count * 2;
+            break;
+        case TYPE_STRING:
+        case TYPE_BINARY:
+        case TYPE_EXT:
+            s->raw_remaining = h.count;
+            break;
+        default:
+            break;
+        }
+        s->offset += header_size;
+        while(header_size > 0) {
+            size_t n = c->last - p;
+            if(n == 0) {
+                c = c->next;
+                p = c->first;
+                continue;
+            }
+            n = n < header_size ? n : header_size;
+            p += n;
+            header_size -= n;
+        }
+    }
+
+    return PRIMITIVE_OBJECT_COMPLETE;
+}
+
+int msgpack_scan_validate(const char* p, size_t length, const msgpack_scan_limits_t* limits, size_t* size)
+{
+    /* remaining entries of nested containers */
+    size_t local_stack[MSGPACK_SCAN_VALIDATE_STACK_CAPACITY];
+    size_t* stack = local_stack;
+    size_t capacity = MSGPACK_SCAN_VALIDATE_STACK_CAPACITY;
+    size_t depth = 0;
+    size_t offset = 0;
+    int r = PRIMITIVE_OBJECT_COMPLETE;
+
+    do {
+        msgpack_scan_header_t h;
+        r = msgpack_scan_header(p + offset, length - offset, &h);
+        if(r < 0) {
+            break;
+        }
+
+        size_t limit;
+        switch(h.type) {
+        case TYPE_ARRAY:
+            limit = limits->max_array_size;
+            break;
+        case TYPE_MAP:
+            limit = limits->max_map_size;
+            break;
+        case TYPE_STRING:
+        case TYPE_BINARY:
+            limit = limits->max_str_size;
+            break;
+        case TYPE_EXT:
+            limit = limits->max_ext_size;
+            break;
+        default:
+            limit = SIZE_MAX;
+        }
+        if(h.count > limit) {
+            r = PRIMITIVE_LIMIT_EXCEEDED;
+            break;
+        }
+
+        if(msgpack_scan_header_is_raw(&h)) {
+            if(length - offset - h.header_size < h.count) {
+                r = PRIMITIVE_EOF;
+                break;
+            }
+            if(h.type == TYPE_STRING && limits->validate_utf8 &&
+                    msgpack_utf8_validate(p + offset + h.header_size, h.count) == MSGPACK_UTF8_INVALID) {
+                r = PRIMITIVE_INVALID_UTF8;
+                break;
+            }
+        }
+
+        if(msgpack_scan_header_is_container(&h) && h.count > 0) {
+            if(depth >= limits->max_depth) {
+                r = PRIMITIVE_STACK_TOO_DEEP;
+                break;
+            }
+            if(depth == capacity) {
+                /* only deeply nested objects take memory; grows as the unpacker stack does */
+                capacity = capacity * 2 < limits->max_depth ? capacity * 2 : limits->max_depth;
+                if(stack == local_stack) {
+                    stack = ALLOC_N(size_t, capacity);
+                    memcpy(stack, local_stack, sizeof(local_stack));
+                } else {
+                    REALLOC_N(stack, size_t, capacity);
+                }
+            }
+            if(depth > 0) {
+                stack[depth-1]--;
+            }
+            stack[depth++] = h.type == TYPE_MAP ? h.count * 2 : h.count;
+            offset += h.header_size;
+            continue;
+        }
+
+        offset += h.header_size;
+        if(msgpack_scan_header_is_raw(&h)) {
+            offset += h.count;
+        }
+        if(depth > 0) {
+            stack[depth-1]--;
+        }
+
+        while(depth > 0 && stack[depth-1] == 0) {
+            depth--;
+        }
+    } while(depth > 0);
+
+    if(stack != local_stack) {
+        xfree(stack);
+    }
+
+    *size = offset;
+    return r < 0 ? r : PRIMITIVE_OBJECT_COMPLETE;
+}
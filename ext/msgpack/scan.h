@@ -0,0 +1,100 @@
+/*
+ * MessagePack for Ruby
+ *
+ * Copyright (C) 2008-2013 Sadayuki Furuhashi
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+#ifndef MSGPACK_RUBY_SCAN_H__
+#define MSGPACK_RUBY_SCAN_H__
+
+#include "unpacker.h"
+
+/*
+ * Scanner for serialized objects in contiguous memory.
+ * It doesn't allocate Ruby objects nor use a stack.
+ */
+
+typedef struct {
+    enum msgpack_unpacker_object_type type;  /* TYPE_STRING and TYPE_BINARY are used for raw types */
+    size_t header_size;  /* includes type byte of exttypes */
+    size_t count;        /* entries of arrays and maps, or length of the payload */
+    int8_t exttype;
+} msgpack_scan_header_t;
+
+/* returns size of the header which starts with the byte, or 0 if the byte is invalid */
+size_t msgpack_scan_header_size(unsigned char b);
+
+/* returns PRIMITIVE_OBJECT_COMPLETE, PRIMITIVE_EOF or PRIMITIVE_INVALID_BYTE */
+int msgpack_scan_header(const char* p, size_t length, msgpack_scan_header_t* h);
+
+/* sets size of the object at p to *size. returns same codes as msgpack_scan_header */
+int msgpack_scan_skip(const char* p, size_t length, size_t* size);
+
+/* state of msgpack_scan_skip_buffer kept while more data is read */
+typedef struct {
+    size_t offset;         /* scanned bytes from the read position */
+    size_t remaining;      /* objects to skip including nested ones */
+    size_t raw_remaining;  /* bytes of the payload being skipped */
+} msgpack_scan_buffer_state_t;
+
+static inline void msgpack_scan_buffer_state_init(msgpack_scan_buffer_state_t* s)
+{
+    s->offset = 0;
+    s->remaining = 1;
+    s->raw_remaining = 0;
+}
+
+/*
+ * Same as msgpack_scan_skip but scans the chunks of a buffer without consuming
+ * them. Size of the object is s->offset when it returns PRIMITIVE_OBJECT_COMPLETE.
+ * After PRIMITIVE_EOF, it can be called again with the same state once more data
+ * is appended to the buffer so that the bytes already scanned are not scanned again.
+ */
+int msgpack_scan_skip_buffer(msgpack_buffer_t* b, msgpack_scan_buffer_state_t* s);
+
+/* limits checked by msgpack_scan_validate */
+typedef struct {
+    size_t max_depth;
+    size_t max_array_size;
+    size_t max_map_size;
+    size_t max_str_size;
+    size_t max_ext_size;
+    bool validate_utf8;
+} msgpack_scan_limits_t;
+
+/* nesting depth validated without allocating memory */
+#ifndef MSGPACK_SCAN_VALIDATE_STACK_CAPACITY
+#define MSGPACK_SCAN_VALIDATE_STACK_CAPACITY 128
+#endif
+
+/*
+ * Validates the object at p without creating objects. Sets size of the object
+ * to *size, or offset of the invalid or truncated object if it's not valid.
+ * returns PRIMITIVE_OBJECT_COMPLETE, PRIMITIVE_EOF, PRIMITIVE_INVALID_BYTE,
+ * PRIMITIVE_STACK_TOO_DEEP, PRIMITIVE_LIMIT_EXCEEDED or PRIMITIVE_INVALID_UTF8
+ */
+int msgpack_scan_validate(const char* p, size_t length, const msgpack_scan_limits_t* limits, size_t* size);
+
+static inline bool msgpack_scan_header_is_container(const msgpack_scan_header_t* h)
+{
+    return h->type == TYPE_ARRAY || h->type == TYPE_MAP;
+}
+
+static inline bool msgpack_scan_header_is_raw(const msgpack_scan_header_t* h)
+{
+    return h->type == TYPE_STRING || h->type == TYPE_BINARY || h->type == TYPE_EXT;
+}
+
+#endif
+
@@ -0,0 +1,361 @@
+/*
+ * MessagePack for Ruby
+ *
+ * Copyright (C) 2008-2013 Sadayuki Furuhashi
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include "stream_index_class.h"
+#include "unpacker_class.h"
+#include "buffer_class.h"
+#include "scan.h"
+
+VALUE cMessagePack_StreamIndex;
+
+/*
+ * A StreamIndex refers to a frozen String of concatenated objects and keeps
+ * offsets of the objects. The offsets are followed by the end of the last
+ * object so that size of object i is offsets[i+1] - offsets[i].
+ */
+typedef struct {
+    VALUE source;     /* frozen String */
+    VALUE decoder;    /* Unpacker */
+    size_t* offsets;
+    size_t length;    /* number of offsets including the end */
+    size_t capacity;
+} msgpack_stream_index_t;
+
+#define STREAM_INDEX(from, name) \
+    msgpack_stream_index_t *name = NULL; \
+    Data_Get_Struct(from, msgpack_stream_index_t, name); \
+    if(name == NULL) { \
+        rb_raise(rb_eArgError, "NULL found for " # name " when shouldn't be."); \
+    }
+
+#define STREAM_INDEX_DUMP_ENTRY_SIZE 8
+
+static void StreamIndex_mark(msgpack_stream_index_t* si)
+{
+    rb_gc_mark(si->source);
+    rb_gc_mark(si->decoder);
+}
+
+static void StreamIndex_free(msgpack_stream_index_t* si)
+{
+    if(si == NULL) {
+        return;
+    }
+    xfree(si->offsets);
+    xfree(si);
+}
+
+static VALUE StreamIndex_alloc(VALUE klass)
+{
+    msgpack_stream_index_t* si = ALLOC_N(msgpack_stream_index_t, 1);
+    memset(si, 0, sizeof(msgpack_stream_index_t));
+    si->source = Qnil;
+    si->decoder = Qnil;
+    return Data_Wrap_Struct(klass, StreamIndex_mark, StreamIndex_free, si);
+}
+
+static inline size_t _stream_index_count(msgpack_stream_index_t* si)
+{
+    return si->length == 0 ? 0 : si->length - 1;
+}
+
+static inline void _stream_index_push(msgpack_stream_index_t* si, size_t offset)
+{
+    if(si->length == si->capacity) {
+        size_t capacity = si->capacity == 0 ? 64 : si->capacity * 2;
+        REALLOC_N(si->offsets, size_t, capacity);
+        si->capacity = capacity;
+    }
+    si->offsets[si->length++] = offset;
+}
+
+/*
+ * Appends offsets of objects in p[0, length) followed by the end of the last
+ * object. An incomplete object at the end is not indexed.
+ */
+static void _stream_index_scan(msgpack_stream_index_t* si, const char* p, size_t length)
+{
+    size_t pos = 0;
+    while(pos < length) {
+        size_t size;
+        int r = msgpack_scan_skip(p + pos, length - pos, &size);
+        if(r == PRIMITIVE_EOF) {
+            break;
+        }
+        if(r < 0) {
+            raise_unpacker_error(r);
+        }
+        _stream_index_push(si, pos);
+        pos += size;
+    }
+    _stream_index_push(si, pos);
+}
+
+static VALUE _stream_index_source(VALUE src)
+{
+    if(rb_obj_is_kind_of(src, cMessagePack_Buffer)) {
+        msgpack_buffer_t* b;
+        Data_Get_Struct(src, msgpack_buffer_t, b);
+        src = msgpack_buffer_all_as_string(b);
+    } else {
+        StringValue(src);
+    }
+    return rb_str_new_frozen(src);
+}
+
+static void _stream_index_set_source(msgpack_stream_index_t* si, VALUE src, VALUE options)
+{
+    if(options != Qnil && rb_type(options) != T_HASH) {
+        rb_raise(rb_eArgError, "expected Hash but found %s.", rb_obj_classname(options));
+    }
+    si->source = _stream_index_source(src);
+    si->decoder = rb_class_new_instance(options == Qnil ? 0 : 1, &options, cMessagePack_Unpacker);
+}
+
+static VALUE _stream_index_decode(msgpack_stream_index_t* si, size_t i)
+{
+    msgpack_unpacker_t* uk;
+    Data_Get_Struct(si->decoder, msgpack_unpacker_t, uk);
+    msgpack_buffer_t* b = UNPACKER_BUFFER_(uk);
+
+    size_t pos = si->offsets[i];
+    size_t length = si->offsets[i+1] - pos;
+
+    _msgpack_unpacker_reset(uk);
+
+    if(length >= MSGPACK_BUFFER_STRING_WRITE_REFERENCE_MINIMUM) {
+        /* refers the source instead of copying long strings */
+        msgpack_buffer_append_string(b, rb_str_substr(si->source, pos, length));
+    } else {
+        msgpack_buffer_append(b, RSTRING_PTR(si->source) + pos, length);
+    }
+
+    int r = msgpack_unpacker_read(uk, 0);
+    if(r < 0) {
+        _msgpack_unpacker_reset(uk);
+        raise_unpacker_error(r);
+    }
+
+    return msgpack_unpacker_get_last_object(uk);
+}
+
+/* converts an Integer index to a position; returns false if it's out of range */
+static bool _stream_index_position(msgpack_stream_index_t* si, VALUE index, size_t* result)
+{
+    long i = NUM2LONG(index);
+    long count = (long) _stream_index_count(si);
+    if(i < 0) {
+        i += count;
+    }
+    if(i < 0 || i >= count) {
+        return false;
+    }
+    *result = (size_t) i;
+    return true;
+}
+
+static VALUE StreamIndex_initialize(int argc, VALUE* argv, VALUE self)
+{
+    if(argc < 1 || argc > 2) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 1..2)", argc);
+    }
+    STREAM_INDEX(self, si);
+
+    _stream_index_set_source(si, argv[0], argc == 2 ? argv[1] : Qnil);
+    /* initialize called again indexes the new source from the start */
+    si->length = 0;
+    _stream_index_scan(si, RSTRING_PTR(si->source), RSTRING_LEN(si->source));
+
+    return self;
+}
+
+static VALUE StreamIndex_s_load(int argc, VALUE* argv, VALUE klass)
+{
+    if(argc < 2 || argc > 3) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 2..3)", argc);
+    }
+    VALUE index = argv[1];
+    StringValue(index);
+
+    VALUE self = StreamIndex_alloc(klass);
+    STREAM_INDEX(self, si);
+    _stream_index_set_source(si, argv[0], argc == 3 ? argv[2] : Qnil);
+
+    const unsigned char* p = (const unsigned char*) RSTRING_PTR(index);
+    size_t length = RSTRING_LEN(index);
+    if(length == 0 || length % STREAM_INDEX_DUMP_ENTRY_SIZE != 0) {
+        rb_raise(rb_eArgError, "invalid stream index");
+    }
+
+    /* offsets are stored as 64-bit little-endian integers */
+    size_t last = 0;
+    size_t n;
+    for(n=0; n < length; n += STREAM_INDEX_DUMP_ENTRY_SIZE) {
+        uint64_t v = 0;
+        int k;
+        for(k=STREAM_INDEX_DUMP_ENTRY_SIZE-1; k >= 0; k--) {
+            v = (v << 8) | p[n+k];
+        }
+        if(v < last || v > (uint64_t) RSTRING_LEN(si->source)) {
+            rb_raise(rb_eArgError, "stream index doesn't match the source");
+        }
+        _stream_index_push(si, (size_t) v);
+        last = (size_t) v;
+    }
+
+    return self;
+}
+
+static VALUE StreamIndex_size(VALUE self)
+{
+    STREAM_INDEX(self, si);
+    return SIZET2NUM(_stream_index_count(si));
+}
+
+static VALUE StreamIndex_empty_p(VALUE self)
+{
+    STREAM_INDEX(self, si);
+    return _stream_index_count(si) == 0 ? Qtrue : Qfalse;
+}
+
+static VALUE StreamIndex_source(VALUE self)
+{
+    STREAM_INDEX(self, si);
+    return si->source;
+}
+
+static VALUE StreamIndex_aref(VALUE self, VALUE index)
+{
+    STREAM_INDEX(self, si);
+    size_t i;
+    if(!_stream_index_position(si, index, &i)) {
+        return Qnil;
+    }
+    return _stream_index_decode(si, i);
+}
+
+static VALUE StreamIndex_offset(VALUE self, VALUE index)
+{
+    STREAM_INDEX(self, si);
+    size_t i;
+    if(!_stream_index_position(si, index, &i)) {
+        return Qnil;
+    }
+    return SIZET2NUM(si->offsets[i]);
+}
+
+static VALUE StreamIndex_end_offset(VALUE self)
+{
+    STREAM_INDEX(self, si);
+    if(si->length == 0) {
+        /* allocated without initialize */
+        rb_raise(rb_eTypeError, "uninitialized %s", rb_obj_classname(self));
+    }
+    return SIZET2NUM(si->offsets[si->length - 1]);
+}
+
+static VALUE StreamIndex_offsets(VALUE self)
+{
+    STREAM_INDEX(self, si);
+    size_t count = _stream_index_count(si);
+    VALUE ary = rb_ary_new2(count);
+    size_t i;
+    for(i=0; i < count; i++) {
+        rb_ary_push(ary, SIZET2NUM(si->offsets[i]));
+    }
+    return ary;
+}
+
+static VALUE StreamIndex_each(int argc, VALUE* argv, VALUE self)
+{
+    STREAM_INDEX(self, si);
+
+    if(argc > 1) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 0..1)", argc);
+    }
+
+#ifdef RETURN_ENUMERATOR
+    RETURN_ENUMERATOR(self, argc, argv);
+#endif
+
+    size_t i = 0;
+    if(argc == 1 && !_stream_index_position(si, argv[0], &i)) {
+        return self;
+    }
+
+    /* objects are decoded one by one so that the block can use this index */
+    for(; i < _stream_index_count(si); i++) {
+        rb_yield(_stream_index_decode(si, i));
+    }
+    return self;
+}
+
+static VALUE StreamIndex_dump(VALUE self)
+{
+    STREAM_INDEX(self, si);
+
+    VALUE dump = rb_str_new(NULL, si->length * STREAM_INDEX_DUMP_ENTRY_SIZE);
+    unsigned char* p = (unsigned char*) RSTRING_PTR(dump);
+    size_t i;
+    for(i=0; i < si->length; i++) {
+        uint64_t v = si->offsets[i];
+        int k;
+        for(k=0; k < STREAM_INDEX_DUMP_ENTRY_SIZE; k++) {
+            *p++ = (unsigned char) (v & 0xff);
+            v >>= 8;
+        }
+    }
+    return dump;
+}
+
+static VALUE MessagePack_scan_offsets_module_method(VALUE mod, VALUE src)
+{
+    UNUSED(mod);
+
+    VALUE self = StreamIndex_alloc(cMessagePack_StreamIndex);
+    STREAM_INDEX(self, si);
+
+    /* scans the source without copying it */
+    VALUE source = _stream_index_source(src);
+    _stream_index_scan(si, RSTRING_PTR(source), RSTRING_LEN(source));
+    RB_GC_GUARD(source);
+
+    return StreamIndex_offsets(self);
+}
+
+void MessagePack_StreamIndex_module_init(VALUE mMessagePack)
+{
+    cMessagePack_StreamIndex = rb_define_class_under(mMessagePack, "StreamIndex", rb_cObject);
+    rb_define_alloc_func(cMessagePack_StreamIndex, StreamIndex_alloc);
+    rb_include_module(cMessagePack_StreamIndex, rb_mEnumerable);
+
+    rb_define_singleton_method(cMessagePack_StreamIndex, "load", StreamIndex_s_load, -1);
+    rb_define_method(cMessagePack_StreamIndex, "initialize", StreamIndex_initialize, -1);
+    rb_define_method(cMessagePack_StreamIndex, "[]", StreamIndex_aref, 1);
+    rb_define_method(cMessagePack_StreamIndex, "each", StreamIndex_each, -1);
+    rb_define_method(cMessagePack_StreamIndex, "size", StreamIndex_size, 0);
+    rb_define_alias(cMessagePack_StreamIndex, "length", "size");
+    rb_define_method(cMessagePack_StreamIndex, "empty?", StreamIndex_empty_p, 0);
+    rb_define_method(cMessagePack_StreamIndex, "offset", StreamIndex_offset, 1);
+    rb_define_method(cMessagePack_StreamIndex, "offsets", StreamIndex_offsets, 0);
+    rb_define_method(cMessagePack_StreamIndex, "end_offset", StreamIndex_end_offset, 0);
+    rb_define_method(cMessagePack_StreamIndex, "source", StreamIndex_source, 0);
+    rb_define_method(cMessagePack_StreamIndex, "dump", StreamIndex_dump, 0);
+
+    rb_define_module_function(mMessagePack, "scan_offsets", MessagePack_scan_offsets_module_method, 1);
+}
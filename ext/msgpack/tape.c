@@ -0,0 +1,264 @@
+/*
+ * MessagePack for Ruby
+ *
+ * Copyright (C) 2008-2013 Sadayuki Furuhashi
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include "tape.h"
+#include "scan.h"
+
+/* initial capacities; they grow twice as needed */
+#define MSGPACK_TAPE_INITIAL_CAPACITY 256
+#define MSGPACK_TAPE_INITIAL_STACK_CAPACITY 32
+
+void msgpack_tape_init(msgpack_tape_t* t)
+{
+    memset(t, 0, sizeof(msgpack_tape_t));
+}
+
+void msgpack_tape_destroy(msgpack_tape_t* t)
+{
+    free(t->entries);
+    free(t->stack);
+    if(t->values != NULL) {
+        xfree(t->values);
+    }
+}
+
+void msgpack_tape_mark(msgpack_tape_t* t)
+{
+    if(t->values != NULL) {
+        rb_gc_mark_locations(t->values, t->values + t->values_size);
+    }
+}
+
+static inline uint16_t _msgpack_tape_load16(const char* p)
+{
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return _msgpack_be16(v);
+}
+
+static inline uint32_t _msgpack_tape_load32(const char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return _msgpack_be32(v);
+}
+
+static inline uint64_t _msgpack_tape_load64(const char* p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return _msgpack_be64(v);
+}
+
+static void _msgpack_tape_read_number(const char* p, msgpack_tape_entry_t* e)
+{
+    unsigned char b = (unsigned char) p[0];
+    if(b <= 0x7f) {
+        e->tag = MSGPACK_TAPE_UINT;
+        e->as.u = b;
+        return;
+    } else if(b >= 0xe0) {
+        e->tag = MSGPACK_TAPE_INT;
+        e->as.i = (int8_t) b;
+        return;
+    }
+
+    union {
+        uint32_t u32;
+        float f;
+        uint64_t u64;
+        double d;
+    } cb;
+
+    switch(b) {
+    case 0xca:
+        cb.u32 = _msgpack_tape_load32(p + 1);
+        e->tag = MSGPACK_TAPE_FLOAT;
+        e->as.d = cb.f;
+        break;
+    case 0xcb:
+        memcpy(&cb.u64, p + 1, 8);
+        cb.u64 = _msgpack_be_double(cb.u64);
+        e->tag = MSGPACK_TAPE_FLOAT;
+        e->as.d = cb.d;
+        break;
+    case 0xcc:
+        e->tag = MSGPACK_TAPE_UINT;
+        e->as.u = (unsigned char) p[1];
+        break;
+    case 0xcd:
+        e->tag = MSGPACK_TAPE_UINT;
+        e->as.u = _msgpack_tape_load16(p + 1);
+        break;
+    case 0xce:
+        e->tag = MSGPACK_TAPE_UINT;
+        e->as.u = _msgpack_tape_load32(p + 1);
+        break;
+    case 0xcf:
+        e->tag = MSGPACK_TAPE_UINT;
+        e->as.u = _msgpack_tape_load64(p + 1);
+        break;
+    case 0xd0:
+        e->tag = MSGPACK_TAPE_INT;
+        e->as.i = (int8_t) p[1];
+        break;
+    case 0xd1:
+        e->tag = MSGPACK_TAPE_INT;
+        e->as.i = (int16_t) _msgpack_tape_load16(p + 1);
+        break;
+    case 0xd2:
+        e->tag = MSGPACK_TAPE_INT;
+        e->as.i = (int32_t) _msgpack_tape_load32(p + 1);
+        break;
+    default:  /* 0xd3 */
+        e->tag = MSGPACK_TAPE_INT;
+        e->as.i = (int64_t) _msgpack_tape_load64(p + 1);
+        break;
+    }
+}
+
+static bool _msgpack_tape_reserve(msgpack_tape_t* t)
+{
+    if(t->size < t->capacity) {
+        return true;
+    }
+    size_t capacity = t->capacity == 0 ? MSGPACK_TAPE_INITIAL_CAPACITY : t->capacity * 2;
+    msgpack_tape_entry_t* entries = realloc(t->entries, sizeof(msgpack_tape_entry_t) * capacity);
+    if(entries == NULL) {
+        return false;
+    }
+    t->entries = entries;
+    t->capacity = capacity;
+    return true;
+}
+
+static int _msgpack_tape_push(msgpack_tape_t* t, size_t remaining, bool map)
+{
+    if(t->depth >= t->max_depth) {
+        return PRIMITIVE_STACK_TOO_DEEP;
+    }
+    if(t->depth == t->stack_capacity) {
+        size_t capacity = t->stack_capacity == 0 ? MSGPACK_TAPE_INITIAL_STACK_CAPACITY : t->stack_capacity * 2;
+        msgpack_tape_frame_t* stack = realloc(t->stack, sizeof(msgpack_tape_frame_t) * capacity);
+        if(stack == NULL) {
+            return MSGPACK_TAPE_NO_MEMORY;
+        }
+        t->stack = stack;
+        t->stack_capacity = capacity;
+    }
+    t->stack[t->depth].remaining = remaining;
+    t->stack[t->depth].map = map;
+    t->depth++;
+    return PRIMITIVE_CONTAINER_START;
+}
+
+int msgpack_tape_parse(msgpack_tape_t* t, const char* p, size_t length)
+{
+    while(true) {
+        msgpack_tape_frame_t* top = NULL;
+        if(t->depth > 0) {
+            top = &t->stack[t->depth-1];
+            if(top->remaining == 0) {
+                t->depth--;
+                continue;
+            }
+        } else if(t->size > 0) {
+            return PRIMITIVE_OBJECT_COMPLETE;
+        }
+
+        if(!_msgpack_tape_reserve(t)) {
+            return MSGPACK_TAPE_NO_MEMORY;
+        }
+
+        msgpack_scan_header_t h;
+        int r = msgpack_scan_header(p + t->offset, length - t->offset, &h);
+        if(r < 0) {
+            return r;
+        }
+
+        msgpack_tape_entry_t* e = &t->entries[t->size];
+        e->flags = (top != NULL && top->map && top->remaining % 2 == 0) ? MSGPACK_TAPE_ENTRY_MAP_KEY : 0;
+        e->exttype = h.exttype;
+        e->count = (uint32_t) h.count;
+        e->as.u = 0;
+
+        bool container = false;
+        switch(h.type) {
+        case TYPE_NIL:
+            e->tag = MSGPACK_TAPE_NIL;
+            break;
+        case TYPE_BOOLEAN:
+            e->tag = (unsigned char) p[t->offset] == 0xc3 ? MSGPACK_TAPE_TRUE : MSGPACK_TAPE_FALSE;
+            break;
+        case TYPE_INTEGER:
+        case TYPE_FLOAT:
+            _msgpack_tape_read_number(p + t->offset, e);
+            break;
+        case TYPE_STRING:
+        case TYPE_BINARY:
+        case TYPE_EXT:
+            if(h.count > (h.type == TYPE_EXT ? t->max_ext_size : t->max_str_size)) {
+                return PRIMITIVE_LIMIT_EXCEEDED;
+            }
+            if(length - t->offset - h.header_size < h.count) {
+                return PRIMITIVE_EOF;
+            }
+            e->tag = h.type == TYPE_STRING ? MSGPACK_TAPE_STRING :
+                (h.type == TYPE_BINARY ? MSGPACK_TAPE_BINARY : MSGPACK_TAPE_EXT);
+            e->as.offset = t->offset + h.header_size;
+            break;
+        case TYPE_ARRAY:
+            if(h.count > t->max_array_size) {
+                return PRIMITIVE_LIMIT_EXCEEDED;
+            }
+            e->tag = MSGPACK_TAPE_ARRAY;
+            container = h.count > 0;
+            break;
+        default:  /* TYPE_MAP */
+            if(h.count > t->max_map_size) {
+                return PRIMITIVE_LIMIT_EXCEEDED;
+            }
+            e->tag = MSGPACK_TAPE_MAP;
+            container = h.count > 0;
+            break;
+        }
+
+        if(container) {
+            r = _msgpack_tape_push(t, e->tag == MSGPACK_TAPE_MAP ? h.count * 2 : h.count, e->tag == MSGPACK_TAPE_MAP);
+            if(r < 0) {
+                return r;
+            }
+            /* the stack may have been reallocated */
+            top = t->depth > 1 ? &t->stack[t->depth-2] : NULL;
+        }
+        if(top != NULL) {
+            top->remaining--;
+        }
+        t->offset += h.header_size;
+        if(msgpack_scan_header_is_raw(&h)) {
+            t->offset += h.count;
+        }
+        t->size++;
+
+        /* checked after reading an entry to make progress on each call */
+        if(t->interrupted) {
+            t->interrupted = 0;
+            return MSGPACK_TAPE_INTERRUPTED;
+        }
+    }
+}
@@ -0,0 +1,126 @@
+/*
+ * MessagePack for Ruby
+ *
+ * Copyright (C) 2008-2013 Sadayuki Furuhashi
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+#ifndef MSGPACK_RUBY_TAPE_H__
+#define MSGPACK_RUBY_TAPE_H__
+
+#include "unpacker.h"
+
+/*
+ * Tape of a serialized object in contiguous memory.
+ *
+ * msgpack_tape_parse validates the whole object and records one entry per
+ * object in depth-first order. It doesn't call any Ruby API so that it can
+ * run without the GVL. msgpack_unpacker_read_tape builds Ruby objects from
+ * the entries afterwards.
+ */
+
+enum msgpack_tape_tag_t {
+    MSGPACK_TAPE_NIL = 0,
+    MSGPACK_TAPE_TRUE,
+    MSGPACK_TAPE_FALSE,
+    MSGPACK_TAPE_UINT,
+    MSGPACK_TAPE_INT,
+    MSGPACK_TAPE_FLOAT,
+    MSGPACK_TAPE_STRING,
+    MSGPACK_TAPE_BINARY,
+    MSGPACK_TAPE_EXT,
+    MSGPACK_TAPE_ARRAY,
+    MSGPACK_TAPE_MAP,
+};
+
+#define MSGPACK_TAPE_ENTRY_MAP_KEY 0x01
+
+typedef struct {
+    uint8_t tag;      /* enum msgpack_tape_tag_t */
+    uint8_t flags;
+    int8_t exttype;
+    uint32_t count;   /* entries of arrays, pairs of maps or length of raw payloads */
+    union {
+        uint64_t u;
+        int64_t i;
+        double d;
+        size_t offset;  /* of raw payloads in the source */
+    } as;
+} msgpack_tape_entry_t;
+
+typedef struct {
+    size_t remaining;  /* entries to read; twice the pairs for maps */
+    bool map;
+    /* set by msgpack_unpacker_read_tape */
+    size_t entry;      /* index of the container entry */
+    size_t values;     /* position of the first child in values */
+} msgpack_tape_frame_t;
+
+/* returned by msgpack_tape_parse in addition to PRIMITIVE_* codes */
+#define MSGPACK_TAPE_INTERRUPTED -100
+#define MSGPACK_TAPE_NO_MEMORY -101
+
+typedef struct {
+    msgpack_tape_entry_t* entries;
+    size_t size;
+    size_t capacity;
+
+    /* state of parsing; msgpack_tape_parse resumes from here */
+    size_t offset;
+    msgpack_tape_frame_t* stack;
+    size_t depth;
+    size_t stack_capacity;
+    volatile int interrupted;
+
+    /* limits of the unpacker */
+    size_t max_depth;
+    size_t max_array_size;
+    size_t max_map_size;
+    size_t max_str_size;
+    size_t max_ext_size;
+
+    /* children of containers being built by msgpack_unpacker_read_tape */
+    VALUE* values;
+    size_t values_size;
+} msgpack_tape_t;
+
+void msgpack_tape_init(msgpack_tape_t* t);
+
+void msgpack_tape_destroy(msgpack_tape_t* t);
+
+void msgpack_tape_mark(msgpack_tape_t* t);
+
+/*
+ * Parses one object at p. Returns PRIMITIVE_OBJECT_COMPLETE and sets t->offset to
+ * the size of the object, or an error code. It can be resumed after
+ * MSGPACK_TAPE_INTERRUPTED, which is returned after msgpack_tape_interrupt.
+ * Allocates memory with malloc because it runs without the GVL.
+ */
+int msgpack_tape_parse(msgpack_tape_t* t, const char* p, size_t length);
+
+static inline void msgpack_tape_interrupt(msgpack_tape_t* t)
+{
+    t->interrupted = 1;
+}
+
+/*
+ * Builds the object of a parsed tape as msgpack_unpacker_read does and sets it
+ * to uk->last_object. Objects are built in the order of the source, so that
+ * ext types and shapes are called in the same order as msgpack_unpacker_read.
+ * Raw payloads are read from source, which must be the frozen binary String
+ * parsed by msgpack_tape_parse. Defined in unpacker.c.
+ */
+int msgpack_unpacker_read_tape(msgpack_unpacker_t* uk, msgpack_tape_t* t, VALUE source);
+
+#endif
+
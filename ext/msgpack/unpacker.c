@@ -19,6 +19,10 @@
 #include "unpacker.h"
 #include "rmem.h"
 #include "exttype_class.h"
+#include "buffer_class.h"
+#include "utf8.h"
+#include "scan.h"
+#include "tape.h"
 
 #if !defined(DISABLE_RMEM) && !defined(DISABLE_UNPACKER_STACK_RMEM) && \
         MSGPACK_UNPACKER_STACK_CAPACITY * MSGPACK_UNPACKER_STACK_SIZE <= MSGPACK_RMEM_PAGE_SIZE
@@ -30,6 +34,8 @@ static msgpack_rmem_t s_stack_rmem;
 #endif
 
 VALUE msgpack_unpacker_class_extended_types = Qfalse;
+static VALUE msgpack_unpacker_class_extended_type_payloads = Qnil;
+unsigned long msgpack_unpacker_extended_types_serial = 0;
 
 void msgpack_unpacker_static_init()
 {
@@ -60,6 +66,7 @@ static inline void _msgpack_unpacker_make_extended_hash(VALUE *extended_types) {
 
 void msgpack_unpacker_class_set_default_extended_type(VALUE val)
 {
+    msgpack_unpacker_extended_types_serial++;
     if(RTEST(val) || RTEST(msgpack_unpacker_class_extended_types)) {
         _msgpack_unpacker_make_extended_hash(&msgpack_unpacker_class_extended_types);
         rb_gc_register_address( &msgpack_unpacker_class_extended_types);
@@ -71,10 +78,34 @@ void msgpack_unpacker_class_set_default_extended_type(VALUE val)
 
 void msgpack_unpacker_class_set_extended_type(int8_t typenr, VALUE val)
 {
+    msgpack_unpacker_extended_types_serial++;
     _msgpack_unpacker_make_extended_hash(&msgpack_unpacker_class_extended_types);
     rb_hash_aset(msgpack_unpacker_class_extended_types, INT2FIX(typenr), val);
 }
 
+static void _msgpack_unpacker_set_extended_type_payload(VALUE* payloads, VALUE typenr, enum msgpack_unpacker_exttype_payload_t payload)
+{
+    msgpack_unpacker_extended_types_serial++;
+    if(payload == MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_STRING) {
+        if(*payloads != Qnil) {
+            rb_hash_delete(*payloads, typenr);
+        }
+        return;
+    }
+    if(*payloads == Qnil) {
+        *payloads = rb_hash_new();
+    }
+    rb_hash_aset(*payloads, typenr, INT2FIX(payload));
+}
+
+void msgpack_unpacker_class_set_extended_type_payload(int8_t typenr, enum msgpack_unpacker_exttype_payload_t payload)
+{
+    if(msgpack_unpacker_class_extended_type_payloads == Qnil && payload != MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_STRING) {
+        rb_gc_register_address(&msgpack_unpacker_class_extended_type_payloads);
+    }
+    _msgpack_unpacker_set_extended_type_payload(&msgpack_unpacker_class_extended_type_payloads, INT2FIX(typenr), payload);
+}
+
 
 void _msgpack_unpacker_init(msgpack_unpacker_t* uk)
 {
@@ -87,6 +118,16 @@ void _msgpack_unpacker_init(msgpack_unpacker_t* uk)
     uk->last_object = Qnil;
     uk->reading_raw = Qnil;
     uk->extended_types = Qnil;
+    uk->extended_type_payloads = Qnil;
+    uk->shapes = Qnil;
+    uk->reading_columns = Qnil;
+    uk->reading_columns_keys = Qnil;
+    uk->reading_columns_slots = Qnil;
+    uk->reading_columns_key = Qnil;
+
+    uk->values = uk->values_embedded;
+    uk->values_capacity = MSGPACK_UNPACKER_EMBEDDED_VALUES_CAPACITY;
+    uk->decoder_ref = Qnil;
 
 #ifdef UNPACKER_STACK_RMEM
     uk->stack = msgpack_rmem_alloc(&s_stack_rmem);
@@ -96,15 +137,34 @@ void _msgpack_unpacker_init(msgpack_unpacker_t* uk)
     uk->stack = malloc(MSGPACK_UNPACKER_STACK_CAPACITY * sizeof(msgpack_unpacker_stack_t));
 #endif
     uk->stack_capacity = MSGPACK_UNPACKER_STACK_CAPACITY;
+    uk->max_depth = MSGPACK_UNPACKER_DEFAULT_MAX_DEPTH;
+
+    uk->max_array_size = SIZE_MAX;
+    uk->max_map_size = SIZE_MAX;
+    uk->max_str_size = SIZE_MAX;
+    uk->max_ext_size = SIZE_MAX;
+    uk->max_buffer_size = SIZE_MAX;
 }
 
 void _msgpack_unpacker_destroy(msgpack_unpacker_t* uk)
 {
+    free(uk->key_cache);
+    xfree(uk->exttype_table);
+
+    if(uk->values != uk->values_embedded) {
+        xfree(uk->values);
+    }
+
+    if(uk->stack_capacity > MSGPACK_UNPACKER_STACK_CAPACITY) {
+        /* grown by _msgpack_unpacker_stack_grow */
+        xfree(uk->stack);
+    } else {
 #ifdef UNPACKER_STACK_RMEM
-    msgpack_rmem_free(&s_stack_rmem, uk->stack);
+        msgpack_rmem_free(&s_stack_rmem, uk->stack);
 #else
-    free(uk->stack);
+        free(uk->stack);
 #endif
+    }
 
     msgpack_buffer_destroy(UNPACKER_BUFFER_(uk));
 }
@@ -114,12 +174,33 @@ void msgpack_unpacker_mark(msgpack_unpacker_t* uk)
     rb_gc_mark(uk->last_object);
     rb_gc_mark(uk->reading_raw);
     rb_gc_mark(uk->extended_types);
+    rb_gc_mark(uk->extended_type_payloads);
+    rb_gc_mark(uk->shapes);
+
+    if(uk->exttype_table != NULL) {
+        int i;
+        for(i=0; i < MSGPACK_UNPACKER_EXTTYPE_TABLE_SIZE; i++) {
+            rb_gc_mark(uk->exttype_table[i].target);
+        }
+    }
+    rb_gc_mark(uk->decoder_ref);
+    rb_gc_mark(uk->reading_columns);
+    rb_gc_mark(uk->reading_columns_keys);
+    rb_gc_mark(uk->reading_columns_slots);
+    rb_gc_mark(uk->reading_columns_key);
+
+    if(uk->key_cache != NULL) {
+        msgpack_unpacker_key_cache_entry_t* e = uk->key_cache;
+        msgpack_unpacker_key_cache_entry_t* eend = uk->key_cache + MSGPACK_UNPACKER_KEY_CACHE_SIZE;
+        for(; e < eend; e++) {
+            rb_gc_mark(e->string);
+            rb_gc_mark(e->key);
+        }
+    }
 
-    msgpack_unpacker_stack_t* s = uk->stack;
-    msgpack_unpacker_stack_t* send = uk->stack + uk->stack_depth;
-    for(; s < send; s++) {
-        rb_gc_mark(s->object);
-        rb_gc_mark(s->key);
+    size_t i;
+    for(i=0; i < uk->values_size; ++i) {
+        rb_gc_mark(uk->values[i]);
     }
 
     /* See MessagePack_Buffer_wrap */
@@ -135,14 +216,47 @@ void _msgpack_unpacker_reset(msgpack_unpacker_t* uk)
 
     /*memset(uk->stack, 0, sizeof(msgpack_unpacker_t) * uk->stack_depth);*/
     uk->stack_depth = 0;
+    uk->values_size = 0;
 
     uk->last_object = Qnil;
     uk->reading_raw = Qnil;
     uk->reading_raw_remaining = 0;
+    uk->reading_raw_extended = false;
+
+    uk->skipping = false;
+    uk->skipping_raw_remaining = 0;
+
+    uk->reading_events = false;
+    uk->stack_of_events = false;
+
+    uk->reading_columns = Qnil;
+    uk->reading_columns_keys = Qnil;
+    uk->reading_columns_slots = Qnil;
+    uk->reading_columns_key = Qnil;
+}
+
+void msgpack_unpacker_set_key_cache(msgpack_unpacker_t* uk, bool enable)
+{
+    if(!enable) {
+        free(uk->key_cache);
+        uk->key_cache = NULL;
+        return;
+    }
+    if(uk->key_cache != NULL) {
+        return;
+    }
+
+    /* empty entries are zero-filled; Qfalse is 0 */
+    msgpack_unpacker_key_cache_entry_t* cache = calloc(MSGPACK_UNPACKER_KEY_CACHE_SIZE, sizeof(msgpack_unpacker_key_cache_entry_t));
+    if(cache == NULL) {
+        rb_raise(rb_eNoMemError, "failed to allocate key cache");
+    }
+    uk->key_cache = cache;
 }
 
 void msgpack_unpacker_set_default_extended_type(msgpack_unpacker_t* uk, VALUE val)
 {
+    msgpack_unpacker_extended_types_serial++;
     if(RTEST(val) || RTEST(uk->extended_types)) {
         _msgpack_unpacker_make_extended_hash(&uk->extended_types);
         rb_hash_set_ifnone(uk->extended_types, val);
@@ -151,8 +265,14 @@ void msgpack_unpacker_set_default_extended_type(msgpack_unpacker_t* uk, VALUE va
     }
 }
 
+void msgpack_unpacker_set_extended_type_payload(msgpack_unpacker_t* uk, VALUE typenr, enum msgpack_unpacker_exttype_payload_t payload)
+{
+    _msgpack_unpacker_set_extended_type_payload(&uk->extended_type_payloads, typenr, payload);
+}
+
 void msgpack_unpacker_set_extended_type(msgpack_unpacker_t* uk, VALUE typenr, VALUE val)
 {
+    msgpack_unpacker_extended_types_serial++;
     _msgpack_unpacker_make_extended_hash(&uk->extended_types);
     if(val == Qnil) {
         rb_hash_delete(uk->extended_types, typenr);
@@ -193,12 +313,58 @@ static inline int object_complete(msgpack_unpacker_t* uk, VALUE object)
     return PRIMITIVE_OBJECT_COMPLETE;
 }
 
+/* Strings, Arrays and Hashes are completed through this for the freeze option */
+static inline int object_complete_mutable(msgpack_unpacker_t* uk, VALUE object)
+{
+    if(uk->freeze) {
+        rb_obj_freeze(object);
+    }
+    return object_complete(uk, object);
+}
+
+#ifdef COMPAT_HAVE_ENCODING
+static int object_complete_validated_string(msgpack_unpacker_t* uk, VALUE str)
+{
+    switch(msgpack_utf8_validate(RSTRING_PTR(str), RSTRING_LEN(str))) {
+    case MSGPACK_UTF8_7BIT:
+        /* let Ruby skip rescanning the string later */
+        ENC_CODERANGE_SET(str, ENC_CODERANGE_7BIT);
+        return object_complete_mutable(uk, str);
+    case MSGPACK_UTF8_VALID:
+        ENC_CODERANGE_SET(str, ENC_CODERANGE_VALID);
+        return object_complete_mutable(uk, str);
+    default:
+        break;
+    }
+
+    switch(uk->validate_utf8) {
+    case MSGPACK_UNPACKER_UTF8_BINARY:
+        ENCODING_SET(str, msgpack_rb_encindex_ascii8bit);
+        return object_complete_mutable(uk, str);
+    case MSGPACK_UNPACKER_UTF8_SCRUB:
+#ifdef HAVE_RB_STR_SCRUB
+        str = rb_str_scrub(str, Qnil);
+#else
+        str = rb_funcall(str, rb_intern("scrub"), 0);
+#endif
+        ENC_CODERANGE_SET(str, ENC_CODERANGE_VALID);
+        return object_complete_mutable(uk, str);
+    default:
+        reset_head_byte(uk);
+        return PRIMITIVE_INVALID_UTF8;
+    }
+}
+#endif
+
 static inline int object_complete_string(msgpack_unpacker_t* uk, VALUE str)
 {
 #ifdef COMPAT_HAVE_ENCODING
     ENCODING_SET(str, msgpack_rb_encindex_utf8);
+    if(uk->validate_utf8 != MSGPACK_UNPACKER_UTF8_NONE) {
+        return object_complete_validated_string(uk, str);
+    }
 #endif
-    return object_complete(uk, str);
+    return object_complete_mutable(uk, str);
 }
 
 static inline int object_complete_binary(msgpack_unpacker_t* uk, VALUE str)
@@ -207,7 +373,7 @@ static inline int object_complete_binary(msgpack_unpacker_t* uk, VALUE str)
     // TODO ruby 2.0 has String#b method
     ENCODING_SET(str, msgpack_rb_encindex_ascii8bit);
 #endif
-    return object_complete(uk, str);
+    return object_complete_mutable(uk, str);
 }
 
 /* stack funcs */
@@ -216,24 +382,62 @@ static inline msgpack_unpacker_stack_t* _msgpack_unpacker_stack_top(msgpack_unpa
     return &uk->stack[uk->stack_depth-1];
 }
 
-static inline int _msgpack_unpacker_stack_push(msgpack_unpacker_t* uk, enum stack_type_t type, size_t count, VALUE object)
+static void _msgpack_unpacker_stack_grow(msgpack_unpacker_t* uk)
+{
+    size_t capacity = uk->stack_capacity * 2;
+    if(uk->stack_capacity == MSGPACK_UNPACKER_STACK_CAPACITY) {
+        msgpack_unpacker_stack_t* stack = ALLOC_N(msgpack_unpacker_stack_t, capacity);
+        memcpy(stack, uk->stack, sizeof(msgpack_unpacker_stack_t) * uk->stack_capacity);
+#ifdef UNPACKER_STACK_RMEM
+        msgpack_rmem_free(&s_stack_rmem, uk->stack);
+#else
+        free(uk->stack);
+#endif
+        uk->stack = stack;
+    } else {
+        REALLOC_N(uk->stack, msgpack_unpacker_stack_t, capacity);
+    }
+    uk->stack_capacity = capacity;
+}
+
+static inline int _msgpack_unpacker_stack_push(msgpack_unpacker_t* uk, enum stack_type_t type, size_t count)
 {
     reset_head_byte(uk);
 
-    if(uk->stack_capacity - uk->stack_depth <= 0) {
+    if(uk->stack_depth >= uk->max_depth) {
         return PRIMITIVE_STACK_TOO_DEEP;
     }
+    if(uk->stack_depth == uk->stack_capacity) {
+        _msgpack_unpacker_stack_grow(uk);
+    }
 
     msgpack_unpacker_stack_t* next = &uk->stack[uk->stack_depth];
     next->count = count;
     next->type = type;
-    next->object = object;
-    next->key = Qnil;
+    next->values = uk->values_size;
 
     uk->stack_depth++;
     return PRIMITIVE_CONTAINER_START;
 }
 
+static inline int read_array_begin(msgpack_unpacker_t* uk, size_t count)
+{
+    if(count > uk->max_array_size) {
+        reset_head_byte(uk);
+        return PRIMITIVE_LIMIT_EXCEEDED;
+    }
+    return _msgpack_unpacker_stack_push(uk, STACK_TYPE_ARRAY, count);
+}
+
+static inline int read_map_begin(msgpack_unpacker_t* uk, size_t count)
+{
+    if(count > uk->max_map_size) {
+        reset_head_byte(uk);
+        return PRIMITIVE_LIMIT_EXCEEDED;
+    }
+    return _msgpack_unpacker_stack_push(uk, STACK_TYPE_MAP_KEY, count*2);
+}
+
 static inline VALUE msgpack_unpacker_stack_pop(msgpack_unpacker_t* uk)
 {
     return --uk->stack_depth;
@@ -244,12 +448,134 @@ static inline bool msgpack_unpacker_stack_is_empty(msgpack_unpacker_t* uk)
     return uk->stack_depth == 0;
 }
 
+static inline void _msgpack_unpacker_values_push(msgpack_unpacker_t* uk, VALUE v)
+{
+    if(uk->values_size == uk->values_capacity) {
+        size_t capacity = uk->values_capacity * 2;
+        if(uk->values == uk->values_embedded) {
+            uk->values = ALLOC_N(VALUE, capacity);
+            memcpy(uk->values, uk->values_embedded, sizeof(uk->values_embedded));
+        } else {
+            REALLOC_N(uk->values, VALUE, capacity);
+        }
+        uk->values_capacity = capacity;
+    }
+    uk->values[uk->values_size++] = v;
+}
+
+static inline VALUE _msgpack_unpacker_new_array(const VALUE* values, size_t size)
+{
+#ifdef HAVE_RB_ARY_NEW_FROM_VALUES
+    return rb_ary_new_from_values(size, values);
+#else
+    return rb_ary_new4(size, values);
+#endif
+}
+
+static inline VALUE _msgpack_unpacker_new_hash(const VALUE* pairs, size_t size)
+{
+#if defined(HAVE_RB_HASH_NEW_CAPA) && defined(HAVE_RB_HASH_BULK_INSERT)
+    /* sized once instead of rehashing as pairs are added */
+    VALUE hash = rb_hash_new_capa(size / 2);
+    rb_hash_bulk_insert(size, pairs, hash);
+    return hash;
+#else
+    VALUE hash = rb_hash_new();
+    size_t i;
+    for(i=0; i < size; i += 2) {
+        rb_hash_aset(hash, pairs[i], pairs[i+1]);
+    }
+    return hash;
+#endif
+}
+
+static inline bool _msgpack_unpacker_shape_key_eq(VALUE key, VALUE name)
+{
+    if(SYMBOL_P(key)) {
+#ifdef HAVE_RB_SYM2STR
+        key = rb_sym2str(key);
+#else
+        key = rb_id2str(SYM2ID(key));
+#endif
+    } else if(rb_type(key) != T_STRING) {
+        return false;
+    }
+    return RSTRING_LEN(key) == RSTRING_LEN(name) &&
+        memcmp(RSTRING_PTR(key), RSTRING_PTR(name), RSTRING_LEN(name)) == 0;
+}
+
+/* builds an object of a registered shape whose keys are the keys of pairs, or returns Qundef */
+static VALUE _msgpack_unpacker_new_shaped_object(msgpack_unpacker_t* uk, const VALUE* pairs, size_t size)
+{
+    long count = (long) (size / 2);
+    long* index = NULL;
+    char* found = NULL;
+    long s;
+    for(s=0; s < RARRAY_LEN(uk->shapes); s++) {
+        VALUE shape = RARRAY_AREF(uk->shapes, s);
+        VALUE names = RARRAY_AREF(shape, 1);
+        if(RARRAY_LEN(names) != count) {
+            continue;
+        }
+
+        /* index of the name of each key; keys usually come in the registered order */
+        if(index == NULL) {
+            index = ALLOCA_N(long, count);
+            found = ALLOCA_N(char, count);
+        }
+        memset(found, 0, count);
+        long i;
+        for(i=0; i < count; i++) {
+            VALUE key = pairs[i*2];
+            long j = i;
+            if(!_msgpack_unpacker_shape_key_eq(key, RARRAY_AREF(names, j))) {
+                for(j=0; j < count; j++) {
+                    if(_msgpack_unpacker_shape_key_eq(key, RARRAY_AREF(names, j))) {
+                        break;
+                    }
+                }
+            }
+            if(j == count || found[j]) {
+                break;
+            }
+            found[j] = 1;
+            index[i] = j;
+        }
+        if(i < count) {
+            continue;
+        }
+
+        VALUE klass = RARRAY_AREF(shape, 0);
+        VALUE targets = RARRAY_AREF(shape, 2);
+        VALUE object;
+        if(RTEST(RARRAY_AREF(shape, 3))) {
+            object = rb_struct_alloc_noinit(klass);
+            for(i=0; i < count; i++) {
+                rb_struct_aset(object, RARRAY_AREF(targets, index[i]), pairs[i*2+1]);
+            }
+        } else {
+            object = rb_obj_alloc(klass);
+            for(i=0; i < count; i++) {
+                rb_ivar_set(object, SYM2ID(RARRAY_AREF(targets, index[i])), pairs[i*2+1]);
+            }
+        }
+        return object;
+    }
+    return Qundef;
+}
+
+/* case ranges are a GNU extension. switch on the head byte is compiled into a jump table
+ * instead of the chain of comparisons below. */
+#if !defined(USE_CASE_RANGE) && !defined(DISABLE_CASE_RANGE) && defined(__GNUC__)
+#define USE_CASE_RANGE
+#endif
+
 #ifdef USE_CASE_RANGE
 
-#define SWITCH_RANGE_BEGIN(BYTE)     { switch(BYTE) {
+#define SWITCH_RANGE_BEGIN(BYTE)     { switch(BYTE) { {
 #define SWITCH_RANGE(BYTE, FROM, TO) } case FROM ... TO: {
 #define SWITCH_RANGE_DEFAULT         } default: {
-#define SWITCH_RANGE_END             } }
+#define SWITCH_RANGE_END             } } }
 
 #else
 
@@ -262,8 +588,9 @@ static inline bool msgpack_unpacker_stack_is_empty(msgpack_unpacker_t* uk)
 
 
 #define READ_CAST_BLOCK_OR_RETURN_EOF(cb, uk, n) \
-    union msgpack_buffer_cast_block_t* cb = msgpack_buffer_read_cast_block(UNPACKER_BUFFER_(uk), n); \
-    if(cb == NULL) { \
+    union msgpack_buffer_cast_block_t cb##_block; \
+    union msgpack_buffer_cast_block_t* cb = &cb##_block; \
+    if(!msgpack_buffer_read_cast_block_to(UNPACKER_BUFFER_(uk), cb, n)) { \
         return PRIMITIVE_EOF; \
     }
 
@@ -296,40 +623,148 @@ static int read_raw_body_cont(msgpack_unpacker_t* uk)
         uk->reading_raw_remaining = length = length - n;
     } while(length > 0);
 
-    object_complete_string(uk, uk->reading_raw);
+    int r = object_complete_string(uk, uk->reading_raw);
     uk->reading_raw = Qnil;
-    return PRIMITIVE_OBJECT_COMPLETE;
+    return r;
+}
+
+static inline uint32_t _key_cache_hash(const char* p, size_t length)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261U;
+    const unsigned char* b = (const unsigned char*) p;
+    const unsigned char* bend = b + length;
+    for(; b < bend; b++) {
+        h = (h ^ *b) * 16777619U;
+    }
+    return h;
+}
+
+/*
+ * Returns the existing Symbol of 7-bit key bytes without allocating a String,
+ * or Qnil if it doesn't exist yet.
+ */
+static inline VALUE lookup_symbol_key(const char* p, size_t length)
+{
+#if defined(HAVE_RB_CHECK_SYMBOL_CSTR) && defined(HAVE_RB_SYM2STR)
+    if(msgpack_utf8_ascii_prefix((const unsigned char*) p, length) == length) {
+        return rb_check_symbol_cstr(p, length, rb_usascii_encoding());
+    }
+#endif
+    return Qnil;
+}
+
+static int complete_cached_map_key(msgpack_unpacker_t* uk, bool str, const char* p, size_t length)
+{
+    uint32_t hash = _key_cache_hash(p, length);
+    msgpack_unpacker_key_cache_entry_t* e = &uk->key_cache[hash & (MSGPACK_UNPACKER_KEY_CACHE_SIZE - 1)];
+
+    if(e->string != Qfalse && e->hash == hash && e->binary == !str &&
+            SYMBOL_P(e->key) == uk->symbolize_keys &&
+            (size_t) RSTRING_LEN(e->string) == length &&
+            memcmp(RSTRING_PTR(e->string), p, length) == 0) {
+        return object_complete(uk, e->key);
+    }
+
+    if(uk->symbolize_keys) {
+        VALUE sym = lookup_symbol_key(p, length);
+        if(sym != Qnil) {
+            e->string = rb_sym2str(sym);
+            e->key = sym;
+            e->hash = hash;
+            e->binary = !str;
+            return object_complete(uk, sym);
+        }
+    }
+
+    VALUE string = rb_str_new(p, length);
+
+    int r;
+    if(str) {
+        r = object_complete_string(uk, string);
+    } else {
+        r = object_complete_binary(uk, string);
+    }
+    if(r == PRIMITIVE_OBJECT_COMPLETE) {
+        VALUE key = rb_obj_freeze(uk->last_object);
+        /* strings replaced by validate_utf8: :scrub don't match the bytes */
+        bool cacheable = key == string;
+        if(uk->symbolize_keys) {
+            key = msgpack_unpacker_symbolize_key(key);
+            uk->last_object = key;
+        }
+        if(cacheable) {
+            e->string = string;
+            e->key = key;
+            e->hash = hash;
+            e->binary = !str;
+        }
+    }
+    return r;
+}
+
+static int read_cached_map_key(msgpack_unpacker_t* uk, bool str, size_t length)
+{
+    msgpack_buffer_t* b = UNPACKER_BUFFER_(uk);
+    int r = complete_cached_map_key(uk, str, msgpack_buffer_top_readable_pointer(b), length);
+    _msgpack_buffer_consumed(b, length);
+    uk->reading_raw_remaining = 0;
+    return r;
 }
 
 static inline int read_raw_body_begin(msgpack_unpacker_t* uk, bool str)
 {
     /* assuming uk->reading_raw == Qnil */
 
-    /* try optimized read */
     size_t length = uk->reading_raw_remaining;
+    if(length > uk->max_str_size) {
+        reset_head_byte(uk);
+        uk->reading_raw_remaining = 0;
+        return PRIMITIVE_LIMIT_EXCEEDED;
+    }
+
+    /* try optimized read */
     if(length <= msgpack_buffer_top_readable_size(UNPACKER_BUFFER_(uk))) {
         /* don't use zerocopy for hash keys but get a frozen string directly
          * because rb_hash_aset freezes keys and it causes copying */
         bool will_freeze = is_reading_map_key(uk);
+        if(will_freeze && uk->key_cache != NULL && length <= MSGPACK_UNPACKER_KEY_CACHE_MAX_LENGTH) {
+            return read_cached_map_key(uk, str, length);
+        }
+        if(will_freeze && uk->symbolize_keys) {
+            VALUE sym = lookup_symbol_key(msgpack_buffer_top_readable_pointer(UNPACKER_BUFFER_(uk)), length);
+            if(sym != Qnil) {
+                _msgpack_buffer_consumed(UNPACKER_BUFFER_(uk), length);
+                uk->reading_raw_remaining = 0;
+                return object_complete(uk, sym);
+            }
+        }
         VALUE string = msgpack_buffer_read_top_as_string(UNPACKER_BUFFER_(uk), length, will_freeze);
+        int r;
         if(str == true) {
-            object_complete_string(uk, string);
+            r = object_complete_string(uk, string);
         } else {
-            object_complete_binary(uk, string);
+            r = object_complete_binary(uk, string);
         }
-        if(will_freeze) {
-            rb_obj_freeze(string);
+        if(will_freeze && r == PRIMITIVE_OBJECT_COMPLETE) {
+            /* object_complete_string may replace the string (validate_utf8: :scrub) */
+            rb_obj_freeze(uk->last_object);
         }
         uk->reading_raw_remaining = 0;
-        return PRIMITIVE_OBJECT_COMPLETE;
+        return r;
     }
 
     return read_raw_body_cont(uk);
 }
 
+static inline int read_extended_type_cont(msgpack_unpacker_t* uk, int8_t extended_type);
+
 static int read_primitive(msgpack_unpacker_t* uk)
 {
     if(uk->reading_raw_remaining > 0) {
+        if(uk->reading_raw_extended) {
+            return read_extended_type_cont(uk, uk->reading_raw_extended_type);
+        }
         return read_raw_body_cont(uk);
     }
 
@@ -357,16 +792,16 @@ static int read_primitive(msgpack_unpacker_t* uk)
     SWITCH_RANGE(b, 0x90, 0x9f)  // FixArray
         int count = b & 0x0f;
         if(count == 0) {
-            return object_complete(uk, rb_ary_new());
+            return object_complete_mutable(uk, rb_ary_new());
         }
-        return _msgpack_unpacker_stack_push(uk, STACK_TYPE_ARRAY, count, rb_ary_new2(count));
+        return read_array_begin(uk, count);
 
     SWITCH_RANGE(b, 0x80, 0x8f)  // FixMap
         int count = b & 0x0f;
         if(count == 0) {
-            return object_complete(uk, rb_hash_new());
+            return object_complete_mutable(uk, rb_hash_new());
         }
-        return _msgpack_unpacker_stack_push(uk, STACK_TYPE_MAP_KEY, count*2, rb_hash_new());
+        return read_map_begin(uk, count);
 
     SWITCH_RANGE(b, 0xc0, 0xdf)  // Variable
         switch(b) {
@@ -381,28 +816,29 @@ static int read_primitive(msgpack_unpacker_t* uk)
         case 0xc3:  // true
             return object_complete(uk, Qtrue);
 
+        /* the size and the type are read at once to resume at the head byte on EOF */
         case 0xc7: // ext 8
             {
-                READ_CAST_BLOCK_OR_RETURN_EOF(cb, uk, 1);
+                READ_CAST_BLOCK_OR_RETURN_EOF(cb, uk, 2);
                 uint8_t count = cb->u8;
                 uk->reading_raw_remaining = count;
-                return msgpack_read_extended_type_begin( uk);
+                return msgpack_read_extended_type_begin(uk, (int8_t) cb->buffer[1]);
             }
 
         case 0xc8: // ext 16
             {
-                READ_CAST_BLOCK_OR_RETURN_EOF(cb, uk, 2);
+                READ_CAST_BLOCK_OR_RETURN_EOF(cb, uk, 3);
                 uint16_t count = _msgpack_be16(cb->u16);
                 uk->reading_raw_remaining = count;
-                return msgpack_read_extended_type_begin( uk);
+                return msgpack_read_extended_type_begin(uk, (int8_t) cb->buffer[2]);
             }
 
         case 0xc9: // ext 32
             {
-                READ_CAST_BLOCK_OR_RETURN_EOF(cb, uk, 4);
+                READ_CAST_BLOCK_OR_RETURN_EOF(cb, uk, 5);
                 uint32_t count = _msgpack_be32(cb->u32);
                 uk->reading_raw_remaining = count;
-                return msgpack_read_extended_type_begin( uk);
+                return msgpack_read_extended_type_begin(uk, (int8_t) cb->buffer[4]);
             }
 
         case 0xca:  // float
@@ -481,8 +917,9 @@ static int read_primitive(msgpack_unpacker_t* uk)
         case 0xd7:  // fixext 8
         case 0xd8:  // fixext 16
             {
+                READ_CAST_BLOCK_OR_RETURN_EOF(cb, uk, 1);
                 uk->reading_raw_remaining = 1UL << (b - 0xd4);
-                return msgpack_read_extended_type_begin( uk);
+                return msgpack_read_extended_type_begin(uk, cb->i8);
             }
 
         case 0xd9:  // raw 8 / str 8
@@ -562,9 +999,9 @@ static int read_primitive(msgpack_unpacker_t* uk)
                 READ_CAST_BLOCK_OR_RETURN_EOF(cb, uk, 2);
                 uint16_t count = _msgpack_be16(cb->u16);
                 if(count == 0) {
-                    return object_complete(uk, rb_ary_new());
+                    return object_complete_mutable(uk, rb_ary_new());
                 }
-                return _msgpack_unpacker_stack_push(uk, STACK_TYPE_ARRAY, count, rb_ary_new2(count));
+                return read_array_begin(uk, count);
             }
 
         case 0xdd:  // array 32
@@ -572,9 +1009,9 @@ static int read_primitive(msgpack_unpacker_t* uk)
                 READ_CAST_BLOCK_OR_RETURN_EOF(cb, uk, 4);
                 uint32_t count = _msgpack_be32(cb->u32);
                 if(count == 0) {
-                    return object_complete(uk, rb_ary_new());
+                    return object_complete_mutable(uk, rb_ary_new());
                 }
-                return _msgpack_unpacker_stack_push(uk, STACK_TYPE_ARRAY, count, rb_ary_new2(count));
+                return read_array_begin(uk, count);
             }
 
         case 0xde:  // map 16
@@ -582,9 +1019,9 @@ static int read_primitive(msgpack_unpacker_t* uk)
                 READ_CAST_BLOCK_OR_RETURN_EOF(cb, uk, 2);
                 uint16_t count = _msgpack_be16(cb->u16);
                 if(count == 0) {
-                    return object_complete(uk, rb_hash_new());
+                    return object_complete_mutable(uk, rb_hash_new());
                 }
-                return _msgpack_unpacker_stack_push(uk, STACK_TYPE_MAP_KEY, count*2, rb_hash_new());
+                return read_map_begin(uk, count);
             }
 
         case 0xdf:  // map 32
@@ -592,9 +1029,9 @@ static int read_primitive(msgpack_unpacker_t* uk)
                 READ_CAST_BLOCK_OR_RETURN_EOF(cb, uk, 4);
                 uint32_t count = _msgpack_be32(cb->u32);
                 if(count == 0) {
-                    return object_complete(uk, rb_hash_new());
+                    return object_complete_mutable(uk, rb_hash_new());
                 }
-                return _msgpack_unpacker_stack_push(uk, STACK_TYPE_MAP_KEY, count*2, rb_hash_new());
+                return read_map_begin(uk, count);
             }
 
         default:
@@ -632,6 +1069,9 @@ int msgpack_unpacker_read_array_header(msgpack_unpacker_t* uk, uint32_t* result_
     }
 
     reset_head_byte(uk);
+    if(*result_size > uk->max_array_size) {
+        return PRIMITIVE_LIMIT_EXCEEDED;
+    }
     return 0;
 }
 
@@ -660,42 +1100,182 @@ int msgpack_unpacker_read_map_header(msgpack_unpacker_t* uk, uint32_t* result_si
     }
 
     reset_head_byte(uk);
+    if(*result_size > uk->max_map_size) {
+        return PRIMITIVE_LIMIT_EXCEEDED;
+    }
     return 0;
 }
 
-static inline int object_complete_extended_type(msgpack_unpacker_t* uk, int8_t typenr, VALUE data)
+#if defined(HAVE_RB_INTEGER_PACK) && defined(HAVE_RB_INTEGER_UNPACK)
+#define UNPACKER_BIGNUM_EXTTYPE
+#endif
+
+#ifdef UNPACKER_BIGNUM_EXTTYPE
+static inline int object_complete_bignum(msgpack_unpacker_t* uk, const char* data, size_t length)
 {
-    /* reset unpacker struct */
+    /* payload is a sign byte (0: positive, 1: negative) and big-endian magnitude */
+    if(length == 0 || (unsigned char) data[0] > 1) {
+        return PRIMITIVE_INVALID_BYTE;
+    }
+    int flags = INTEGER_PACK_BIG_ENDIAN;
+    if(data[0] == 1) {
+        flags |= INTEGER_PACK_NEGATIVE;
+    }
+    uk->last_object = rb_integer_unpack(data + 1, length - 1, 1, 0, flags);
+
     uk->head_byte = HEAD_BYTE_REQUIRED;
     uk->reading_raw_remaining = 0;
-    uk->reading_raw = Qnil;  // previous value, if any, has been passed here as 3rd argument (data)
+    uk->reading_raw = Qnil;
+
+    return PRIMITIVE_OBJECT_COMPLETE;
+}
+#endif
+
+static msgpack_unpacker_exttype_entry_t* _msgpack_unpacker_lookup_extended_type(msgpack_unpacker_t* uk, int8_t typenr)
+{
+    if(uk->exttype_table == NULL) {
+        uk->exttype_table = ALLOC_N(msgpack_unpacker_exttype_entry_t, MSGPACK_UNPACKER_EXTTYPE_TABLE_SIZE);
+        uk->exttype_table_serial = msgpack_unpacker_extended_types_serial - 1;
+    }
+    if(uk->exttype_table_serial != msgpack_unpacker_extended_types_serial) {
+        int i;
+        for(i=0; i < MSGPACK_UNPACKER_EXTTYPE_TABLE_SIZE; i++) {
+            uk->exttype_table[i].target = Qundef;
+        }
+        uk->exttype_table_serial = msgpack_unpacker_extended_types_serial;
+    }
+
+    msgpack_unpacker_exttype_entry_t* e = &uk->exttype_table[(uint8_t) typenr];
+    if(e->target != Qundef) {
+        return e;
+    }
 
-    /* find the unpacking target */
     VALUE target = msgpack_unpacker_resolve_extended_type(uk, typenr);
-    ID method = s_from_exttype;
 
-    /* how to construct the unpacked object? */
+    /* payload option of the registration which target comes from */
+    VALUE nr = INT2FIX(typenr);
+    VALUE payload = Qnil;
+    if(RTEST(uk->extended_types) && rb_hash_lookup2(uk->extended_types, nr, Qundef) != Qundef) {
+        if(uk->extended_type_payloads != Qnil) {
+            payload = rb_hash_lookup(uk->extended_type_payloads, nr);
+        }
+    } else if(msgpack_unpacker_get_default_extended_type(uk) == Qnil &&
+            msgpack_unpacker_class_extended_type_payloads != Qnil) {
+        payload = rb_hash_lookup(msgpack_unpacker_class_extended_type_payloads, nr);
+    }
+    e->payload = payload == Qnil ? MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_STRING : FIX2INT(payload);
+
     switch(rb_type(target)) {
     case T_FALSE:  // explicit rejection of the exttype
     case T_NIL:    // both the instance and the class defaulted, no target exists
-        return PRIMITIVE_UNKNOWN_EXTTYPE;
+        e->kind = MSGPACK_UNPACKER_EXTTYPE_UNKNOWN;
+        break;
     case T_OBJECT:  // the object must be callable or it would have been rejected on setting
     case T_DATA:
-        method = s_call;
+        /* singleton classes or subclasses may override #call */
+        if(CLASS_OF(target) == rb_cProc) {
+            e->kind = MSGPACK_UNPACKER_EXTTYPE_PROC;
+        } else if(CLASS_OF(target) == rb_cMethod) {
+            e->kind = MSGPACK_UNPACKER_EXTTYPE_METHOD;
+        } else {
+            e->kind = MSGPACK_UNPACKER_EXTTYPE_CALLABLE;
+        }
         break;
     case T_CLASS:  // the class must respond to 'from_exttype' or it would have been rejected on setting
-        // no-op, s_from_exttype is the method we want
+        e->kind = MSGPACK_UNPACKER_EXTTYPE_CLASS;
         break;
     default:  // we cannot be here, except by a mistake in the lib which permitted setting an invalid target
+        e->kind = MSGPACK_UNPACKER_EXTTYPE_INVALID;
+    }
+    e->target = target;
+    return e;
+}
+
+static inline int _msgpack_unpacker_extended_type_payload(msgpack_unpacker_t* uk, int8_t typenr)
+{
+    if(uk->reading_events) {
+        return MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_STRING;
+    }
+#ifdef UNPACKER_BIGNUM_EXTTYPE
+    if(uk->bignum_exttype_enabled && typenr == uk->bignum_exttype) {
+        return MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_STRING;
+    }
+#endif
+    return _msgpack_unpacker_lookup_extended_type(uk, typenr)->payload;
+}
+
+static inline void _msgpack_unpacker_append_payload(msgpack_buffer_t* b, msgpack_buffer_t* pb, size_t length)
+{
+    /* moves length bytes from the top chunk of b to pb, sharing memory where possible */
+    if(b->head->mapped_string != NO_MAPPED_STRING) {
+        msgpack_buffer_append_string_reference(pb, _msgpack_buffer_refer_head_mapped_string(b, length));
+    } else {
+        msgpack_buffer_append(pb, b->read_buffer, length);
+    }
+    _msgpack_buffer_consumed(b, length);
+}
+
+static inline VALUE _msgpack_unpacker_new_payload_buffer(void)
+{
+    return rb_obj_alloc(cMessagePack_Buffer);
+}
+
+static inline int object_complete_extended_type(msgpack_unpacker_t* uk, int8_t typenr, VALUE data)
+{
+#ifdef UNPACKER_BIGNUM_EXTTYPE
+    if(uk->bignum_exttype_enabled && typenr == uk->bignum_exttype) {
+        return object_complete_bignum(uk, RSTRING_PTR(data), RSTRING_LEN(data));
+    }
+#endif
+
+    /* reset unpacker struct */
+    uk->head_byte = HEAD_BYTE_REQUIRED;
+    uk->reading_raw_remaining = 0;
+    uk->reading_raw = Qnil;  // previous value, if any, has been passed here as 3rd argument (data)
+
+    if(uk->reading_events) {
+#ifdef COMPAT_HAVE_ENCODING
+        ENCODING_SET(data, msgpack_rb_encindex_ascii8bit);
+#endif
+        uk->last_extended_type = typenr;
+        object_complete_mutable(uk, data);
+        return PRIMITIVE_OBJECT_EXTENDED_TYPE;
+    }
+
+    /* find the unpacking target */
+    msgpack_unpacker_exttype_entry_t* e = _msgpack_unpacker_lookup_extended_type(uk, typenr);
+    if(e->kind == MSGPACK_UNPACKER_EXTTYPE_UNKNOWN) {
+        return PRIMITIVE_UNKNOWN_EXTTYPE;
+    } else if(e->kind == MSGPACK_UNPACKER_EXTTYPE_INVALID) {
         rb_raise(rb_eTypeError, "invalid exttype unpack target");
     }
+    VALUE target = e->target;
 
     /* let the unpacking target construct the unpacked object from raw data */
+    if(RB_TYPE_P(data, T_STRING)) {
 #ifdef COMPAT_HAVE_ENCODING
-    ENCODING_SET(data, msgpack_rb_encindex_ascii8bit);
+        ENCODING_SET(data, msgpack_rb_encindex_ascii8bit);
 #endif
+        /* shared payloads refer to the buffer's memory and must not be modified */
+        if(e->payload == MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_SHARED) {
+            rb_obj_freeze(data);
+        }
+    }
     VALUE argv[2] = {INT2FIX(typenr), data};
-    uk->last_object = rb_funcall2(target, method, 2, argv);
+    switch(e->kind) {
+    case MSGPACK_UNPACKER_EXTTYPE_PROC:
+        uk->last_object = rb_proc_call_with_block(target, 2, argv, Qnil);
+        break;
+    case MSGPACK_UNPACKER_EXTTYPE_METHOD:
+        uk->last_object = rb_method_call(2, argv, target);
+        break;
+    case MSGPACK_UNPACKER_EXTTYPE_CLASS:
+        uk->last_object = rb_funcall2(target, s_from_exttype, 2, argv);
+        break;
+    default:
+        uk->last_object = rb_funcall2(target, s_call, 2, argv);
+    }
+    /* results are owned by the target, so :freeze leaves them as they are */
 
     return PRIMITIVE_OBJECT_COMPLETE;
 }
@@ -705,7 +1285,35 @@ static inline int read_extended_type_cont(msgpack_unpacker_t* uk, int8_t extende
     size_t length = uk->reading_raw_remaining;
 
     if(uk->reading_raw == Qnil) {
-        uk->reading_raw = rb_str_buf_new(length);
+        if(_msgpack_unpacker_extended_type_payload(uk, extended_type) == MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_BUFFER) {
+            uk->reading_raw = _msgpack_unpacker_new_payload_buffer();
+        } else {
+            uk->reading_raw = rb_str_buf_new(length);
+        }
+    }
+
+    if(!RB_TYPE_P(uk->reading_raw, T_STRING)) {
+        /* collect the payload into a Buffer chunk by chunk without joining them */
+        msgpack_buffer_t* b = UNPACKER_BUFFER_(uk);
+        msgpack_buffer_t* pb;
+        Data_Get_Struct(uk->reading_raw, msgpack_buffer_t, pb);
+        while(length > 0) {
+            size_t n = msgpack_buffer_top_readable_size(b);
+            if(n == 0) {
+                if(b->io == Qnil) {
+                    return PRIMITIVE_EOF;
+                }
+                _msgpack_buffer_feed_from_io(b);
+                continue;
+            }
+            if(n > length) {
+                n = length;
+            }
+            _msgpack_unpacker_append_payload(b, pb, n);
+            uk->reading_raw_remaining = length = length - n;
+        }
+        uk->reading_raw_extended = false;
+        return object_complete_extended_type(uk, extended_type, uk->reading_raw);
     }
 
     do {
@@ -716,31 +1324,88 @@ static inline int read_extended_type_cont(msgpack_unpacker_t* uk, int8_t extende
         uk->reading_raw_remaining = length = length - n;
     } while(length > 0);
 
+    uk->reading_raw_extended = false;
     return object_complete_extended_type(uk, extended_type, uk->reading_raw);
 }
 
-int msgpack_read_extended_type_begin(msgpack_unpacker_t* uk)
+int msgpack_read_extended_type_begin(msgpack_unpacker_t* uk, int8_t extended_type)
 {
-    int8_t extended_type;
-    union msgpack_buffer_cast_block_t* cb = msgpack_buffer_read_cast_block(UNPACKER_BUFFER_(uk), 1);
-    if(cb == NULL) {
-        return PRIMITIVE_EOF;
-    } else {
-      extended_type = cb->i8;
+    if(uk->reading_raw_remaining > uk->max_ext_size) {
+        reset_head_byte(uk);
+        uk->reading_raw_remaining = 0;
+        return PRIMITIVE_LIMIT_EXCEEDED;
     }
 
     size_t length = uk->reading_raw_remaining;
 
     if(length <= msgpack_buffer_top_readable_size(UNPACKER_BUFFER_(uk))) {
-        VALUE data = msgpack_buffer_read_top_as_string(UNPACKER_BUFFER_(uk), length, false);
+#ifdef UNPACKER_BIGNUM_EXTTYPE
+        if(uk->bignum_exttype_enabled && extended_type == uk->bignum_exttype) {
+            /* decode directly from the buffer */
+            int r = object_complete_bignum(uk,
+                    msgpack_buffer_top_readable_pointer(UNPACKER_BUFFER_(uk)), length);
+            if(r == PRIMITIVE_OBJECT_COMPLETE) {
+                msgpack_buffer_skip_nonblock(UNPACKER_BUFFER_(uk), length);
+            }
+            return r;
+        }
+#endif
+        msgpack_buffer_t* b = UNPACKER_BUFFER_(uk);
+        VALUE data;
+        switch(_msgpack_unpacker_extended_type_payload(uk, extended_type)) {
+        case MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_SHARED:
+            /* refer to the buffer regardless of read_reference_threshold */
+            if(b->head->mapped_string != NO_MAPPED_STRING) {
+                data = _msgpack_buffer_refer_head_mapped_string(b, length);
+                _msgpack_buffer_consumed(b, length);
+            } else {
+                data = msgpack_buffer_read_top_as_string(b, length, false);
+            }
+            break;
+        case MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_BUFFER:
+            data = _msgpack_unpacker_new_payload_buffer();
+            if(length > 0) {
+                msgpack_buffer_t* pb;
+                Data_Get_Struct(data, msgpack_buffer_t, pb);
+                _msgpack_unpacker_append_payload(b, pb, length);
+            }
+            break;
+        default:
+            data = msgpack_buffer_read_top_as_string(b, length, false);
+        }
         return object_complete_extended_type(uk, extended_type, data);
     }
 
+    uk->reading_raw_extended = true;
+    uk->reading_raw_extended_type = extended_type;
     return read_extended_type_cont(uk, extended_type);
 }
 
+static inline int _msgpack_unpacker_begin_reader(msgpack_unpacker_t* uk, bool events)
+{
+    if(uk->stack_depth > 0 && uk->stack_of_events != events) {
+        return PRIMITIVE_READER_SWITCHED;
+    }
+    uk->stack_of_events = events;
+    return PRIMITIVE_OBJECT_COMPLETE;
+}
+
 int msgpack_unpacker_read(msgpack_unpacker_t* uk, size_t target_stack_depth)
 {
+    /* msgpack_unpacker_read_event leaves the flag set if an exception is raised */
+    uk->reading_events = false;
+
+    if(uk->skipping) {
+        /* finish skipping first because entries on the stack don't have objects */
+        int r = msgpack_unpacker_skip(uk, target_stack_depth);
+        if(r < 0) {
+            return r;
+        }
+    }
+    if(_msgpack_unpacker_begin_reader(uk, false) < 0) {
+        return PRIMITIVE_READER_SWITCHED;
+    }
+
     while(true) {
         int r = read_primitive(uk);
         if(r < 0) {
@@ -751,7 +1416,7 @@ int msgpack_unpacker_read(msgpack_unpacker_t* uk, size_t target_stack_depth)
         }
         /* PRIMITIVE_OBJECT_COMPLETE */
 
-        if(msgpack_unpacker_stack_is_empty(uk)) {
+        if(uk->stack_depth <= target_stack_depth) {
             return PRIMITIVE_OBJECT_COMPLETE;
         }
 
@@ -760,36 +1425,40 @@ int msgpack_unpacker_read(msgpack_unpacker_t* uk, size_t target_stack_depth)
             msgpack_unpacker_stack_t* top = _msgpack_unpacker_stack_top(uk);
             switch(top->type) {
             case STACK_TYPE_ARRAY:
-                rb_ary_push(top->object, uk->last_object);
+                _msgpack_unpacker_values_push(uk, uk->last_object);
                 break;
             case STACK_TYPE_MAP_KEY:
-                top->key = uk->last_object;
+                if(uk->symbolize_keys && rb_type(uk->last_object) == T_STRING) {
+                    _msgpack_unpacker_values_push(uk, msgpack_unpacker_symbolize_key(uk->last_object));
+                } else {
+                    _msgpack_unpacker_values_push(uk, uk->last_object);
+                }
                 top->type = STACK_TYPE_MAP_VALUE;
                 break;
             case STACK_TYPE_MAP_VALUE:
-                if(uk->symbolize_keys && rb_type(top->key) == T_STRING) {
-                    /* here uses rb_intern_str instead of rb_intern so that Ruby VM can GC unused symbols */
-#ifdef HAVE_RB_STR_INTERN
-                    /* rb_str_intern is added since MRI 2.2.0 */
-                    rb_hash_aset(top->object, rb_str_intern(top->key), uk->last_object);
-#else
-#ifndef HAVE_RB_INTERN_STR
-                    /* MRI 1.8 doesn't have rb_intern_str or rb_intern2 */
-                    rb_hash_aset(top->object, ID2SYM(rb_intern(RSTRING_PTR(top->key))), uk->last_object);
-#else
-                    rb_hash_aset(top->object, ID2SYM(rb_intern_str(top->key)), uk->last_object);
-#endif
-#endif
-                } else {
-                    rb_hash_aset(top->object, top->key, uk->last_object);
-                }
+                _msgpack_unpacker_values_push(uk, uk->last_object);
                 top->type = STACK_TYPE_MAP_KEY;
                 break;
             }
             size_t count = --top->count;
 
             if(count == 0) {
-                object_complete(uk, top->object);
+                const VALUE* values = uk->values + top->values;
+                size_t size = uk->values_size - top->values;
+                VALUE object;
+                if(top->type == STACK_TYPE_ARRAY) {
+                    object = _msgpack_unpacker_new_array(values, size);
+                } else {
+                    object = Qundef;
+                    if(uk->shapes != Qnil) {
+                        object = _msgpack_unpacker_new_shaped_object(uk, values, size);
+                    }
+                    if(object == Qundef) {
+                        object = _msgpack_unpacker_new_hash(values, size);
+                    }
+                }
+                uk->values_size = top->values;
+                object_complete_mutable(uk, object);
                 if(msgpack_unpacker_stack_pop(uk) <= target_stack_depth) {
                     return PRIMITIVE_OBJECT_COMPLETE;
                 }
@@ -799,39 +1468,115 @@ int msgpack_unpacker_read(msgpack_unpacker_t* uk, size_t target_stack_depth)
     }
 }
 
-int msgpack_unpacker_skip(msgpack_unpacker_t* uk, size_t target_stack_depth)
+static int skip_header(msgpack_unpacker_t* uk, msgpack_scan_header_t* h)
 {
-    while(true) {
-        int r = read_primitive(uk);
-        if(r < 0) {
-            return r;
+    msgpack_buffer_t* b = UNPACKER_BUFFER_(uk);
+
+    int head = uk->head_byte;
+    if(head == HEAD_BYTE_REQUIRED) {
+        /* fast path: the header is in the top chunk */
+        size_t avail = msgpack_buffer_top_readable_size(b);
+        if(avail > 0) {
+            int r = msgpack_scan_header(msgpack_buffer_top_readable_pointer(b), avail, h);
+            if(r == PRIMITIVE_OBJECT_COMPLETE) {
+                _msgpack_buffer_consumed(b, h->header_size);
+                return r;
+            } else if(r != PRIMITIVE_EOF) {
+                return r;
+            }
         }
-        if(r == PRIMITIVE_CONTAINER_START) {
-            continue;
+        head = read_head_byte(uk);
+        if(head < 0) {
+            return head;
         }
-        /* PRIMITIVE_OBJECT_COMPLETE */
+    }
 
-        if(msgpack_unpacker_stack_is_empty(uk)) {
-            return PRIMITIVE_OBJECT_COMPLETE;
-        }
+    char header[9];
+    size_t size = msgpack_scan_header_size((unsigned char) head);
+    if(size == 0) {
+        return PRIMITIVE_INVALID_BYTE;
+    }
+    header[0] = (char) head;
+    if(size > 1 && !msgpack_buffer_read_all(b, header + 1, size - 1)) {
+        /* head_byte is kept to continue */
+        return PRIMITIVE_EOF;
+    }
+    reset_head_byte(uk);
 
-        container_completed:
-        {
-            msgpack_unpacker_stack_t* top = _msgpack_unpacker_stack_top(uk);
+    return msgpack_scan_header(header, size, h);
+}
 
-            /* this section optimized out */
-            // TODO object_complete still creates objects which should be optimized out
+int msgpack_unpacker_skip(msgpack_unpacker_t* uk, size_t target_stack_depth)
+{
+    msgpack_buffer_t* b = UNPACKER_BUFFER_(uk);
 
-            size_t count = --top->count;
+    if(uk->reading_raw_remaining > 0) {
+        /* msgpack_unpacker_read stopped in the middle of a raw */
+        reset_head_byte(uk);
+        uk->skipping_raw_remaining = uk->reading_raw_remaining;
+        uk->reading_raw_remaining = 0;
+        uk->reading_raw = Qnil;
+        uk->reading_raw_extended = false;
+    }
+    uk->skipping = true;
 
-            if(count == 0) {
-                object_complete(uk, Qnil);
-                if(msgpack_unpacker_stack_pop(uk) <= target_stack_depth) {
-                    return PRIMITIVE_OBJECT_COMPLETE;
+    while(true) {
+        if(uk->skipping_raw_remaining > 0) {
+            do {
+                size_t n = msgpack_buffer_skip(b, uk->skipping_raw_remaining);
+                if(n == 0) {
+                    return PRIMITIVE_EOF;
+                }
+                uk->skipping_raw_remaining -= n;
+            } while(uk->skipping_raw_remaining > 0);
+
+        } else {
+            msgpack_scan_header_t h;
+            int r = skip_header(uk, &h);
+            if(r < 0) {
+                return r;
+            }
+
+            if(h.count > 0) {
+                switch(h.type) {
+                case TYPE_ARRAY:
+                    r = _msgpack_unpacker_stack_push(uk, STACK_TYPE_ARRAY, h.count);
+                    if(r < 0) {
+                        return r;
+                    }
+                    continue;
+                case TYPE_MAP:
+                    r = _msgpack_unpacker_stack_push(uk, STACK_TYPE_MAP_KEY, h.count*2);
+                    if(r < 0) {
+                        return r;
+                    }
+                    continue;
+                case TYPE_STRING:
+                case TYPE_BINARY:
+                case TYPE_EXT:
+                    uk->skipping_raw_remaining = h.count;
+                    continue;
+                default:
+                    break;
                 }
-                goto container_completed;
             }
         }
+        /* an object is skipped */
+
+        while(true) {
+            if(uk->stack_depth <= target_stack_depth) {
+                uk->skipping = false;
+                uk->last_object = Qnil;
+                return PRIMITIVE_OBJECT_COMPLETE;
+            }
+            msgpack_unpacker_stack_t* top = _msgpack_unpacker_stack_top(uk);
+            if(--top->count > 0) {
+                break;
+            }
+            /* drops children collected by msgpack_unpacker_read which stopped in the container */
+            uk->values_size = top->values;
+            msgpack_unpacker_stack_pop(uk);
+        }
     }
 }
 
@@ -858,9 +1603,6 @@ int msgpack_unpacker_peek_next_object_type(msgpack_unpacker_t* uk)
     SWITCH_RANGE(b, 0x80, 0x8f)  // FixMap
         return TYPE_MAP;
 
-    SWITCH_RANGE(b, 0xd4, 0xd8)  // FixExt
-        return TYPE_EXT;
-
     SWITCH_RANGE(b, 0xc0, 0xdf)  // Variable
         switch(b) {
         case 0xc0:  // nil
@@ -907,6 +1649,11 @@ int msgpack_unpacker_peek_next_object_type(msgpack_unpacker_t* uk)
         case 0xc7:  // ext 8
         case 0xc8:  // ext 16
         case 0xc9:  // ext 32
+        case 0xd4:  // fixext 1
+        case 0xd5:  // fixext 2
+        case 0xd6:  // fixext 4
+        case 0xd7:  // fixext 8
+        case 0xd8:  // fixext 16
             return TYPE_EXT;
 
         default:
@@ -919,6 +1666,255 @@ int msgpack_unpacker_peek_next_object_type(msgpack_unpacker_t* uk)
     SWITCH_RANGE_END
 }
 
+static VALUE read_columns_column(msgpack_unpacker_t* uk, VALUE key)
+{
+    /* maps in an array usually have the same keys in the same order */
+    size_t position = uk->reading_columns_position++;
+    if(position < (size_t) RARRAY_LEN(uk->reading_columns_keys) &&
+            RARRAY_AREF(uk->reading_columns_keys, position) == key) {
+        return RARRAY_AREF(uk->reading_columns_slots, position);
+    }
+
+    VALUE column = rb_hash_lookup2(uk->reading_columns, key, Qnil);
+    if(column == Qnil) {
+        column = rb_ary_new();
+        rb_hash_aset(uk->reading_columns, key, column);
+    }
+    rb_ary_store(uk->reading_columns_keys, position, key);
+    rb_ary_store(uk->reading_columns_slots, position, column);
+    return column;
+}
+
+static int read_columns_complete_i(VALUE key, VALUE column, VALUE arg)
+{
+    UNUSED(key);
+    msgpack_unpacker_t* uk = (msgpack_unpacker_t*) arg;
+
+    /* fill nil for maps without the key */
+    size_t rows = uk->reading_columns_rows;
+    if((size_t) RARRAY_LEN(column) < rows) {
+        rb_ary_store(column, rows - 1, Qnil);
+    }
+    object_complete_mutable(uk, column);
+    return ST_CONTINUE;
+}
+
+static int read_columns_complete(msgpack_unpacker_t* uk)
+{
+    VALUE columns = uk->reading_columns;
+    rb_hash_foreach(columns, read_columns_complete_i, (VALUE) uk);
+
+    uk->reading_columns = Qnil;
+    uk->reading_columns_keys = Qnil;
+    uk->reading_columns_slots = Qnil;
+    uk->reading_columns_key = Qnil;
+    return object_complete_mutable(uk, columns);
+}
+
+int msgpack_unpacker_read_columns(msgpack_unpacker_t* uk)
+{
+    uk->reading_events = false;
+
+    if(uk->skipping) {
+        int r = msgpack_unpacker_skip(uk, 0);
+        if(r < 0) {
+            return r;
+        }
+    }
+    if(_msgpack_unpacker_begin_reader(uk, false) < 0) {
+        return PRIMITIVE_READER_SWITCHED;
+    }
+
+    /* stack entries count maps left at depth 1 and keys and values left at depth 2 */
+    if(uk->reading_columns == Qnil) {
+        uint32_t rows;
+        int r = msgpack_unpacker_read_array_header(uk, &rows);
+        if(r < 0) {
+            return r;
+        }
+        r = _msgpack_unpacker_stack_push(uk, STACK_TYPE_ARRAY, rows);
+        if(r < 0) {
+            return r;
+        }
+        if(uk->key_cache == NULL) {
+            /* same keys are read as the same objects */
+            msgpack_unpacker_set_key_cache(uk, true);
+        }
+        uk->reading_columns = rb_hash_new();
+        uk->reading_columns_keys = rb_ary_new();
+        uk->reading_columns_slots = rb_ary_new();
+        uk->reading_columns_rows = rows;
+    }
+
+    while(true) {
+        msgpack_unpacker_stack_t* top = _msgpack_unpacker_stack_top(uk);
+
+        if(uk->stack_depth == 1) {
+            if(top->count == 0) {
+                msgpack_unpacker_stack_pop(uk);
+                return read_columns_complete(uk);
+            }
+            uint32_t pairs;
+            int r = msgpack_unpacker_read_map_header(uk, &pairs);
+            if(r < 0) {
+                return r;
+            }
+            top->count--;
+            if(pairs > 0) {
+                r = _msgpack_unpacker_stack_push(uk, STACK_TYPE_MAP_KEY, (size_t) pairs * 2);
+                if(r < 0) {
+                    return r;
+                }
+                uk->reading_columns_position = 0;
+            }
+            continue;
+        }
+
+        if(top->count == 0) {
+            msgpack_unpacker_stack_pop(uk);
+            continue;
+        }
+
+        int r = msgpack_unpacker_read(uk, 2);
+        if(r < 0) {
+            return r;
+        }
+        top = _msgpack_unpacker_stack_top(uk);
+        VALUE object = uk->last_object;
+
+        if(top->type == STACK_TYPE_MAP_KEY) {
+            if(uk->symbolize_keys && rb_type(object) == T_STRING) {
+                object = msgpack_unpacker_symbolize_key(object);
+            }
+            uk->reading_columns_key = object;
+            top->type = STACK_TYPE_MAP_VALUE;
+        } else {
+            VALUE column = read_columns_column(uk, uk->reading_columns_key);
+            size_t row = uk->reading_columns_rows - uk->stack[0].count - 1;
+            rb_ary_store(column, row, object);
+            top->type = STACK_TYPE_MAP_KEY;
+        }
+        top->count--;
+    }
+}
+
+static inline void event_element_read(msgpack_unpacker_t* uk)
+{
+    if(uk->stack_depth > 0) {
+        msgpack_unpacker_stack_t* top = _msgpack_unpacker_stack_top(uk);
+        top->count--;
+        switch(top->type) {
+        case STACK_TYPE_MAP_KEY:
+            top->type = STACK_TYPE_MAP_VALUE;
+            break;
+        case STACK_TYPE_MAP_VALUE:
+            top->type = STACK_TYPE_MAP_KEY;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static int read_event(msgpack_unpacker_t* uk, msgpack_unpacker_event_t* event)
+{
+    if(uk->reading_raw_remaining == 0) {
+        if(uk->stack_depth > 0 && _msgpack_unpacker_stack_top(uk)->count == 0) {
+            msgpack_unpacker_stack_pop(uk);
+            event->type = MSGPACK_UNPACKER_EVENT_END;
+            return PRIMITIVE_OBJECT_COMPLETE;
+        }
+
+        int type = msgpack_unpacker_peek_next_object_type(uk);
+        if(type < 0) {
+            return type;
+        }
+
+        if(type == TYPE_ARRAY || type == TYPE_MAP) {
+            uint32_t count;
+            int r;
+            if(type == TYPE_ARRAY) {
+                r = msgpack_unpacker_read_array_header(uk, &count);
+            } else {
+                r = msgpack_unpacker_read_map_header(uk, &count);
+            }
+            if(r < 0) {
+                return r;
+            }
+            event_element_read(uk);
+
+            /* entries count children left until the END event including empty ones */
+            if(type == TYPE_ARRAY) {
+                r = _msgpack_unpacker_stack_push(uk, STACK_TYPE_ARRAY, count);
+                event->type = MSGPACK_UNPACKER_EVENT_ARRAY_START;
+            } else {
+                r = _msgpack_unpacker_stack_push(uk, STACK_TYPE_MAP_KEY, (size_t) count * 2);
+                event->type = MSGPACK_UNPACKER_EVENT_MAP_START;
+            }
+            if(r < 0) {
+                return r;
+            }
+            event->count = count;
+            return PRIMITIVE_OBJECT_COMPLETE;
+        }
+    }
+
+    int r = read_primitive(uk);
+    if(r < 0) {
+        return r;
+    }
+
+    VALUE object = uk->last_object;
+    if(r == PRIMITIVE_OBJECT_EXTENDED_TYPE) {
+        event->type = MSGPACK_UNPACKER_EVENT_EXT;
+        event->exttype = uk->last_extended_type;
+    } else {
+        if(uk->symbolize_keys && is_reading_map_key(uk) && rb_type(object) == T_STRING) {
+            object = msgpack_unpacker_symbolize_key(object);
+        }
+        event->type = MSGPACK_UNPACKER_EVENT_VALUE;
+    }
+    event->object = object;
+    event_element_read(uk);
+    return PRIMITIVE_OBJECT_COMPLETE;
+}
+
+int msgpack_unpacker_read_event(msgpack_unpacker_t* uk, msgpack_unpacker_event_t* event)
+{
+    if(uk->skipping) {
+        /* finish skipping first because entries on the stack don't count events */
+        int r = msgpack_unpacker_skip(uk, 0);
+        if(r < 0) {
+            return r;
+        }
+    }
+    int r = _msgpack_unpacker_begin_reader(uk, true);
+    if(r < 0) {
+        return r;
+    }
+
+    uk->reading_events = true;
+    r = read_event(uk, event);
+    uk->reading_events = false;
+    return r;
+}
+
+int msgpack_unpacker_each_event(msgpack_unpacker_t* uk,
+        msgpack_unpacker_event_callback_t callback, void* data)
+{
+    msgpack_unpacker_event_t event;
+    while(true) {
+        int r = msgpack_unpacker_read_event(uk, &event);
+        if(r < 0) {
+            return r;
+        }
+        r = callback(&event, data);
+        if(r != 0) {
+            return r;
+        }
+    }
+}
+
 int msgpack_unpacker_skip_nil(msgpack_unpacker_t* uk)
 {
     int b = get_head_byte(uk);
@@ -931,3 +1927,157 @@ int msgpack_unpacker_skip_nil(msgpack_unpacker_t* uk)
     return 0;
 }
 
+
+static inline VALUE read_tape_payload(msgpack_unpacker_t* uk, VALUE source, const msgpack_tape_entry_t* e)
+{
+    if(e->count >= UNPACKER_BUFFER_(uk)->read_reference_threshold) {
+        return rb_str_substr(source, e->as.offset, e->count);
+    }
+    return rb_str_new(RSTRING_PTR(source) + e->as.offset, e->count);
+}
+
+static int read_tape_raw(msgpack_unpacker_t* uk, VALUE source, const msgpack_tape_entry_t* e)
+{
+    bool str = e->tag == MSGPACK_TAPE_STRING;
+    size_t length = e->count;
+
+    if(length == 0) {
+        VALUE string = rb_str_buf_new(0);
+        return str ? object_complete_string(uk, string) : object_complete_binary(uk, string);
+    }
+
+    if(!(e->flags & MSGPACK_TAPE_ENTRY_MAP_KEY)) {
+        VALUE string = read_tape_payload(uk, source, e);
+        return str ? object_complete_string(uk, string) : object_complete_binary(uk, string);
+    }
+
+    /* same as read_raw_body_begin for map keys */
+    const char* p = RSTRING_PTR(source) + e->as.offset;
+    if(uk->key_cache != NULL && length <= MSGPACK_UNPACKER_KEY_CACHE_MAX_LENGTH) {
+        return complete_cached_map_key(uk, str, p, length);
+    }
+    if(uk->symbolize_keys) {
+        VALUE sym = lookup_symbol_key(p, length);
+        if(sym != Qnil) {
+            return object_complete(uk, sym);
+        }
+    }
+    VALUE string = rb_str_new(p, length);
+    int r = str ? object_complete_string(uk, string) : object_complete_binary(uk, string);
+    if(r == PRIMITIVE_OBJECT_COMPLETE) {
+        rb_obj_freeze(uk->last_object);
+    }
+    return r;
+}
+
+static int read_tape_extended_type(msgpack_unpacker_t* uk, VALUE source, const msgpack_tape_entry_t* e)
+{
+    VALUE data;
+    switch(_msgpack_unpacker_extended_type_payload(uk, e->exttype)) {
+    case MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_SHARED:
+        data = rb_str_substr(source, e->as.offset, e->count);
+        break;
+    case MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_BUFFER:
+        data = _msgpack_unpacker_new_payload_buffer();
+        if(e->count > 0) {
+            msgpack_buffer_t* pb;
+            Data_Get_Struct(data, msgpack_buffer_t, pb);
+            msgpack_buffer_append_string_reference(pb, rb_str_substr(source, e->as.offset, e->count));
+        }
+        break;
+    default:
+        data = read_tape_payload(uk, source, e);
+    }
+    return object_complete_extended_type(uk, e->exttype, data);
+}
+
+int msgpack_unpacker_read_tape(msgpack_unpacker_t* uk, msgpack_tape_t* t, VALUE source)
+{
+    /* frames of msgpack_tape_parse are reused; the stack is as deep as the tape */
+    t->values = ALLOC_N(VALUE, t->size);
+    t->values_size = 0;
+    t->depth = 0;
+
+    size_t i;
+    for(i = 0; i < t->size; i++) {
+        const msgpack_tape_entry_t* e = &t->entries[i];
+        int r;
+        switch(e->tag) {
+        case MSGPACK_TAPE_NIL:
+            r = object_complete(uk, Qnil);
+            break;
+        case MSGPACK_TAPE_TRUE:
+            r = object_complete(uk, Qtrue);
+            break;
+        case MSGPACK_TAPE_FALSE:
+            r = object_complete(uk, Qfalse);
+            break;
+        case MSGPACK_TAPE_UINT:
+            r = object_complete(uk, e->as.u <= (uint64_t) FIXNUM_MAX ? LONG2FIX((long) e->as.u) : rb_ull2inum(e->as.u));
+            break;
+        case MSGPACK_TAPE_INT:
+            r = object_complete(uk, FIXABLE(e->as.i) ? LONG2FIX((long) e->as.i) : rb_ll2inum(e->as.i));
+            break;
+        case MSGPACK_TAPE_FLOAT:
+            r = object_complete(uk, rb_float_new(e->as.d));
+            break;
+        case MSGPACK_TAPE_STRING:
+        case MSGPACK_TAPE_BINARY:
+            r = read_tape_raw(uk, source, e);
+            break;
+        case MSGPACK_TAPE_EXT:
+            r = read_tape_extended_type(uk, source, e);
+            break;
+        default:  /* MSGPACK_TAPE_ARRAY and MSGPACK_TAPE_MAP */
+            if(e->count > 0) {
+                msgpack_tape_frame_t* next = &t->stack[t->depth++];
+                next->remaining = e->tag == MSGPACK_TAPE_MAP ? (size_t) e->count * 2 : e->count;
+                next->entry = i;
+                next->values = t->values_size;
+                continue;
+            }
+            r = object_complete_mutable(uk, e->tag == MSGPACK_TAPE_MAP ? rb_hash_new() : rb_ary_new());
+            break;
+        }
+        if(r < 0) {
+            return r;
+        }
+
+        while(t->depth > 0) {
+            VALUE v = uk->last_object;
+            if((e->flags & MSGPACK_TAPE_ENTRY_MAP_KEY) && uk->symbolize_keys && rb_type(v) == T_STRING) {
+                v = msgpack_unpacker_symbolize_key(v);
+            }
+            t->values[t->values_size++] = v;
+
+            msgpack_tape_frame_t* top = &t->stack[t->depth-1];
+            if(--top->remaining > 0) {
+                break;
+            }
+
+            /* all children are read; children stay marked until the container is built */
+            e = &t->entries[top->entry];
+            const VALUE* values = t->values + top->values;
+            size_t size = t->values_size - top->values;
+            VALUE object = Qundef;
+            if(e->tag == MSGPACK_TAPE_ARRAY) {
+                object = _msgpack_unpacker_new_array(values, size);
+            } else {
+                if(uk->shapes != Qnil) {
+                    object = _msgpack_unpacker_new_shaped_object(uk, values, size);
+                }
+                if(object == Qundef) {
+                    object = _msgpack_unpacker_new_hash(values, size);
+                }
+            }
+            t->values_size = top->values;
+            t->depth--;
+            r = object_complete_mutable(uk, object);
+            if(r < 0) {
+                return r;
+            }
+        }
+    }
+
+    return PRIMITIVE_OBJECT_COMPLETE;
+}
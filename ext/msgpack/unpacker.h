@@ -20,10 +20,30 @@
 
 #include "buffer.h"
 
+/* initial capacity of the stack. it grows up to max_depth */
 #ifndef MSGPACK_UNPACKER_STACK_CAPACITY
 #define MSGPACK_UNPACKER_STACK_CAPACITY 128
 #endif
 
+#ifndef MSGPACK_UNPACKER_DEFAULT_MAX_DEPTH
+#define MSGPACK_UNPACKER_DEFAULT_MAX_DEPTH 128
+#endif
+
+/* children of containers being read are collected here before growing to heap */
+#ifndef MSGPACK_UNPACKER_EMBEDDED_VALUES_CAPACITY
+#define MSGPACK_UNPACKER_EMBEDDED_VALUES_CAPACITY 32
+#endif
+
+/* number of entries of the key cache. must be a power of 2 */
+#ifndef MSGPACK_UNPACKER_KEY_CACHE_SIZE
+#define MSGPACK_UNPACKER_KEY_CACHE_SIZE 256
+#endif
+
+/* longer keys are not cached */
+#ifndef MSGPACK_UNPACKER_KEY_CACHE_MAX_LENGTH
+#define MSGPACK_UNPACKER_KEY_CACHE_MAX_LENGTH 64
+#endif
+
 struct msgpack_unpacker_t;
 typedef struct msgpack_unpacker_t msgpack_unpacker_t;
 
@@ -36,11 +56,42 @@ enum stack_type_t {
 typedef struct {
     size_t count;
     enum stack_type_t type;
-    VALUE object;
-    VALUE key;
+    size_t values;  /* offset of the children in msgpack_unpacker_t::values */
 } msgpack_unpacker_stack_t;
 
-#define MSGPACK_UNPACKER_STACK_SIZE (8+4+8+8)  /* assumes size_t <= 64bit, enum <= 32bit, VALUE <= 64bit */
+#define MSGPACK_UNPACKER_STACK_SIZE (8+4+8)  /* assumes size_t <= 64bit, enum <= 32bit */
+
+/* how a resolved extended type target constructs objects */
+enum msgpack_unpacker_exttype_kind_t {
+    MSGPACK_UNPACKER_EXTTYPE_UNKNOWN = 0,  /* nil or false */
+    MSGPACK_UNPACKER_EXTTYPE_CLASS,        /* target.from_exttype(type, data) */
+    MSGPACK_UNPACKER_EXTTYPE_PROC,         /* Proc called without looking up #call */
+    MSGPACK_UNPACKER_EXTTYPE_METHOD,       /* Method called without looking up #call */
+    MSGPACK_UNPACKER_EXTTYPE_CALLABLE,     /* target.call(type, data) */
+    MSGPACK_UNPACKER_EXTTYPE_INVALID,
+};
+
+/* what extended type targets receive as payloads */
+enum msgpack_unpacker_exttype_payload_t {
+    MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_STRING = 0,  /* String */
+    MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_SHARED,      /* frozen String sharing memory with fed data */
+    MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_BUFFER,      /* MessagePack::Buffer referring to fed data */
+};
+
+typedef struct {
+    VALUE target;  /* Qundef if not resolved yet */
+    enum msgpack_unpacker_exttype_kind_t kind;
+    enum msgpack_unpacker_exttype_payload_t payload;
+} msgpack_unpacker_exttype_entry_t;
+
+#define MSGPACK_UNPACKER_EXTTYPE_TABLE_SIZE 256
+
+typedef struct {
+    VALUE string;  /* frozen String or Qfalse */
+    VALUE key;     /* the String, or a Symbol if symbolize_keys is set */
+    uint32_t hash;
+    bool binary;
+} msgpack_unpacker_key_cache_entry_t;
 
 struct msgpack_unpacker_t {
     msgpack_buffer_t buffer;
@@ -50,19 +101,83 @@ struct msgpack_unpacker_t {
     msgpack_unpacker_stack_t* stack;
     size_t stack_depth;
     size_t stack_capacity;
+    size_t max_depth;
 
     VALUE last_object;
 
+    /* elements of Arrays and keys and values of Hashes being read.
+     * containers are created at once when all children are read. */
+    VALUE* values;
+    size_t values_size;
+    size_t values_capacity;
+    VALUE values_embedded[MSGPACK_UNPACKER_EMBEDDED_VALUES_CAPACITY];
+
     VALUE reading_raw;
     size_t reading_raw_remaining;
+    bool reading_raw_extended;  /* reading_raw is the payload of an extended type */
+    int8_t reading_raw_extended_type;
+
+    /* msgpack_unpacker_skip pushes stack entries without objects */
+    bool skipping;
+    size_t skipping_raw_remaining;
+
+    /* msgpack_unpacker_read_columns stores values of maps in an array of maps
+     * into a column Array per key instead of building the maps */
+    VALUE reading_columns;        /* Hash of keys to columns, or Qnil */
+    VALUE reading_columns_keys;   /* keys in the order of the previous map */
+    VALUE reading_columns_slots;  /* columns in the order of the previous map */
+    VALUE reading_columns_key;
+    size_t reading_columns_rows;
+    size_t reading_columns_position;
+
+    /* msgpack_unpacker_read_event pushes stack entries without objects
+     * and completes extended types with their payload */
+    bool reading_events;
+    int8_t last_extended_type;
+    /* entries on the stack were pushed by msgpack_unpacker_read_event; other
+     * readers can't continue them because they don't collect objects */
+    bool stack_of_events;
 
     VALUE buffer_ref;
     VALUE self_ref;
+    VALUE decoder_ref;  /* Unpacker to deserialize objects read without deserializing */
 
     VALUE extended_types;  // how to unpack extended types. Can be Qnil, Qfalse or a hash
+    VALUE extended_type_payloads;  // Qnil or a hash of typenr to enum msgpack_unpacker_exttype_payload_t
+
+    /* targets of extended types resolved from extended_types and the class-level
+     * extended types, indexed by (uint8_t) typenr, or NULL until an extended type is read.
+     * it's cleared when registrations of any unpacker or the class change. */
+    msgpack_unpacker_exttype_entry_t* exttype_table;
+    unsigned long exttype_table_serial;
+
+    /* classes to build from maps instead of Hashes, or Qnil.
+     * an Array of [class, keys, targets, struct_p] registered by Unpacker#register_shape */
+    VALUE shapes;
+
+    /* map keys indexed by hash of bytes, or NULL if disabled */
+    msgpack_unpacker_key_cache_entry_t* key_cache;
 
     /* options */
     bool symbolize_keys;
+    bool freeze;
+    int validate_utf8;
+    bool bignum_exttype_enabled;
+    int8_t bignum_exttype;
+
+    /* limits of declared sizes; SIZE_MAX if unlimited */
+    size_t max_array_size;
+    size_t max_map_size;
+    size_t max_str_size;
+    size_t max_ext_size;
+    size_t max_buffer_size;
+};
+
+enum msgpack_unpacker_utf8_mode_t {
+    MSGPACK_UNPACKER_UTF8_NONE = 0,
+    MSGPACK_UNPACKER_UTF8_RAISE,
+    MSGPACK_UNPACKER_UTF8_BINARY,
+    MSGPACK_UNPACKER_UTF8_SCRUB,
 };
 
 #define HEAD_BYTE_REQUIRED 0xc1
@@ -98,6 +213,45 @@ static inline void msgpack_unpacker_set_symbolized_keys(msgpack_unpacker_t* uk,
     uk->symbolize_keys = enable;
 }
 
+static inline void msgpack_unpacker_set_max_depth(msgpack_unpacker_t* uk, size_t max_depth)
+{
+    uk->max_depth = max_depth;
+}
+
+static inline void msgpack_unpacker_set_freeze(msgpack_unpacker_t* uk, bool enable)
+{
+    uk->freeze = enable;
+}
+
+static inline void msgpack_unpacker_set_validate_utf8(msgpack_unpacker_t* uk, int mode)
+{
+    uk->validate_utf8 = mode;
+}
+
+void msgpack_unpacker_set_key_cache(msgpack_unpacker_t* uk, bool enable);
+
+static inline void msgpack_unpacker_set_bignum_exttype(msgpack_unpacker_t* uk, int8_t typenr)
+{
+    uk->bignum_exttype_enabled = true;
+    uk->bignum_exttype = typenr;
+}
+
+static inline VALUE msgpack_unpacker_symbolize_key(VALUE key)
+{
+    /* here uses rb_intern_str instead of rb_intern so that Ruby VM can GC unused symbols */
+#ifdef HAVE_RB_STR_INTERN
+    /* rb_str_intern is added since MRI 2.2.0 */
+    return rb_str_intern(key);
+#else
+#ifndef HAVE_RB_INTERN_STR
+    /* MRI 1.8 doesn't have rb_intern_str or rb_intern2 */
+    return ID2SYM(rb_intern(RSTRING_PTR(key)));
+#else
+    return ID2SYM(rb_intern_str(key));
+#endif
+#endif
+}
+
 /* shared code for extended types */
 
 extern ID s_from_exttype;
@@ -125,6 +279,9 @@ static inline VALUE _get_extended_type( VALUE extended_types, int8_t typenr)
 
 extern VALUE msgpack_unpacker_class_extended_types;  // Qnil, Qfalse or a hash
 
+/* incremented when any registration of extended types changes */
+extern unsigned long msgpack_unpacker_extended_types_serial;
+
 void msgpack_unpacker_class_set_default_extended_type(VALUE val);
 
 static inline VALUE msgpack_unpacker_class_get_default_extended_type()
@@ -134,6 +291,8 @@ static inline VALUE msgpack_unpacker_class_get_default_extended_type()
 
 void msgpack_unpacker_class_set_extended_type(int8_t typenr, VALUE val);
 
+void msgpack_unpacker_class_set_extended_type_payload(int8_t typenr, enum msgpack_unpacker_exttype_payload_t payload);
+
 static inline VALUE msgpack_unpacker_class_get_extended_type(int8_t typenr)
 {
     return _get_extended_type( msgpack_unpacker_class_extended_types, typenr);
@@ -150,6 +309,8 @@ static inline VALUE msgpack_unpacker_get_default_extended_type(msgpack_unpacker_
 
 void msgpack_unpacker_set_extended_type(msgpack_unpacker_t* uk, VALUE typenr, VALUE val);
 
+void msgpack_unpacker_set_extended_type_payload(msgpack_unpacker_t* uk, VALUE typenr, enum msgpack_unpacker_exttype_payload_t payload);
+
 static inline VALUE msgpack_unpacker_get_extended_type(msgpack_unpacker_t* uk, int8_t typenr)
 {
     return _get_extended_type( uk->extended_types, typenr);
@@ -173,10 +334,11 @@ static inline VALUE msgpack_unpacker_resolve_extended_type(msgpack_unpacker_t* u
 }
 
 
-int msgpack_read_extended_type_begin( msgpack_unpacker_t* uk);
+int msgpack_read_extended_type_begin(msgpack_unpacker_t* uk, int8_t extended_type);
 
 
 /* error codes */
+#define PRIMITIVE_OBJECT_EXTENDED_TYPE 2  /* payload of an extended type read by msgpack_unpacker_read_event */
 #define PRIMITIVE_CONTAINER_START 1
 #define PRIMITIVE_OBJECT_COMPLETE 0
 #define PRIMITIVE_EOF -1
@@ -184,11 +346,54 @@ int msgpack_read_extended_type_begin( msgpack_unpacker_t* uk);
 #define PRIMITIVE_STACK_TOO_DEEP -3
 #define PRIMITIVE_UNEXPECTED_TYPE -4
 #define PRIMITIVE_UNKNOWN_EXTTYPE -5
+#define PRIMITIVE_INVALID_UTF8 -6
+#define PRIMITIVE_LIMIT_EXCEEDED -7
+#define PRIMITIVE_READER_SWITCHED -8  /* events and objects are read in the middle of the other */
 
 int msgpack_unpacker_read(msgpack_unpacker_t* uk, size_t target_stack_depth);
 
 int msgpack_unpacker_skip(msgpack_unpacker_t* uk, size_t target_stack_depth);
 
+/* reads an array of maps and sets a Hash of keys to Arrays of values to last_object.
+ * keys missing in a map are filled with nil. */
+int msgpack_unpacker_read_columns(msgpack_unpacker_t* uk);
+
+/*
+ * Events are read from the stream one by one without building containers:
+ *
+ *   MSGPACK_UNPACKER_EVENT_ARRAY_START  count is the number of elements
+ *   MSGPACK_UNPACKER_EVENT_MAP_START    count is the number of pairs
+ *   MSGPACK_UNPACKER_EVENT_VALUE        object is a nil, boolean, number or string
+ *   MSGPACK_UNPACKER_EVENT_EXT          exttype and object (the payload String)
+ *   MSGPACK_UNPACKER_EVENT_END          after the last element of an array or a map
+ */
+enum msgpack_unpacker_event_type_t {
+    MSGPACK_UNPACKER_EVENT_VALUE = 0,
+    MSGPACK_UNPACKER_EVENT_ARRAY_START,
+    MSGPACK_UNPACKER_EVENT_MAP_START,
+    MSGPACK_UNPACKER_EVENT_EXT,
+    MSGPACK_UNPACKER_EVENT_END,
+};
+
+typedef struct {
+    enum msgpack_unpacker_event_type_t type;
+    size_t count;
+    VALUE object;
+    int8_t exttype;
+} msgpack_unpacker_event_t;
+
+/* returns PRIMITIVE_OBJECT_COMPLETE and sets event, or an error code.
+ * reading can be resumed after PRIMITIVE_EOF once more data is fed. */
+int msgpack_unpacker_read_event(msgpack_unpacker_t* uk, msgpack_unpacker_event_t* event);
+
+/* called for each event; returning non-zero stops msgpack_unpacker_each_event */
+typedef int (*msgpack_unpacker_event_callback_t)(const msgpack_unpacker_event_t* event, void* data);
+
+/* reads events until the buffer runs out (PRIMITIVE_EOF), an error code
+ * is returned, or the callback returns non-zero, which is returned. */
+int msgpack_unpacker_each_event(msgpack_unpacker_t* uk,
+        msgpack_unpacker_event_callback_t callback, void* data);
+
 static inline VALUE msgpack_unpacker_get_last_object(msgpack_unpacker_t* uk)
 {
     return uk->last_object;
@@ -20,6 +20,13 @@
 #include "unpacker_class.h"
 #include "buffer_class.h"
 #include "exttype_class.h"
+#include "lazy_class.h"
+#include "scan.h"
+#include "tape.h"
+
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
 
 VALUE cMessagePack_Unpacker;
 VALUE cMessagePack_exttypes;  // global default for unpacking extended types
@@ -27,12 +34,19 @@ VALUE cMessagePack_exttypes;  // global default for unpacking extended types
 ID s_from_exttype;
 ID s_call;
 
+static VALUE s_event_array_start;
+static VALUE s_event_map_start;
+static VALUE s_event_value;
+static VALUE s_event_ext;
+static VALUE s_event_end;
+
 //static VALUE s_unpacker_value;
 //static msgpack_unpacker_t* s_unpacker;
 
 static VALUE eUnpackError;
 static VALUE eMalformedFormatError;
 static VALUE eStackError;
+static VALUE eLimitError;
 static VALUE eTypeError;
 
 static bool _unpacker_check_exttype_target(VALUE arg)
@@ -59,6 +73,57 @@ static bool _unpacker_check_exttype_target(VALUE arg)
     return true;
 }
 
+static int _unpacker_utf8_mode(VALUE arg)
+{
+    if(!RTEST(arg)) {
+        return MSGPACK_UNPACKER_UTF8_NONE;
+    } else if(arg == Qtrue || arg == ID2SYM(rb_intern("raise"))) {
+        return MSGPACK_UNPACKER_UTF8_RAISE;
+    } else if(arg == ID2SYM(rb_intern("binary"))) {
+        return MSGPACK_UNPACKER_UTF8_BINARY;
+    } else if(arg == ID2SYM(rb_intern("scrub"))) {
+        return MSGPACK_UNPACKER_UTF8_SCRUB;
+    }
+    rb_raise(rb_eArgError, "expected :raise, :binary or :scrub for :validate_utf8 option");
+}
+
+static enum msgpack_unpacker_exttype_payload_t _unpacker_exttype_payload_option(int* argc, VALUE* argv)
+{
+    /* takes the trailing options hash of register_exttype off the arguments */
+    if(*argc < 2 || rb_type(argv[*argc - 1]) != T_HASH) {
+        return MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_STRING;
+    }
+    VALUE options = argv[--*argc];
+    VALUE key = ID2SYM(rb_intern("payload"));
+    VALUE v = rb_hash_lookup2(options, key, Qundef);
+    if(RHASH_SIZE(options) > (v == Qundef ? 0 : 1)) {
+        VALUE unknown = rb_funcall(options, rb_intern("keys"), 0);
+        rb_ary_delete(unknown, key);
+        rb_raise(rb_eArgError, "unknown option for register_exttype: %s", RSTRING_PTR(rb_inspect(unknown)));
+    }
+    if(v == Qundef || v == Qnil || v == ID2SYM(rb_intern("string"))) {
+        return MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_STRING;
+    } else if(v == ID2SYM(rb_intern("shared"))) {
+        return MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_SHARED;
+    } else if(v == ID2SYM(rb_intern("buffer"))) {
+        return MSGPACK_UNPACKER_EXTTYPE_PAYLOAD_BUFFER;
+    }
+    rb_raise(rb_eArgError, "expected :string, :shared or :buffer for :payload option");
+}
+
+static size_t _unpacker_limit_option(VALUE options, const char* name, size_t current)
+{
+    VALUE v = rb_hash_aref(options, ID2SYM(rb_intern(name)));
+    if(v == Qnil) {
+        return current;
+    }
+    long n = NUM2LONG(v);
+    if(n < 0) {
+        rb_raise(rb_eArgError, "%s must be zero or positive but %ld found", name, n);
+    }
+    return (size_t) n;
+}
+
 static VALUE _unpacker_check_exttype_set_args(int argc, VALUE val, VALUE block) {
     if(block == Qnil) {
         if(argc == 1) {
@@ -95,11 +160,13 @@ static VALUE Unpacker_exttype_class_method(VALUE self, VALUE typenr)
 static VALUE Unpacker_register_exttype_class_method(int argc, VALUE *argv, VALUE self)
 {
     VALUE typenr, target, block;
+    enum msgpack_unpacker_exttype_payload_t payload = _unpacker_exttype_payload_option(&argc, argv);
     rb_scan_args(argc, argv, "11&", &typenr, &target, &block);
     int8_t nr= _exttype_check_typecode( typenr);
     target = _unpacker_check_exttype_set_args(argc, target, block);
     _unpacker_check_exttype_target(target);
     msgpack_unpacker_class_set_extended_type(nr, target);
+    msgpack_unpacker_class_set_extended_type_payload(nr, payload);
     return target;
 }
 
@@ -167,6 +234,12 @@ static VALUE Unpacker_initialize(int argc, VALUE* argv, VALUE self)
     MessagePack_Unpacker_initialize(uk, io, options);
     uk->self_ref = self;
 
+    /* streaming unpackers with symbolize_keys cache Symbols unless :key_cache => false */
+    if(uk->symbolize_keys && (options == Qnil ||
+                rb_hash_aref(options, ID2SYM(rb_intern("key_cache"))) == Qnil)) {
+        msgpack_unpacker_set_key_cache(uk, true);
+    }
+
     return self;
 }
 
@@ -181,13 +254,46 @@ void MessagePack_Unpacker_initialize(msgpack_unpacker_t* uk, VALUE io, VALUE opt
         v = rb_hash_aref(options, ID2SYM(rb_intern("symbolize_keys")));
         msgpack_unpacker_set_symbolized_keys(uk, RTEST(v));
 
+        v = rb_hash_aref(options, ID2SYM(rb_intern("freeze")));
+        msgpack_unpacker_set_freeze(uk, RTEST(v));
+
         v = rb_hash_aref(options, ID2SYM(rb_intern("default_exttype")));
         _unpacker_check_exttype_target(v);
         msgpack_unpacker_set_default_extended_type(uk, v);
+
+        v = rb_hash_aref(options, ID2SYM(rb_intern("validate_utf8")));
+        msgpack_unpacker_set_validate_utf8(uk, _unpacker_utf8_mode(v));
+
+        v = rb_hash_aref(options, ID2SYM(rb_intern("key_cache")));
+        msgpack_unpacker_set_key_cache(uk, RTEST(v));
+
+        v = rb_hash_aref(options, ID2SYM(rb_intern("max_depth")));
+        if(v != Qnil) {
+            long n = NUM2LONG(v);
+            if(n <= 0) {
+                rb_raise(rb_eArgError, "max_depth must be positive but %ld found", n);
+            }
+            msgpack_unpacker_set_max_depth(uk, (size_t) n);
+        }
+
+        uk->max_array_size = _unpacker_limit_option(options, "max_array_size", uk->max_array_size);
+        uk->max_map_size = _unpacker_limit_option(options, "max_map_size", uk->max_map_size);
+        uk->max_str_size = _unpacker_limit_option(options, "max_str_size", uk->max_str_size);
+        uk->max_ext_size = _unpacker_limit_option(options, "max_ext_size", uk->max_ext_size);
+        uk->max_buffer_size = _unpacker_limit_option(options, "max_buffer_size", uk->max_buffer_size);
+
+        v = rb_hash_aref(options, ID2SYM(rb_intern("bignum_exttype")));
+        if(v != Qnil) {
+#if defined(HAVE_RB_INTEGER_PACK) && defined(HAVE_RB_INTEGER_UNPACK)
+            msgpack_unpacker_set_bignum_exttype(uk, _exttype_check_typecode(v));
+#else
+            rb_raise(rb_eNotImpError, ":bignum_exttype option is not supported on this platform");
+#endif
+        }
     }
 }
 
-static void raise_unpacker_error(int r)
+void raise_unpacker_error(int r)
 {
     switch(r) {
     case PRIMITIVE_EOF:
@@ -200,6 +306,12 @@ static void raise_unpacker_error(int r)
         rb_raise(eTypeError, "unexpected type");
     case PRIMITIVE_UNKNOWN_EXTTYPE:
         rb_raise(eUnpackError, "unknown extended type");
+    case PRIMITIVE_INVALID_UTF8:
+        rb_raise(eMalformedFormatError, "invalid UTF-8 byte sequence in a string");
+    case PRIMITIVE_LIMIT_EXCEEDED:
+        rb_raise(eLimitError, "size of an object exceeds the limit");
+    case PRIMITIVE_READER_SWITCHED:
+        rb_raise(eUnpackError, "can't switch between each_event and read in the middle of an object");
     default:
         rb_raise(eUnpackError, "logically unknown error %d", r);
     }
@@ -223,6 +335,18 @@ static VALUE Unpacker_read(VALUE self)
     return msgpack_unpacker_get_last_object(uk);
 }
 
+static VALUE Unpacker_read_columns(VALUE self)
+{
+    UNPACKER(self, uk);
+
+    int r = msgpack_unpacker_read_columns(uk);
+    if(r < 0) {
+        raise_unpacker_error(r);
+    }
+
+    return msgpack_unpacker_get_last_object(uk);
+}
+
 static VALUE Unpacker_skip(VALUE self)
 {
     UNPACKER(self, uk);
@@ -311,17 +435,147 @@ static VALUE Unpacker_peek_next_type(VALUE self)
     }
 }
 
+/* returns an unpacker to deserialize bytes read by _unpacker_read_object */
+static VALUE _unpacker_decoder(msgpack_unpacker_t* uk)
+{
+    if(uk->decoder_ref == Qnil) {
+        VALUE decoder = Unpacker_alloc(cMessagePack_Unpacker);
+        msgpack_unpacker_t* dk;
+        Data_Get_Struct(decoder, msgpack_unpacker_t, dk);
+
+        /* prefer reference than copying; see MessagePack_unpack */
+        msgpack_buffer_set_write_reference_threshold(UNPACKER_BUFFER_(dk), 0);
+        dk->self_ref = decoder;
+
+        uk->decoder_ref = decoder;
+    }
+
+    msgpack_unpacker_t* dk;
+    Data_Get_Struct(uk->decoder_ref, msgpack_unpacker_t, dk);
+
+    /* options and extended types may be changed after the last call */
+    dk->symbolize_keys = uk->symbolize_keys;
+    dk->freeze = uk->freeze;
+    dk->max_depth = uk->max_depth;
+    dk->max_array_size = uk->max_array_size;
+    dk->max_map_size = uk->max_map_size;
+    dk->max_str_size = uk->max_str_size;
+    dk->max_ext_size = uk->max_ext_size;
+    dk->validate_utf8 = uk->validate_utf8;
+    dk->bignum_exttype_enabled = uk->bignum_exttype_enabled;
+    dk->bignum_exttype = uk->bignum_exttype;
+    dk->extended_types = uk->extended_types;
+    dk->extended_type_payloads = uk->extended_type_payloads;
+    dk->shapes = uk->shapes;
+
+    return uk->decoder_ref;
+}
+
+/*
+ * Reads bytes of an object without deserializing it and returns them as a
+ * frozen String. If _containers_only_ is true and the object is not an array
+ * nor a map, returns nil without consuming the object.
+ */
+static VALUE _unpacker_read_object(msgpack_unpacker_t* uk, bool containers_only)
+{
+    msgpack_buffer_t* b = UNPACKER_BUFFER_(uk);
+
+    if(uk->head_byte != HEAD_BYTE_REQUIRED || uk->stack_depth > 0 || uk->skipping) {
+        rb_raise(eUnpackError, "can't read bytes of an object in the middle of an object");
+    }
+
+    msgpack_scan_buffer_state_t s;
+    msgpack_scan_buffer_state_init(&s);
+
+    while(true) {
+        const char* head = containers_only && s.offset == 0 ? msgpack_buffer_readable_pointer_at(b, 0, 1) : NULL;
+        if(head != NULL) {
+            /* fixarray, fixmap, array 16/32 or map 16/32 */
+            unsigned char t = (unsigned char) *head;
+            if(!((0x80 <= t && t <= 0x9f) || (0xdc <= t && t <= 0xdf))) {
+                return Qnil;
+            }
+        }
+
+        int r = msgpack_scan_skip_buffer(b, &s);
+        if(r == PRIMITIVE_OBJECT_COMPLETE) {
+            size_t size = s.offset;
+            VALUE source;
+            if(b->head->mapped_string != NO_MAPPED_STRING && msgpack_buffer_top_readable_size(b) >= size) {
+                source = _msgpack_buffer_refer_head_mapped_string(b, size);
+                msgpack_buffer_skip_nonblock(b, size);
+            } else {
+                /* copies only the object even if the buffer has more chunks */
+                source = rb_str_new(NULL, size);
+                msgpack_buffer_read_nonblock(b, RSTRING_PTR(source), size);
+            }
+            return rb_obj_freeze(source);
+        }
+
+        if(r != PRIMITIVE_EOF) {
+            raise_unpacker_error(r);
+        }
+        if(!msgpack_buffer_has_io(b)) {
+            raise_unpacker_error(PRIMITIVE_EOF);
+        }
+        _msgpack_buffer_feed_from_io(b);
+    }
+}
+
+static VALUE Unpacker_read_lazy(VALUE self)
+{
+    UNPACKER(self, uk);
+
+    VALUE source = _unpacker_read_object(uk, true);
+    if(source == Qnil) {
+        return Unpacker_read(self);
+    }
+
+    return MessagePack_Lazy_new(source, _unpacker_decoder(uk), 0, RSTRING_LEN(source));
+}
+
+static VALUE Unpacker_dig(int argc, VALUE* argv, VALUE self)
+{
+    UNPACKER(self, uk);
+
+    VALUE source = _unpacker_read_object(uk, false);
+
+    return MessagePack_Lazy_extract(source, _unpacker_decoder(uk), 0, RSTRING_LEN(source), argc, argv);
+}
+
+static void _unpacker_check_buffer_size(msgpack_unpacker_t* uk, VALUE data)
+{
+    if(uk->max_buffer_size != SIZE_MAX &&
+            msgpack_buffer_all_readable_size(UNPACKER_BUFFER_(uk)) + RSTRING_LEN(data) > uk->max_buffer_size) {
+        rb_raise(eLimitError, "buffered data exceeds max_buffer_size");
+    }
+}
+
 static VALUE Unpacker_feed(VALUE self, VALUE data)
 {
     UNPACKER(self, uk);
 
     StringValue(data);
+    _unpacker_check_buffer_size(uk, data);
 
     msgpack_buffer_append_string(UNPACKER_BUFFER_(uk), data);
 
     return self;
 }
 
+static VALUE Unpacker_feed_reference(VALUE self, VALUE data)
+{
+    UNPACKER(self, uk);
+
+    StringValue(data);
+    _unpacker_check_buffer_size(uk, data);
+
+    /* data must not be modified until the objects are read */
+    msgpack_buffer_append_string_reference(UNPACKER_BUFFER_(uk), data);
+
+    return self;
+}
+
 static VALUE Unpacker_each_impl(VALUE self)
 {
     UNPACKER(self, uk);
@@ -345,9 +599,10 @@ static VALUE Unpacker_each_impl(VALUE self)
     }
 }
 
-static VALUE Unpacker_rescue_EOFError(VALUE self)
+static VALUE Unpacker_rescue_EOFError(VALUE self, VALUE error)
 {
     UNUSED(self);
+    UNUSED(error);
     return Qnil;
 }
 
@@ -369,11 +624,196 @@ static VALUE Unpacker_each(VALUE self)
     }
 }
 
+struct unpacker_read_many_args {
+    msgpack_unpacker_t* uk;
+    VALUE io;
+    long max;
+};
+
+static VALUE _unpacker_read_many(VALUE arg)
+{
+    struct unpacker_read_many_args* args = (struct unpacker_read_many_args*) arg;
+    msgpack_unpacker_t* uk = args->uk;
+
+    VALUE result = rb_ary_new();
+    while(RARRAY_LEN(result) < args->max) {
+        int r = msgpack_unpacker_read(uk, 0);
+        if(r < 0) {
+            if(r == PRIMITIVE_EOF) {
+                break;
+            }
+            raise_unpacker_error(r);
+        }
+        rb_ary_push(result, msgpack_unpacker_get_last_object(uk));
+    }
+    return result;
+}
+
+static VALUE _unpacker_read_many_ensure(VALUE arg)
+{
+    struct unpacker_read_many_args* args = (struct unpacker_read_many_args*) arg;
+    UNPACKER_BUFFER_(args->uk)->io = args->io;
+    return Qnil;
+}
+
+static VALUE Unpacker_read_many(VALUE self, VALUE max)
+{
+    UNPACKER(self, uk);
+
+    long n = NUM2LONG(max);
+    if(n < 0) {
+        rb_raise(rb_eArgError, "max must be zero or positive but %ld found", n);
+    }
+
+    /* reads only buffered data; the io is detached while reading */
+    struct unpacker_read_many_args args = { uk, UNPACKER_BUFFER_(uk)->io, n };
+    msgpack_buffer_reset_io(UNPACKER_BUFFER_(uk));
+
+    return rb_ensure(_unpacker_read_many, (VALUE) &args, _unpacker_read_many_ensure, (VALUE) &args);
+}
+
+struct unpacker_each_batch_args {
+    VALUE self;
+    VALUE batch;
+    long size;
+};
+
+/* batches start small enough and grow, so a large size doesn't allocate before reading */
+#define UNPACKER_BATCH_INITIAL_CAPACITY 1024
+
+static inline VALUE _unpacker_new_batch(long size)
+{
+    return rb_ary_new2(size < UNPACKER_BATCH_INITIAL_CAPACITY ? size : UNPACKER_BATCH_INITIAL_CAPACITY);
+}
+
+static VALUE _unpacker_each_batch(VALUE arg)
+{
+    struct unpacker_each_batch_args* args = (struct unpacker_each_batch_args*) arg;
+    UNPACKER(args->self, uk);
+
+    while(true) {
+        int r = msgpack_unpacker_read(uk, 0);
+        if(r < 0) {
+            if(r == PRIMITIVE_EOF) {
+                return Qnil;
+            }
+            raise_unpacker_error(r);
+        }
+        rb_ary_push(args->batch, msgpack_unpacker_get_last_object(uk));
+        if(RARRAY_LEN(args->batch) >= args->size) {
+            VALUE batch = args->batch;
+            args->batch = _unpacker_new_batch(args->size);
+            rb_yield(batch);
+        }
+    }
+}
+
+static int Unpacker_yield_event(const msgpack_unpacker_event_t* event, void* data)
+{
+    UNUSED(data);
+    VALUE v;
+    switch(event->type) {
+    case MSGPACK_UNPACKER_EVENT_ARRAY_START:
+        v = rb_ary_new3(2, s_event_array_start, SIZET2NUM(event->count));
+        break;
+    case MSGPACK_UNPACKER_EVENT_MAP_START:
+        v = rb_ary_new3(2, s_event_map_start, SIZET2NUM(event->count));
+        break;
+    case MSGPACK_UNPACKER_EVENT_EXT:
+        v = rb_ary_new3(3, s_event_ext, INT2FIX(event->exttype), event->object);
+        break;
+    case MSGPACK_UNPACKER_EVENT_END:
+        v = rb_ary_new3(1, s_event_end);
+        break;
+    default:
+        v = rb_ary_new3(2, s_event_value, event->object);
+        break;
+    }
+    rb_yield(v);
+    return 0;
+}
+
+static VALUE Unpacker_each_event_impl(VALUE self)
+{
+    UNPACKER(self, uk);
+
+    int r = msgpack_unpacker_each_event(uk, Unpacker_yield_event, NULL);
+    if(r != PRIMITIVE_EOF) {
+        raise_unpacker_error(r);
+    }
+    return Qnil;
+}
+
+static VALUE Unpacker_each_event(VALUE self)
+{
+    UNPACKER(self, uk);
+
+#ifdef RETURN_ENUMERATOR
+    RETURN_ENUMERATOR(self, 0, 0);
+#endif
+
+    if(msgpack_buffer_has_io(UNPACKER_BUFFER_(uk))) {
+        /* rescue EOFError only if io is set */
+        return rb_rescue2(Unpacker_each_event_impl, self,
+                Unpacker_rescue_EOFError, self,
+                rb_eEOFError, NULL);
+    } else {
+        return Unpacker_each_event_impl(self);
+    }
+}
+
+static VALUE Unpacker_each_batch(VALUE self, VALUE size)
+{
+    UNPACKER(self, uk);
+
+#ifdef RETURN_ENUMERATOR
+    RETURN_ENUMERATOR(self, 1, &size);
+#endif
+
+    long n = NUM2LONG(size);
+    if(n <= 0) {
+        rb_raise(rb_eArgError, "size must be positive but %ld found", n);
+    }
+
+    struct unpacker_each_batch_args args = { self, _unpacker_new_batch(n), n };
+
+    if(msgpack_buffer_has_io(UNPACKER_BUFFER_(uk))) {
+        /* rescue EOFError only if io is set */
+        rb_rescue2(_unpacker_each_batch, (VALUE) &args,
+                Unpacker_rescue_EOFError, self,
+                rb_eEOFError, NULL);
+    } else {
+        _unpacker_each_batch((VALUE) &args);
+    }
+
+    /* objects read before the end of data */
+    if(RARRAY_LEN(args.batch) > 0) {
+        rb_yield(args.batch);
+    }
+    return Qnil;
+}
+
 static VALUE Unpacker_feed_each(VALUE self, VALUE data)
 {
-    // TODO optimize
-    Unpacker_feed(self, data);
-    return Unpacker_each(self);
+    UNPACKER(self, uk);
+    msgpack_buffer_t* b = UNPACKER_BUFFER_(uk);
+
+    if(!rb_block_given_p() || msgpack_buffer_has_io(b)) {
+        Unpacker_feed(self, data);
+        return Unpacker_each(self);
+    }
+
+    StringValue(data);
+    _unpacker_check_buffer_size(uk, data);
+
+    /* refer to data instead of copying it; objects are read before it returns */
+    msgpack_buffer_append_string_reference(b, data);
+
+    Unpacker_each_impl(self);
+
+    /* don't keep data after all bytes are read */
+    msgpack_buffer_release_read_references(b);
+    return Qnil;
 }
 
 static VALUE Unpacker_reset(VALUE self)
@@ -385,7 +825,7 @@ static VALUE Unpacker_reset(VALUE self)
     return Qnil;
 }
 
-VALUE MessagePack_unpack(int argc, VALUE* argv)
+static VALUE _messagepack_unpack(int argc, VALUE* argv, bool columns)
 {
     VALUE src;
     VALUE options = Qnil;
@@ -419,7 +859,12 @@ VALUE MessagePack_unpack(int argc, VALUE* argv)
         MessagePack_Unpacker_initialize(uk, src, options);
     }
 
-    int r = msgpack_unpacker_read(uk, 0);
+    int r;
+    if(columns) {
+        r = msgpack_unpacker_read_columns(uk);
+    } else {
+        r = msgpack_unpacker_read(uk, 0);
+    }
     if(r < 0) {
         raise_unpacker_error(r);
     }
@@ -439,6 +884,390 @@ VALUE MessagePack_unpack(int argc, VALUE* argv)
 }
 
 
+VALUE MessagePack_unpack(int argc, VALUE* argv)
+{
+    return _messagepack_unpack(argc, argv, false);
+}
+
+static VALUE MessagePack_unpack_columnar(int argc, VALUE* argv)
+{
+    return _messagepack_unpack(argc, argv, true);
+}
+
+static VALUE MessagePack_unpack_at(int argc, VALUE* argv)
+{
+    VALUE src;
+    VALUE options = Qnil;
+
+    switch(argc) {
+    case 3:
+        options = argv[2];
+        if(rb_type(options) != T_HASH) {
+            rb_raise(rb_eArgError, "expected Hash but found %s.", rb_obj_classname(options));
+        }
+        /* pass-through */
+    case 2:
+        src = argv[0];
+        break;
+    default:
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 2..3)", argc);
+    }
+    StringValue(src);
+
+    long offset = NUM2LONG(argv[1]);
+    size_t length = RSTRING_LEN(src);
+    if(offset < 0 || (size_t) offset > length) {
+        rb_raise(rb_eArgError, "offset %ld out of range", offset);
+    }
+
+    VALUE self = Unpacker_alloc(cMessagePack_Unpacker);
+    UNPACKER(self, uk);
+    msgpack_buffer_t* b = UNPACKER_BUFFER_(uk);
+
+    /* prefer reference than copying; see MessagePack_Unpacker_module_init */
+    msgpack_buffer_set_write_reference_threshold(b, 0);
+    MessagePack_Unpacker_initialize(uk, Qnil, options);
+
+    size_t size;
+    int r = msgpack_scan_skip(RSTRING_PTR(src) + offset, length - offset, &size);
+    if(r < 0) {
+        raise_unpacker_error(r);
+    }
+
+    /* copy short objects, otherwise refer to the bytes of the object in src */
+    if(size < MSGPACK_BUFFER_STRING_FEED_REFERENCE_MINIMUM) {
+        msgpack_buffer_append(b, RSTRING_PTR(src) + offset, size);
+    } else {
+        msgpack_buffer_append_string_reference(b, rb_str_substr(src, offset, size));
+    }
+
+    r = msgpack_unpacker_read(uk, 0);
+    if(r < 0) {
+        raise_unpacker_error(r);
+    }
+
+#ifdef RB_GC_GUARD
+    RB_GC_GUARD(self);
+#endif
+
+    return rb_assoc_new(msgpack_unpacker_get_last_object(uk), SIZET2NUM(offset + size));
+}
+
+/* shorter Strings are parsed without releasing the GVL */
+#ifndef MSGPACK_UNPACKER_TAPE_WITHOUT_GVL_MINIMUM
+#define MSGPACK_UNPACKER_TAPE_WITHOUT_GVL_MINIMUM (64*1024)
+#endif
+
+static void Tape_free(msgpack_tape_t* t)
+{
+    if(t == NULL) {
+        return;
+    }
+    msgpack_tape_destroy(t);
+    xfree(t);
+}
+
+struct tape_parse_args {
+    msgpack_tape_t* tape;
+    const char* p;
+    size_t length;
+    int result;
+};
+
+static void* _unpacker_parse_tape(void* ptr)
+{
+    struct tape_parse_args* args = ptr;
+    args->result = msgpack_tape_parse(args->tape, args->p, args->length);
+    return NULL;
+}
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+static void _unpacker_interrupt_tape(void* ptr)
+{
+    msgpack_tape_interrupt(((struct tape_parse_args*) ptr)->tape);
+}
+#endif
+
+static VALUE MessagePack_unpack_without_gvl(int argc, VALUE* argv)
+{
+    VALUE src;
+    VALUE options = Qnil;
+
+    switch(argc) {
+    case 2:
+        options = argv[1];
+        if(rb_type(options) != T_HASH) {
+            rb_raise(rb_eArgError, "expected Hash but found %s.", rb_obj_classname(options));
+        }
+        /* pass-through */
+    case 1:
+        src = argv[0];
+        break;
+    default:
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 1..2)", argc);
+    }
+    StringValue(src);
+
+    VALUE self = Unpacker_alloc(cMessagePack_Unpacker);
+    UNPACKER(self, uk);
+    MessagePack_Unpacker_initialize(uk, Qnil, options);
+
+    /* other threads may modify src while the GVL is released. this shares memory with src */
+    VALUE source = rb_str_dup(src);
+#ifdef COMPAT_HAVE_ENCODING
+    ENCODING_SET(source, msgpack_rb_encindex_ascii8bit);
+#endif
+    rb_obj_freeze(source);
+
+    msgpack_tape_t* t;
+    /* klass 0 hides the tape from ObjectSpace */
+    VALUE tape = Data_Make_Struct(0, msgpack_tape_t, msgpack_tape_mark, Tape_free, t);
+    msgpack_tape_init(t);
+    t->max_depth = uk->max_depth;
+    t->max_array_size = uk->max_array_size;
+    t->max_map_size = uk->max_map_size;
+    t->max_str_size = uk->max_str_size;
+    t->max_ext_size = uk->max_ext_size;
+
+    struct tape_parse_args args = { t, RSTRING_PTR(source), RSTRING_LEN(source), 0 };
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    if(args.length >= MSGPACK_UNPACKER_TAPE_WITHOUT_GVL_MINIMUM) {
+        while(true) {
+            rb_thread_call_without_gvl(_unpacker_parse_tape, &args, _unpacker_interrupt_tape, &args);
+            if(args.result != MSGPACK_TAPE_INTERRUPTED) {
+                break;
+            }
+            /* raises if the thread is killed, or resumes parsing */
+            rb_thread_check_ints();
+        }
+    } else {
+        _unpacker_parse_tape(&args);
+    }
+#else
+    _unpacker_parse_tape(&args);
+#endif
+
+    if(args.result == MSGPACK_TAPE_NO_MEMORY) {
+        rb_memerror();
+    } else if(args.result < 0) {
+        raise_unpacker_error(args.result);
+    }
+
+    /* raise if extra bytes follow */
+    if(t->offset < args.length) {
+        rb_raise(eMalformedFormatError, "extra bytes follow after a deserialized object");
+    }
+
+    int r = msgpack_unpacker_read_tape(uk, t, source);
+    if(r < 0) {
+        raise_unpacker_error(r);
+    }
+
+#ifdef RB_GC_GUARD
+    RB_GC_GUARD(self);
+    RB_GC_GUARD(source);
+    RB_GC_GUARD(tape);
+#endif
+
+    return msgpack_unpacker_get_last_object(uk);
+}
+
+/*
+ * Validates a String without creating objects. Returns true, or sets offset
+ * of the first invalid object (or extra bytes) to *offset and returns false.
+ */
+static bool _messagepack_validate(int argc, VALUE* argv, size_t* offset)
+{
+    VALUE src;
+    VALUE options = Qnil;
+
+    switch(argc) {
+    case 2:
+        options = argv[1];
+        if(rb_type(options) != T_HASH) {
+            rb_raise(rb_eArgError, "expected Hash but found %s.", rb_obj_classname(options));
+        }
+        /* pass-through */
+    case 1:
+        src = argv[0];
+        break;
+    default:
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 1..2)", argc);
+    }
+    StringValue(src);
+
+    msgpack_scan_limits_t limits;
+    limits.max_depth = MSGPACK_UNPACKER_DEFAULT_MAX_DEPTH;
+    limits.max_array_size = SIZE_MAX;
+    limits.max_map_size = SIZE_MAX;
+    limits.max_str_size = SIZE_MAX;
+    limits.max_ext_size = SIZE_MAX;
+    limits.validate_utf8 = false;
+    bool multiple = false;
+
+    if(options != Qnil) {
+        VALUE v;
+
+        v = rb_hash_aref(options, ID2SYM(rb_intern("validate_utf8")));
+        limits.validate_utf8 = _unpacker_utf8_mode(v) == MSGPACK_UNPACKER_UTF8_RAISE;
+
+        v = rb_hash_aref(options, ID2SYM(rb_intern("max_depth")));
+        if(v != Qnil) {
+            long n = NUM2LONG(v);
+            if(n <= 0) {
+                rb_raise(rb_eArgError, "max_depth must be positive but %ld found", n);
+            }
+            limits.max_depth = (size_t) n;
+        }
+
+        limits.max_array_size = _unpacker_limit_option(options, "max_array_size", limits.max_array_size);
+        limits.max_map_size = _unpacker_limit_option(options, "max_map_size", limits.max_map_size);
+        limits.max_str_size = _unpacker_limit_option(options, "max_str_size", limits.max_str_size);
+        limits.max_ext_size = _unpacker_limit_option(options, "max_ext_size", limits.max_ext_size);
+
+        v = rb_hash_aref(options, ID2SYM(rb_intern("multiple")));
+        multiple = RTEST(v);
+    }
+
+    const char* p = RSTRING_PTR(src);
+    size_t length = RSTRING_LEN(src);
+    size_t pos = 0;
+
+    /* exactly one object unless :multiple is set */
+    do {
+        size_t size;
+        if(msgpack_scan_validate(p + pos, length - pos, &limits, &size) < 0) {
+            *offset = pos + size;
+            return false;
+        }
+        pos += size;
+    } while(multiple && pos < length);
+
+    if(pos < length) {
+        *offset = pos;
+        return false;
+    }
+    return true;
+}
+
+static VALUE MessagePack_valid_p(int argc, VALUE* argv)
+{
+    size_t offset;
+    return _messagepack_validate(argc, argv, &offset) ? Qtrue : Qfalse;
+}
+
+static VALUE MessagePack_validate(int argc, VALUE* argv)
+{
+    size_t offset;
+    if(_messagepack_validate(argc, argv, &offset)) {
+        return Qnil;
+    }
+    return SIZET2NUM(offset);
+}
+
+/* creates an unpacker which reads a String or an IO, and deserializes entries by itself */
+static VALUE _unpacker_new_self_decoder(VALUE src, VALUE options)
+{
+    VALUE self = Unpacker_alloc(cMessagePack_Unpacker);
+    UNPACKER(self, uk);
+
+    /* prefer reference than copying; see MessagePack_Unpacker_module_init */
+    msgpack_buffer_set_write_reference_threshold(UNPACKER_BUFFER_(uk), 0);
+
+    if(rb_type(src) == T_STRING) {
+        MessagePack_Unpacker_initialize(uk, Qnil, options);
+        msgpack_buffer_append_string(UNPACKER_BUFFER_(uk), src);
+    } else {
+        MessagePack_Unpacker_initialize(uk, src, options);
+    }
+    uk->self_ref = self;
+    uk->decoder_ref = self;
+
+    return self;
+}
+
+static void _unpacker_finish_source(msgpack_unpacker_t* uk)
+{
+    /* raise if extra bytes follow */
+    if(msgpack_buffer_top_readable_size(UNPACKER_BUFFER_(uk)) > 0) {
+        rb_raise(eMalformedFormatError, "extra bytes follow after a deserialized object");
+    }
+    /* entries are deserialized using this unpacker */
+    msgpack_buffer_reset_io(UNPACKER_BUFFER_(uk));
+}
+
+static VALUE MessagePack_unpack_lazy(int argc, VALUE* argv)
+{
+    VALUE src;
+    VALUE options = Qnil;
+
+    switch(argc) {
+    case 2:
+        options = argv[1];
+        if(rb_type(options) != T_HASH) {
+            rb_raise(rb_eArgError, "expected Hash but found %s.", rb_obj_classname(options));
+        }
+        /* pass-through */
+    case 1:
+        src = argv[0];
+        break;
+    default:
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 1..2)", argc);
+    }
+
+    VALUE self = _unpacker_new_self_decoder(src, options);
+    UNPACKER(self, uk);
+
+    VALUE v;
+    VALUE source = _unpacker_read_object(uk, true);
+    if(source == Qnil) {
+        int r = msgpack_unpacker_read(uk, 0);
+        if(r < 0) {
+            raise_unpacker_error(r);
+        }
+        v = msgpack_unpacker_get_last_object(uk);
+    } else {
+        v = MessagePack_Lazy_new(source, self, 0, RSTRING_LEN(source));
+    }
+    _unpacker_finish_source(uk);
+
+    return v;
+}
+
+static VALUE MessagePack_extract(int argc, VALUE* argv)
+{
+    VALUE options = Qnil;
+
+    if(argc < 1) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 1+)", argc);
+    }
+    if(argc > 1 && rb_type(argv[argc-1]) == T_HASH) {
+        options = argv[--argc];
+    }
+
+    VALUE self = _unpacker_new_self_decoder(argv[0], options);
+    UNPACKER(self, uk);
+
+    VALUE source = _unpacker_read_object(uk, false);
+    size_t size = RSTRING_LEN(source);
+    _unpacker_finish_source(uk);
+
+    VALUE result = rb_ary_new2(argc - 1);
+    int i;
+    for(i=1; i < argc; i++) {
+        VALUE path = argv[i];
+        VALUE v;
+        if(rb_type(path) == T_ARRAY) {
+            v = MessagePack_Lazy_extract(source, self, 0, size, (int) RARRAY_LEN(path), RARRAY_PTR(path));
+        } else {
+            v = MessagePack_Lazy_extract(source, self, 0, size, 1, &path);
+        }
+        rb_ary_push(result, v);
+    }
+
+    return result;
+}
+
 static VALUE Unpacker_default_exttype(VALUE self)
 {
     UNPACKER(self, uk);
@@ -467,8 +1296,81 @@ static VALUE Unpacker_resolve_exttype(VALUE self, VALUE typenr)
     return msgpack_unpacker_resolve_extended_type(uk, nr);
 }
 
+static VALUE Unpacker_register_shape(int argc, VALUE* argv, VALUE self)
+{
+    VALUE klass, options;
+    rb_scan_args(argc, argv, "11", &klass, &options);
+    UNPACKER(self, uk);
+
+    if(rb_type(klass) != T_CLASS) {
+        rb_raise(rb_eTypeError, "expected Class but found %s.", rb_obj_classname(klass));
+    }
+    if(rb_get_alloc_func(klass) == NULL) {
+        /* objects are allocated with the allocator of klass */
+        rb_raise(rb_eTypeError, "allocator undefined for %s", rb_class2name(klass));
+    }
+    bool struct_p = RTEST(rb_class_inherited_p(klass, rb_cStruct));
+
+    VALUE keys = Qnil;
+    if(options != Qnil) {
+        if(rb_type(options) != T_HASH) {
+            rb_raise(rb_eArgError, "expected Hash but found %s.", rb_obj_classname(options));
+        }
+        keys = rb_hash_aref(options, ID2SYM(rb_intern("keys")));
+    }
+    VALUE members = struct_p ? rb_struct_s_members(klass) : Qnil;
+    if(keys == Qnil) {
+        if(!struct_p) {
+            rb_raise(rb_eArgError, "keys are required unless %s is a Struct", rb_class2name(klass));
+        }
+        keys = members;
+    }
+    keys = rb_Array(keys);
+
+    long count = RARRAY_LEN(keys);
+    VALUE names = rb_ary_new2(count);
+    VALUE targets = rb_ary_new2(count);
+    long i;
+    for(i=0; i < count; i++) {
+        VALUE key = RARRAY_AREF(keys, i);
+        VALUE name = rb_obj_freeze(rb_str_dup(SYMBOL_P(key) ? rb_sym_to_s(key) : StringValue(key)));
+        if(rb_ary_includes(names, name) == Qtrue) {
+            rb_raise(rb_eArgError, "duplicated key %s", RSTRING_PTR(name));
+        }
+        rb_ary_push(names, name);
+
+        if(struct_p) {
+            long m;
+            for(m=0; m < RARRAY_LEN(members); m++) {
+                if(rb_str_equal(rb_sym_to_s(RARRAY_AREF(members, m)), name) == Qtrue) {
+                    break;
+                }
+            }
+            if(m == RARRAY_LEN(members)) {
+                rb_raise(rb_eArgError, "%s is not a member of %s", RSTRING_PTR(name), rb_class2name(klass));
+            }
+            rb_ary_push(targets, LONG2FIX(m));
+        } else {
+            VALUE ivar = rb_str_plus(rb_str_new_cstr("@"), name);
+            /* raises NameError unless ivar is a valid name */
+            rb_funcall(klass, rb_intern("instance_variable_defined?"), 1, ivar);
+            rb_ary_push(targets, ID2SYM(rb_intern_str(ivar)));
+        }
+    }
+
+    VALUE shape = rb_ary_new3(4, klass, rb_obj_freeze(names), rb_obj_freeze(targets), struct_p ? Qtrue : Qfalse);
+    if(uk->shapes == Qnil) {
+        uk->shapes = rb_ary_new();
+    }
+    /* shapes registered later take precedence */
+    rb_ary_unshift(uk->shapes, rb_obj_freeze(shape));
+
+    return Qnil;
+}
+
 #define UNPACKER_REGISTER_DRY \
     VALUE typenr, target, block; \
+    enum msgpack_unpacker_exttype_payload_t payload = _unpacker_exttype_payload_option(&argc, argv); \
     rb_scan_args(argc, argv, "11&", &typenr, &target, &block); \
     VALUE nr= INT2FIX(_exttype_check_typecode(typenr)); \
     target = _unpacker_check_exttype_set_args(argc, target, block); \
@@ -479,6 +1381,7 @@ static VALUE Unpacker_register_exttype(int argc, VALUE *argv, VALUE self)
 {
     UNPACKER_REGISTER_DRY
     msgpack_unpacker_set_extended_type(uk, nr, target);
+    msgpack_unpacker_set_extended_type_payload(uk, nr, payload);
     return target;
 }
 
@@ -515,6 +1418,48 @@ static VALUE MessagePack_unpack_module_method(int argc, VALUE* argv, VALUE mod)
     return MessagePack_unpack(argc, argv);
 }
 
+static VALUE MessagePack_unpack_columnar_module_method(int argc, VALUE* argv, VALUE mod)
+{
+    UNUSED(mod);
+    return MessagePack_unpack_columnar(argc, argv);
+}
+
+static VALUE MessagePack_unpack_at_module_method(int argc, VALUE* argv, VALUE mod)
+{
+    UNUSED(mod);
+    return MessagePack_unpack_at(argc, argv);
+}
+
+static VALUE MessagePack_unpack_without_gvl_module_method(int argc, VALUE* argv, VALUE mod)
+{
+    UNUSED(mod);
+    return MessagePack_unpack_without_gvl(argc, argv);
+}
+
+static VALUE MessagePack_valid_p_module_method(int argc, VALUE* argv, VALUE mod)
+{
+    UNUSED(mod);
+    return MessagePack_valid_p(argc, argv);
+}
+
+static VALUE MessagePack_validate_module_method(int argc, VALUE* argv, VALUE mod)
+{
+    UNUSED(mod);
+    return MessagePack_validate(argc, argv);
+}
+
+static VALUE MessagePack_unpack_lazy_module_method(int argc, VALUE* argv, VALUE mod)
+{
+    UNUSED(mod);
+    return MessagePack_unpack_lazy(argc, argv);
+}
+
+static VALUE MessagePack_extract_module_method(int argc, VALUE* argv, VALUE mod)
+{
+    UNUSED(mod);
+    return MessagePack_extract(argc, argv);
+}
+
 void MessagePack_Unpacker_module_init(VALUE mMessagePack)
 {
     msgpack_unpacker_static_init();
@@ -522,6 +1467,12 @@ void MessagePack_Unpacker_module_init(VALUE mMessagePack)
     s_from_exttype = rb_intern("from_exttype");
     s_call = rb_intern("call");
 
+    s_event_array_start = ID2SYM(rb_intern("array_start"));
+    s_event_map_start = ID2SYM(rb_intern("map_start"));
+    s_event_value = ID2SYM(rb_intern("value"));
+    s_event_ext = ID2SYM(rb_intern("ext"));
+    s_event_end = ID2SYM(rb_intern("end"));
+
     cMessagePack_Unpacker = rb_define_class_under(mMessagePack, "Unpacker", rb_cObject);
 
     eUnpackError = rb_define_class_under(mMessagePack, "UnpackError", rb_eStandardError);
@@ -530,6 +1481,8 @@ void MessagePack_Unpacker_module_init(VALUE mMessagePack)
 
     eStackError = rb_define_class_under(mMessagePack, "StackError", eUnpackError);
 
+    eLimitError = rb_define_class_under(mMessagePack, "LimitError", eUnpackError);
+
     eTypeError = rb_define_class_under(mMessagePack, "TypeError", rb_eStandardError);
 
     rb_define_alloc_func(cMessagePack_Unpacker, Unpacker_alloc);
@@ -545,13 +1498,20 @@ void MessagePack_Unpacker_module_init(VALUE mMessagePack)
     rb_define_method(cMessagePack_Unpacker, "buffer", Unpacker_buffer, 0);
     rb_define_method(cMessagePack_Unpacker, "read", Unpacker_read, 0);
     rb_define_alias(cMessagePack_Unpacker, "unpack", "read");
+    rb_define_method(cMessagePack_Unpacker, "read_lazy", Unpacker_read_lazy, 0);
+    rb_define_method(cMessagePack_Unpacker, "dig", Unpacker_dig, -1);
     rb_define_method(cMessagePack_Unpacker, "skip", Unpacker_skip, 0);
     rb_define_method(cMessagePack_Unpacker, "skip_nil", Unpacker_skip_nil, 0);
+    rb_define_method(cMessagePack_Unpacker, "read_many", Unpacker_read_many, 1);
+    rb_define_method(cMessagePack_Unpacker, "read_columns", Unpacker_read_columns, 0);
     rb_define_method(cMessagePack_Unpacker, "read_array_header", Unpacker_read_array_header, 0);
     rb_define_method(cMessagePack_Unpacker, "read_map_header", Unpacker_read_map_header, 0);
     //rb_define_method(cMessagePack_Unpacker, "peek_next_type", Unpacker_peek_next_type, 0);  // TODO
     rb_define_method(cMessagePack_Unpacker, "feed", Unpacker_feed, 1);
+    rb_define_method(cMessagePack_Unpacker, "feed_reference", Unpacker_feed_reference, 1);
     rb_define_method(cMessagePack_Unpacker, "each", Unpacker_each, 0);
+    rb_define_method(cMessagePack_Unpacker, "each_batch", Unpacker_each_batch, 1);
+    rb_define_method(cMessagePack_Unpacker, "each_event", Unpacker_each_event, 0);
     rb_define_method(cMessagePack_Unpacker, "feed_each", Unpacker_feed_each, 1);
     rb_define_method(cMessagePack_Unpacker, "reset", Unpacker_reset, 0);
 
@@ -559,6 +1519,7 @@ void MessagePack_Unpacker_module_init(VALUE mMessagePack)
     rb_define_method(cMessagePack_Unpacker, "default_exttype=", Unpacker_default_exttype_set, 1);
     rb_define_method(cMessagePack_Unpacker, "default_exttype", Unpacker_default_exttype, 0);
     rb_define_method(cMessagePack_Unpacker, "register_exttype", Unpacker_register_exttype, -1);
+    rb_define_method(cMessagePack_Unpacker, "register_shape", Unpacker_register_shape, -1);
     //~ rb_define_method(cMessagePack_Unpacker, "register_lowlevel", Unpacker_register_lowlevel, -1);  // TODO
     rb_define_method(cMessagePack_Unpacker, "exttype", Unpacker_exttype, 1);  // returns exactly what register_exttype has set, no defaults
     rb_define_method(cMessagePack_Unpacker, "resolve_exttype", Unpacker_resolve_exttype, 1);  // also considers the instance and class defaults
@@ -572,5 +1533,12 @@ void MessagePack_Unpacker_module_init(VALUE mMessagePack)
     /* MessagePack.unpack(x) */
     rb_define_module_function(mMessagePack, "load", MessagePack_load_module_method, -1);
     rb_define_module_function(mMessagePack, "unpack", MessagePack_unpack_module_method, -1);
+    rb_define_module_function(mMessagePack, "unpack_columnar", MessagePack_unpack_columnar_module_method, -1);
+    rb_define_module_function(mMessagePack, "unpack_at", MessagePack_unpack_at_module_method, -1);
+    rb_define_module_function(mMessagePack, "unpack_without_gvl", MessagePack_unpack_without_gvl_module_method, -1);
+    rb_define_module_function(mMessagePack, "valid?", MessagePack_valid_p_module_method, -1);
+    rb_define_module_function(mMessagePack, "validate", MessagePack_validate_module_method, -1);
+    rb_define_module_function(mMessagePack, "unpack_lazy", MessagePack_unpack_lazy_module_method, -1);
+    rb_define_module_function(mMessagePack, "extract", MessagePack_extract_module_method, -1);
 }
 
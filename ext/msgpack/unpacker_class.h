@@ -28,5 +28,7 @@ VALUE MessagePack_unpack(int argc, VALUE* argv);
 
 void MessagePack_Unpacker_initialize(msgpack_unpacker_t* uk, VALUE io, VALUE options);
 
+NORETURN(void raise_unpacker_error(int r));
+
 #endif
 
@@ -0,0 +1,138 @@
+/*
+ * MessagePack for Ruby
+ *
+ * Copyright (C) 2008-2013 Sadayuki Furuhashi
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+#ifndef MSGPACK_RUBY_UTF8_H__
+#define MSGPACK_RUBY_UTF8_H__
+
+#include "sysdep.h"
+
+#if defined(__SSE2__) && !defined(DISABLE_UTF8_SIMD)
+#include <emmintrin.h>
+#define UTF8_SIMD_SSE2
+#endif
+
+enum msgpack_utf8_result_t {
+    MSGPACK_UTF8_INVALID = 0,
+    MSGPACK_UTF8_7BIT,
+    MSGPACK_UTF8_VALID,
+};
+
+/*
+ * Returns length of the leading 7bit-only part of p.
+ * Scans 16 bytes at once using SSE2 if available, otherwise 8 bytes at once
+ * using a word-sized mask.
+ */
+static inline size_t msgpack_utf8_ascii_prefix(const unsigned char* p, size_t length)
+{
+    size_t i = 0;
+
+#ifdef UTF8_SIMD_SSE2
+    for(; i + 16 <= length; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) (p + i)));
+        if(mask != 0) {
+            _msgpack_bsp32(nz, mask);
+            return i + nz;
+        }
+    }
+#endif
+
+    for(; i + 8 <= length; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        if(w & 0x8080808080808080ULL) {
+            break;
+        }
+    }
+
+    for(; i < length; i++) {
+        if(p[i] & 0x80) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+static inline bool _msgpack_utf8_is_cont(unsigned char c)
+{
+    return (c & 0xc0) == 0x80;
+}
+
+/*
+ * Validates UTF-8 according to RFC 3629: rejects overlong forms, surrogates
+ * (U+D800..U+DFFF) and code points beyond U+10FFFF.
+ */
+static inline enum msgpack_utf8_result_t msgpack_utf8_validate(const char* str, size_t length)
+{
+    const unsigned char* p = (const unsigned char*) str;
+
+    size_t i = msgpack_utf8_ascii_prefix(p, length);
+    if(i == length) {
+        return MSGPACK_UTF8_7BIT;
+    }
+
+    while(i < length) {
+        unsigned char c = p[i];
+        size_t rest = length - i;
+
+        if(c < 0x80) {
+            i += msgpack_utf8_ascii_prefix(p + i, rest);
+
+        } else if(c < 0xc2) {
+            /* continuation byte or overlong 2-byte sequence */
+            return MSGPACK_UTF8_INVALID;
+
+        } else if(c < 0xe0) {
+            if(rest < 2 || !_msgpack_utf8_is_cont(p[i+1])) {
+                return MSGPACK_UTF8_INVALID;
+            }
+            i += 2;
+
+        } else if(c < 0xf0) {
+            if(rest < 3) {
+                return MSGPACK_UTF8_INVALID;
+            }
+            unsigned char c1 = p[i+1];
+            if(!_msgpack_utf8_is_cont(c1) || !_msgpack_utf8_is_cont(p[i+2]) ||
+                    (c == 0xe0 && c1 < 0xa0) ||  /* overlong */
+                    (c == 0xed && c1 > 0x9f)) {  /* surrogate */
+                return MSGPACK_UTF8_INVALID;
+            }
+            i += 3;
+
+        } else if(c < 0xf5) {
+            if(rest < 4) {
+                return MSGPACK_UTF8_INVALID;
+            }
+            unsigned char c1 = p[i+1];
+            if(!_msgpack_utf8_is_cont(c1) || !_msgpack_utf8_is_cont(p[i+2]) || !_msgpack_utf8_is_cont(p[i+3]) ||
+                    (c == 0xf0 && c1 < 0x90) ||  /* overlong */
+                    (c == 0xf4 && c1 > 0x8f)) {  /* > U+10FFFF */
+                return MSGPACK_UTF8_INVALID;
+            }
+            i += 4;
+
+        } else {
+            return MSGPACK_UTF8_INVALID;
+        }
+    }
+
+    return MSGPACK_UTF8_VALID;
+}
+
+#endif
+
@@ -0,0 +1,87 @@
+# encoding: ascii-8bit
+require 'spec_helper'
+require 'stringio'
+
+describe 'MessagePack.extract' do
+  let :message do
+    {
+      'type' => 'event'.force_encoding('UTF-8'),
+      'payload' => {'body' => 'x' * 1000, 'list' => [1, 2, [3, 4]]},
+      'meta' => {'tenant_id' => 42, 'tags' => {'a' => 1}},
+      7 => 'seven'.force_encoding('UTF-8'),
+    }
+  end
+
+  let :data do
+    MessagePack.pack(message)
+  end
+
+  it 'returns values at paths' do
+    MessagePack.extract(data, ['meta', 'tenant_id'], ['type']).should == [42, 'event']
+    MessagePack.extract(data, ['payload', 'list', 2, -1]).should == [4]
+    MessagePack.extract(data, [7]).should == ['seven']
+  end
+
+  it 'accepts a key as a path' do
+    MessagePack.extract(data, 'type', 7).should == ['event', 'seven']
+  end
+
+  it 'returns nil for missing paths' do
+    MessagePack.extract(data, ['meta', 'nothing'], ['type', 'x'], ['payload', 'list', 3], ['payload', 'list', 'a']).should == [nil, nil, nil, nil]
+  end
+
+  it 'deserializes containers at paths' do
+    MessagePack.extract(data, ['meta', 'tags'], []).should == [{'a' => 1}, message]
+  end
+
+  it 'returns the last value if keys are duplicated' do
+    MessagePack.extract("\x82\xa1a\x01\xa1a\x02", ['a']).should == [2]
+  end
+
+  it 'supports options' do
+    MessagePack.extract(data, [:meta, :tenant_id], ['type'], :symbolize_keys => true).should == [42, nil]
+  end
+
+  it 'compares non-ASCII keys with encodings' do
+    key = "キー".force_encoding('UTF-8')
+    bytes = MessagePack.pack({key => 1})
+    MessagePack.extract(bytes, [key], [key.dup.force_encoding('ASCII-8BIT')]).should == [1, nil]
+  end
+
+  it 'reads an IO' do
+    MessagePack.extract(StringIO.new(data), ['meta', 'tenant_id']).should == [42]
+  end
+
+  it 'raises errors' do
+    lambda { MessagePack.extract(data[0, 20], ['type']) }.should raise_error(EOFError)
+    lambda { MessagePack.extract(data + "\xc0", ['type']) }.should raise_error(MessagePack::MalformedFormatError)
+  end
+
+  it 'does not allocate objects for skipped entries' do
+    record = {}
+    100.times {|i| record["key#{i}"] = ["value#{i}", {"x" => i}] }
+    record['id'] = 1
+    bytes = MessagePack.pack(record)
+    MessagePack.extract(bytes, ['id'])
+    before = GC.stat(:total_allocated_objects)
+    MessagePack.extract(bytes, ['id'])
+    (GC.stat(:total_allocated_objects) - before < 20).should == true
+  end
+end
+
+describe 'Unpacker#dig' do
+  it 'reads an object and returns the value at the path' do
+    unpacker = MessagePack::Unpacker.new
+    unpacker.feed(MessagePack.pack({'a' => [1, {'b' => 2}]}) * 2 + MessagePack.pack(3))
+    unpacker.dig('a', 1, 'b').should == 2
+    unpacker.dig('a', 2).should == nil
+    unpacker.dig.should == 3
+    lambda { unpacker.dig('a') }.should raise_error(EOFError)
+  end
+
+  it 'reads objects from IO' do
+    data = MessagePack.pack({'a' => 'x' * 3000, 'b' => 1}) * 3
+    unpacker = MessagePack::Unpacker.new(StringIO.new(data), :io_buffer_size => 1024)
+    3.times { unpacker.dig('b').should == 1 }
+  end
+end
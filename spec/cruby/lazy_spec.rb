@@ -0,0 +1,121 @@
+# encoding: ascii-8bit
+require 'spec_helper'
+require 'stringio'
+
+describe 'lazy views' do
+  let :record do
+    {
+      'id' => 1,
+      'name' => 'msgpack'.force_encoding('UTF-8'),
+      'tags' => ['a'.force_encoding('UTF-8'), 'b'.force_encoding('UTF-8')],
+      'nested' => {'x' => [1, {'y' => 2.5}], 'big' => 'z' * 1000},
+      3 => nil,
+    }
+  end
+
+  let :data do
+    MessagePack.pack(record)
+  end
+
+  it 'MessagePack.unpack_lazy returns LazyMap for a map' do
+    map = MessagePack.unpack_lazy(data)
+    map.class.should == MessagePack::LazyMap
+    map.size.should == 5
+    map['id'].should == 1
+    map['name'].should == 'msgpack'
+    map[3].should == nil
+    map.key?(3).should == true
+    map.key?('nothing').should == false
+    map['nothing'].should == nil
+    map.keys.should == record.keys
+  end
+
+  it 'returns LazyArray and LazyMap for nested containers' do
+    map = MessagePack.unpack_lazy(data)
+    map['tags'].class.should == MessagePack::LazyArray
+    map['tags'].to_a.should == ['a', 'b']
+    map['tags'][-1].should == 'b'
+    map['tags'][2].should == nil
+    map['nested'].class.should == MessagePack::LazyMap
+    map['nested']['big'].should == 'z' * 1000
+  end
+
+  it '#dig reads nested entries' do
+    map = MessagePack.unpack_lazy(data)
+    map.dig('nested', 'x', 1, 'y').should == 2.5
+    map.dig('nested', 'nothing', 1).should == nil
+  end
+
+  it '#each, #to_h and #to_a deserialize entries' do
+    map = MessagePack.unpack_lazy(data)
+    map.to_h.should == record
+    map.map {|k, v| k }.should == record.keys
+    map['nested'].each.to_a[1].should == ['big', 'z' * 1000]
+    MessagePack.unpack_lazy(MessagePack.pack([1, [2, 3], {}])).to_a.should == [1, [2, 3], {}]
+  end
+
+  it 'returns the last value if keys are duplicated' do
+    map = MessagePack.unpack_lazy("\x82\xa1a\x01\xa1a\x02")
+    map['a'].should == 2
+  end
+
+  it 'supports symbolize_keys' do
+    map = MessagePack.unpack_lazy(data, :symbolize_keys => true)
+    map[:name].should == 'msgpack'
+    map['name'].should == nil
+    map.dig(:nested, :x, 0).should == 1
+    map.keys.should == [:id, :name, :tags, :nested, 3]
+  end
+
+  it 'compares non-ASCII string keys with encodings' do
+    key = "あ".force_encoding('UTF-8')
+    map = MessagePack.unpack_lazy(MessagePack.pack({key => 1}))
+    map[key].should == 1
+    map[key.dup.force_encoding('ASCII-8BIT')].should == nil
+  end
+
+  it 'deserializes other types as MessagePack.unpack' do
+    MessagePack.unpack_lazy(MessagePack.pack(1)).should == 1
+    MessagePack.unpack_lazy(MessagePack.pack(nil)).should == nil
+  end
+
+  it 'raises errors' do
+    lambda { MessagePack.unpack_lazy(data[0, data.size - 1]) }.should raise_error(EOFError)
+    lambda { MessagePack.unpack_lazy(data + "\xc0") }.should raise_error(MessagePack::MalformedFormatError)
+    lambda { MessagePack.unpack_lazy("\x92\xc1\x01") }.should raise_error(MessagePack::MalformedFormatError)
+  end
+
+  it 'Unpacker#read_lazy reads objects split into chunks' do
+    unpacker = MessagePack::Unpacker.new
+    data.each_char {|c| unpacker.feed(c) }
+    unpacker.feed(MessagePack.pack(7))
+    unpacker.read_lazy.to_h.should == record
+    unpacker.read_lazy.should == 7
+    lambda { unpacker.read_lazy }.should raise_error(EOFError)
+  end
+
+  it 'Unpacker#read_lazy reads objects whose headers are split into chunks' do
+    unpacker = MessagePack::Unpacker.new
+    raw = data + MessagePack.pack("s" * 300) + data + MessagePack.pack(2**40)
+    (0...raw.bytesize).step(3) {|i| unpacker.feed_reference(raw[i, 3]) }
+    unpacker.read_lazy.to_h.should == record
+    unpacker.read_lazy.should == "s" * 300
+    unpacker.read_lazy.dig('nested', 'x', 1, 'y').should == 2.5
+    unpacker.read_lazy.should == 2**40
+    lambda { unpacker.read_lazy }.should raise_error(EOFError)
+  end
+
+  it 'Unpacker#read_lazy reads objects from IO' do
+    unpacker = MessagePack::Unpacker.new(StringIO.new(data * 2), :io_buffer_size => 1024)
+    unpacker.read_lazy['tags'].to_a.should == ['a', 'b']
+    unpacker.read_lazy.dig('nested', 'big').should == 'z' * 1000
+    lambda { unpacker.read_lazy }.should raise_error(EOFError)
+  end
+
+  it 'Unpacker#read_lazy uses options and exttypes of the unpacker' do
+    unpacker = MessagePack::Unpacker.new(:symbolize_keys => true)
+    unpacker.register_exttype(1) {|nr, payload| payload.to_i }
+    unpacker.feed("\x81\xa1a\x91\xd4\x01\x35")
+    unpacker.read_lazy[:a][0].should == 5
+  end
+end
@@ -89,6 +89,144 @@ describe Packer do
     io.string.should == "\xc0"
   end
 
+  it 'write_array_stream' do
+    packer.write_array_stream do |w|
+      w << 1
+      w.write(nil)
+      w.size.should == 2
+    end
+    packer.to_s.should == "\xdd\x00\x00\x00\x02\x01\xc0"
+    MessagePack.unpack(packer.to_s).should == [1, nil]
+  end
+
+  it 'write_map_stream' do
+    packer.write_map_stream do |w|
+      w["a"] = 1
+      w.write(2, [3])
+    end
+    MessagePack.unpack(packer.to_s).should == {"a" => 1, 2 => [3]}
+  end
+
+  it 'write_array_stream and write_map_stream take an enumerable' do
+    packer.write_array_stream(1..3)
+    packer.write_map_stream({1 => 2, 3 => 4})
+    packer.write_map_stream([[5, 6]].each)
+    u = Unpacker.new
+    u.feed(packer.to_s)
+    u.each.to_a.should == [[1, 2, 3], {1 => 2, 3 => 4}, {5 => 6}]
+  end
+
+  it 'write_array_stream patches the count when the block raises' do
+    lambda {
+      packer.write_array_stream do |w|
+        w << 1
+        raise "error"
+      end
+    }.should raise_error(RuntimeError, "error")
+    MessagePack.unpack(packer.to_s).should == [1]
+  end
+
+  it 'write_array_stream keeps data in the buffer until the stream is closed' do
+    io = StringIO.new
+    pk = Packer.new(io, :io_buffer_size => 1024)
+    pk.write_array_stream do |w|
+      1000.times { w << "x" * 100 }
+      pk.flush
+      io.string.should == ''
+    end
+    pk.flush
+    MessagePack.unpack(io.string).should == ["x" * 100] * 1000
+  end
+
+  it 'write_array_stream keeps the buffer from being read until the stream is closed' do
+    packer.write("abcd")
+    lambda {
+      packer.write_array_stream do |w|
+        packer.buffer.read(5)
+        w.write(Array.new(70000, 0))
+      end
+    }.should raise_error(RuntimeError)
+    lambda { packer.write_map_stream { packer.clear } }.should raise_error(RuntimeError)
+    lambda { packer.write_map_stream { packer.write_to(StringIO.new) } }.should raise_error(RuntimeError)
+    objects = []
+    MessagePack::Unpacker.new.feed_each(packer.to_s) {|o| objects << o }
+    objects.should == ["abcd", [], {}, {}]
+
+    packer.buffer.read(6).should == MessagePack.pack("abcd")
+    packer.write_array_stream {|w| w << 1 }
+    objects.clear
+    MessagePack::Unpacker.new.feed_each(packer.to_s) {|o| objects << o }
+    objects.should == [[], {}, {}, [1]]
+  end
+
+  it 'stream writer raises after it is closed' do
+    writer = nil
+    packer.write_array_stream {|w| writer = w }
+    writer.closed?.should == true
+    lambda { writer << 1 }.should raise_error(RuntimeError)
+  end
+
+  it 'bignum_exttype packs Integers beyond 64-bit as exttype' do
+    pk = Packer.new(:bignum_exttype => 3)
+    pk.write(2**64).to_s.should == "\xc7\x0a\x03\x00\x01" + "\x00" * 8
+    pk.clear
+    pk.write(-(2**64)).to_s.should == "\xc7\x0a\x03\x01\x01" + "\x00" * 8
+    pk.clear
+    pk.write(2**64 - 1).write(-(2**63)).to_s.should == "\xcf" + "\xff" * 8 + "\xd3\x80" + "\x00" * 7
+    MessagePack.pack(2**128, :bignum_exttype => 3).should == "\xc7\x12\x03\x00\x01" + "\x00" * 16
+  end
+
+  it 'bignum_exttype requires a valid exttype typecode' do
+    lambda { Packer.new(:bignum_exttype => 128) }.should raise_error(ArgumentError)
+    lambda { Packer.new(:bignum_exttype => "1") }.should raise_error(TypeError)
+  end
+
+  it 'pack_each returns packed data of each object' do
+    packer.pack_each([1, nil, [1, 2], {1 => 2}]).should == ["\x01", "\xc0", "\x92\x01\x02", "\x81\x01\x02"]
+    packer.pack_each([]).should == []
+    packer.empty?.should == true
+  end
+
+  it 'pack_each with :join option returns concatenated data and offsets' do
+    packer.pack_each([1, [1, 2], nil], :join => true).should == ["\x01\x92\x01\x02\xc0", [0, 1, 4]]
+  end
+
+  it 'pack_each uses registered types' do
+    packer.register_exttype(Ext, 42)
+    packer.pack_each([extobj, 1]).should == ["\xC7\x03*.o0", "\x01"]
+  end
+
+  it 'pack_each raises if the buffer is not empty' do
+    packer.write(1)
+    lambda { packer.pack_each([1]) }.should raise_error(RuntimeError)
+  end
+
+  it 'pack_each clears the buffer when an exception is raised' do
+    lambda { packer_of_known_types.pack_each([1, Object.new]) }.should raise_error(TypeError)
+    packer_of_known_types.empty?.should == true
+    packer_of_known_types.pack_each([2]).should == ["\x02"]
+  end
+
+  it 'MessagePack.pack_many' do
+    objs = [1, "a" * 100, {"k" => [1.0, nil]}]
+    MessagePack.pack_many(objs).should == objs.map {|o| MessagePack.pack(o) }
+    MessagePack.pack_many(objs, :join => true).should == [objs.map {|o| MessagePack.pack(o) }.join, [0, 1, 103]]
+  end
+
+  it 'packs deeply nested objects without recursion' do
+    deep = (1..50_000).inject([]) {|a, i| [a] }
+    packer.write(deep).to_s.should == "\x91" * 50_000 + "\x90"
+  end
+
+  it 'raises ArgumentError if nesting exceeds max_depth' do
+    pk = Packer.new(:max_depth => 3)
+    pk.write([[{1 => 2}]]).to_s.should == "\x91\x91\x81\x01\x02"
+    lambda { pk.write([[[[1]]]]) }.should raise_error(ArgumentError)
+    lambda { MessagePack.pack({1 => {2 => {3 => {}}}}, :max_depth => 3) }.should raise_error(ArgumentError)
+    pk.clear
+    pk.write([[[2]]]).to_s.should == "\x91\x91\x91\x02"
+  end
+
   it 'to_msgpack returns String' do
     nil.to_msgpack.class.should == String
     true.to_msgpack.class.should == String
@@ -0,0 +1,88 @@
+# encoding: ascii-8bit
+require 'spec_helper'
+
+describe MessagePack::StreamIndex do
+  let :objects do
+    [1, nil, 'abc'.force_encoding('UTF-8'), [1, [2, 3]], {'a' => {'b' => 'x' * 1000}}, -1.5, MessagePack::ExtType.new(1, 'e')]
+  end
+
+  let :data do
+    objects.map {|o| MessagePack.pack(o) }.join
+  end
+
+  it 'MessagePack.scan_offsets returns offsets of objects' do
+    offsets = []
+    pos = 0
+    objects.each {|o| offsets << pos; pos += MessagePack.pack(o).bytesize }
+    MessagePack.scan_offsets(data).should == offsets
+    MessagePack.scan_offsets('').should == []
+
+    buffer = MessagePack::Buffer.new
+    buffer << data[0, 5]
+    buffer << data[5..-1]
+    MessagePack.scan_offsets(buffer).should == offsets
+    buffer.size.should == data.bytesize
+  end
+
+  it 'MessagePack.scan_offsets ignores an incomplete object at the end' do
+    MessagePack.scan_offsets(data + "\x92\x01").size.should == objects.size
+    lambda { MessagePack.scan_offsets(data + "\xC1") }.should raise_error(MessagePack::MalformedFormatError)
+  end
+
+  it 'decodes objects at indexes' do
+    index = MessagePack::StreamIndex.new(data)
+    index.size.should == objects.size
+    index.empty?.should == false
+    objects.each_with_index {|o, i| index[i].should == o }
+    index[-1].should == objects[-1]
+    index[objects.size].should == nil
+    index.offset(0).should == 0
+    index.offset(objects.size).should == nil
+    index.offsets.should == MessagePack.scan_offsets(data)
+    index.end_offset.should == data.bytesize
+    index.source.frozen?.should == true
+  end
+
+  it 'iterates objects from an index' do
+    index = MessagePack::StreamIndex.new(data)
+    index.to_a.should == objects
+    index.each(3).to_a.should == objects[3..-1]
+    index.each(-2).to_a.should == objects[-2..-1]
+    index.each(objects.size).to_a.should == []
+
+    # the block can use the index
+    index.each(5).map {|o| [o, index[0]] }.should == [[-1.5, 1], [objects[6], 1]]
+  end
+
+  it 'deserializes objects with options' do
+    index = MessagePack::StreamIndex.new(MessagePack.pack({'a' => 1}) * 2, :symbolize_keys => true)
+    index.to_a.should == [{:a => 1}, {:a => 1}]
+  end
+
+  it 'is restored by dump and load' do
+    source = data + "\x92\x01"
+    index = MessagePack::StreamIndex.new(source)
+    dump = index.dump
+    dump.bytesize.should == (objects.size + 1) * 8
+
+    loaded = MessagePack::StreamIndex.load(source, dump)
+    loaded.offsets.should == index.offsets
+    loaded.end_offset.should == index.end_offset
+    loaded.to_a.should == objects
+
+    lambda { MessagePack::StreamIndex.load(source, dump[0, 7]) }.should raise_error(ArgumentError)
+    lambda { MessagePack::StreamIndex.load(source[0, 10], dump) }.should raise_error(ArgumentError)
+  end
+
+  it 'raises on an uninitialized index and reindexes on initialize' do
+    index = MessagePack::StreamIndex.allocate
+    index.size.should == 0
+    lambda { index.end_offset }.should raise_error(TypeError)
+
+    index.send(:initialize, data)
+    index.send(:initialize, MessagePack.pack(1) * 2)
+    index.offsets.should == [0, 1]
+    index.end_offset.should == 2
+    index.to_a.should == [1, 1]
+  end
+end
@@ -110,6 +110,68 @@ describe Unpacker do
     unpacker.read.should == 5
   end
 
+  it 'skip skips nested objects' do
+    obj = [1, {"a" => [2.5, nil, "x" * 300], "b" => {"c" => 2**63}}, MessagePack::ExtType.new(1, "ext"), "y" * 70000]
+    unpacker.feed(MessagePack.pack(obj) * 3 + MessagePack.pack(3))
+    unpacker.skip.should == nil
+    unpacker.read.should == obj
+    unpacker.skip
+    unpacker.read.should == 3
+  end
+
+  it 'skip continues after EOFError' do
+    obj = {"a" => [1, "x" * 300, {"b" => 2.5}], "c" => MessagePack::ExtType.new(1, "ext")}
+    data = MessagePack.pack(obj) + MessagePack.pack(7)
+    n = 0
+    begin
+      unpacker.feed(data[n])
+      n += 1
+      unpacker.skip
+    rescue EOFError
+      retry
+    end
+    n.should == data.size - 1
+    unpacker.feed(data[n..-1])
+    unpacker.read.should == 7
+  end
+
+  it 'skip finishes reading stopped by EOFError' do
+    data = MessagePack.pack([["zq" * 500, [1]]] * 100)
+    unpacker.feed(data[0, data.bytesize / 2])
+    lambda { unpacker.read }.should raise_error(EOFError)
+    unpacker.feed(data[data.bytesize / 2..-1])
+    unpacker.skip
+
+    unpacker.feed(MessagePack.pack([1, [2]]))
+    unpacker.read.should == [1, [2]]
+  end
+
+  it 'read finishes skipping stopped by EOFError' do
+    data = MessagePack.pack([[1, 2], "x" * 300])
+    unpacker.feed(data[0, 10])
+    lambda { unpacker.skip }.should raise_error(EOFError)
+    unpacker.feed(data[10..-1])
+    unpacker.feed(MessagePack.pack(5))
+    unpacker.read.should == 5
+  end
+
+  it 'skip reads data from io' do
+    obj = {"a" => ["x" * 3000] * 10}
+    unpacker = Unpacker.new(StringIO.new(MessagePack.pack(obj) + MessagePack.pack(1)), :io_buffer_size => 1024)
+    unpacker.skip
+    unpacker.read.should == 1
+  end
+
+  it 'skip does not allocate objects' do
+    data = MessagePack.pack([{"a" => [1.5, 2**63, "x" * 300]}] * 100)
+    unpacker.feed(data)
+    unpacker.skip
+    unpacker.feed(data)
+    before = GC.stat(:total_allocated_objects)
+    unpacker.skip
+    (GC.stat(:total_allocated_objects) - before < 10).should == true
+  end
+
   it 'read raises EOFError' do
     lambda {
       unpacker.read
@@ -159,6 +221,376 @@ describe Unpacker do
     objects.should == [sample_object] * 4
   end
 
+  it 'read_many returns buffered objects up to max' do
+    unpacker.feed([1, "a", [2], {"b" => 3}, nil].map {|o| MessagePack.pack(o) }.join + "\x92\x01")
+    unpacker.read_many(3).should == [1, "a", [2]]
+    unpacker.read_many(0).should == []
+    unpacker.read_many(10).should == [{"b" => 3}, nil]
+    unpacker.read_many(10).should == []
+    unpacker.feed("\x02")
+    unpacker.read_many(10).should == [[1, 2]]
+    lambda { unpacker.read_many(-1) }.should raise_error(ArgumentError)
+  end
+
+  it 'read_many does not read the io' do
+    io = StringIO.new(MessagePack.pack(1) + MessagePack.pack(2))
+    unpacker = Unpacker.new(io)
+    unpacker.read_many(10).should == []
+    unpacker.read.should == 1
+    unpacker.read_many(10).should == [2]
+    unpacker.read_many(10).should == []
+    io.eof?.should == true
+  end
+
+  it 'read_columns reads an array of maps into columns' do
+    rows = [{"ts" => 1, "v" => [2.5]}, {"v" => nil, "ts" => 2}, {}, {"ts" => 4, "w" => "x"}, {"ts" => 5}]
+    expected = {"ts" => [1, 2, nil, 4, 5], "v" => [[2.5], nil, nil, nil, nil], "w" => [nil, nil, nil, "x", nil]}
+    raw = MessagePack.pack(rows)
+
+    unpacker.feed(raw + MessagePack.pack(1))
+    unpacker.read_columns.should == expected
+    unpacker.read.should == 1
+
+    columns = nil
+    raw.split(//).each do |b|
+      unpacker.feed(b)
+      begin
+        columns = unpacker.read_columns
+      rescue EOFError
+      end
+    end
+    columns.should == expected
+    columns.keys.map {|k| k.frozen? }.should == [true, true, true]
+
+    MessagePack.unpack_columnar(raw).should == expected
+    MessagePack.unpack_columnar(MessagePack.pack([])).should == {}
+    MessagePack.unpack_columnar(raw, :symbolize_keys => true).should == {:ts => expected["ts"], :v => expected["v"], :w => expected["w"]}
+    MessagePack.unpack_columnar(StringIO.new(raw), :freeze => true).values.map {|c| c.frozen? }.should == [true, true, true]
+
+    lambda { MessagePack.unpack_columnar(MessagePack.pack({"a" => 1})) }.should raise_error(MessagePack::TypeError)
+    lambda { MessagePack.unpack_columnar(MessagePack.pack([{"a" => 1}, 2])) }.should raise_error(MessagePack::TypeError)
+  end
+
+  it 'unpack_without_gvl deserializes objects as unpack does' do
+    objects = [
+      nil, true, false, 0, -1, 127, 128, -33, 2**16, -2**31, 2**64-1, -2**63, 1.5, 2.0**70,
+      "", "a", "\xE3\x81\x82" * 100, "x".b * 300, [], {}, [[1, [2, {}]], {"k" => [nil]}],
+      {"a" => 1, "b" => {"c" => ["d", 2.5]}, 1 => 2, nil => []},
+      (1..100).map {|i| {"id" => i, "name" => "n#{i}" * i} },
+      MessagePack::ExtType.new(1, "ext"),
+    ]
+    objects.each do |obj|
+      raw = MessagePack.pack(obj)
+      MessagePack.unpack_without_gvl(raw).should == MessagePack.unpack(raw)
+    end
+
+    # long enough to release the GVL
+    obj = (1..4000).map {|i| [i, "v#{i}", {"k" => i.to_f}] }
+    raw = MessagePack.pack(obj)
+    MessagePack.unpack_without_gvl(raw).should == obj
+
+    raw = MessagePack.pack("\xE3\x81\x82".force_encoding("UTF-8"))
+    MessagePack.unpack_without_gvl(raw).encoding.should == Encoding::UTF_8
+    MessagePack.unpack_without_gvl(MessagePack.pack("x".b)).encoding.should == Encoding::BINARY
+  end
+
+  it 'unpack_without_gvl deserializes fixed-width formats as unpack does' do
+    raws = [
+      "\xC0", "\xC2", "\xC3", "\x00", "\x7F", "\xE0", "\xFF",
+      "\xCA" + [1.5].pack("g"), "\xCA" + [-0.1].pack("g"),
+      "\xCB" + [1.5].pack("G"), "\xCB" + [-0.1].pack("G"),
+      "\xCC\xFF", "\xCD\xFF\xFE", "\xCE\xFF\xFE\xFD\xFC", "\xCF\xFF\xFE\xFD\xFC\xFB\xFA\xF9\xF8",
+      "\xD0\x80", "\xD1\x80\x01", "\xD2\x80\x00\x00\x01", "\xD3\x80\x00\x00\x00\x00\x00\x00\x01",
+      "\xD4\x01a", "\xD5\x01ab", "\xD6\x01abcd", "\xD7\x01abcdefgh", "\xD8\x01abcdefghijklmnop",
+    ]
+    raws.each do |raw|
+      MessagePack.unpack_without_gvl(raw).should == MessagePack.unpack(raw)
+      MessagePack.unpack_without_gvl("\x91" + raw).should == MessagePack.unpack("\x91" + raw)
+    end
+    MessagePack.unpack_without_gvl("\xCA" + [1.5].pack("g")).should == 1.5
+  end
+
+  it 'unpack_without_gvl calls exttypes in the order of the source' do
+    calls = []
+    Unpacker.register_exttype(92) {|nr, data| calls << data; data }
+    exts = ("a".."f").map {|c| MessagePack::ExtType.new(92, c) }
+    raw = MessagePack.pack([exts[0], {exts[1] => [exts[2], exts[3]]}, [[exts[4]]], exts[5]])
+
+    MessagePack.unpack(raw)
+    order = calls.dup
+    calls.clear
+    MessagePack.unpack_without_gvl(raw).should == ["a", {"b" => ["c", "d"]}, [["e"]], "f"]
+    calls.should == order
+    order.should == ["a", "b", "c", "d", "e", "f"]
+  end
+
+  it 'unpack_without_gvl observes options' do
+    raw = MessagePack.pack([{"a" => "b"}, {"a" => "c"}])
+    MessagePack.unpack_without_gvl(raw, :symbolize_keys => true).should == [{:a => "b"}, {:a => "c"}]
+    frozen = MessagePack.unpack_without_gvl(raw, :freeze => true)
+    frozen.frozen?.should == true
+    frozen[0].frozen?.should == true
+    frozen[0]["a"].frozen?.should == true
+    MessagePack.unpack_without_gvl(raw).map {|h| h.keys[0] }.map {|k| k.frozen? }.should == [true, true]
+
+    lambda { MessagePack.unpack_without_gvl(MessagePack.pack("\xFF".force_encoding("UTF-8")), :validate_utf8 => true) }.should raise_error(MessagePack::MalformedFormatError)
+    lambda { MessagePack.unpack_without_gvl(MessagePack.pack([[[1]]]), :max_depth => 2) }.should raise_error(MessagePack::StackError)
+    lambda { MessagePack.unpack_without_gvl(MessagePack.pack([1, 2]), :max_array_size => 1) }.should raise_error(MessagePack::UnpackError)
+    lambda { MessagePack.unpack_without_gvl(MessagePack.pack([1, 2])[0, 2]) }.should raise_error(EOFError)
+    lambda { MessagePack.unpack_without_gvl(MessagePack.pack([1]) + "\xC0") }.should raise_error(MessagePack::MalformedFormatError)
+    lambda { MessagePack.unpack_without_gvl("\xC1") }.should raise_error(MessagePack::MalformedFormatError)
+  end
+
+  it 'unpack_at deserializes an object at an offset and returns the next offset' do
+    objects = [1, "a" * 300, {"k" => [nil, 2.5]}, "x" * 10000, [], -1]
+    raw = objects.map {|o| MessagePack.pack(o) }.join
+
+    offset = 0
+    result = []
+    while offset < raw.bytesize
+      obj, offset = MessagePack.unpack_at(raw, offset)
+      result << obj
+    end
+    result.should == objects
+    offset.should == raw.bytesize
+
+    MessagePack.unpack_at(raw, 0).should == [1, 1]
+    MessagePack.unpack_at(raw[0, 1 + MessagePack.pack("a" * 300).bytesize], 1)[1].should == 1 + MessagePack.pack("a" * 300).bytesize
+    MessagePack.unpack_at(MessagePack.pack({"a" => 1}) * 2, 5, :symbolize_keys => true).should == [{:a => 1}, 10]
+
+    lambda { MessagePack.unpack_at(raw, raw.bytesize) }.should raise_error(EOFError)
+    last = raw.bytesize - MessagePack.pack(-1).bytesize - MessagePack.pack([]).bytesize - MessagePack.pack("x" * 10000).bytesize
+    lambda { MessagePack.unpack_at(raw[0, last + 5000], last) }.should raise_error(EOFError)
+    lambda { MessagePack.unpack_at(raw, raw.bytesize + 1) }.should raise_error(ArgumentError)
+    lambda { MessagePack.unpack_at(raw, -1) }.should raise_error(ArgumentError)
+    lambda { MessagePack.unpack_at("\x01\xC1", 1) }.should raise_error(MessagePack::MalformedFormatError)
+  end
+
+  it 'feed_reference appends data without copying it' do
+    objects = [1, "a" * 300, {"k" => [nil, 2.5]}, "x" * 10000]
+    raw = objects.map {|o| MessagePack.pack(o) }.join
+
+    unpacker.feed_reference(raw).should == unpacker
+    unpacker.read.should == 1
+    unpacker.feed("\x92\x01")
+    unpacker.feed_reference(MessagePack.pack(2))
+    result = []
+    unpacker.each {|o| result << o }
+    result.should == objects[1..-1] + [[1, 2]]
+
+    big = MessagePack.pack("x" * 10000)
+    unpacker.feed_reference(big[0, 5000])
+    lambda { unpacker.read }.should raise_error(EOFError)
+    unpacker.feed_reference(big[5000..-1])
+    unpacker.read.should == "x" * 10000
+  end
+
+  it 'valid? and validate check data without deserializing it' do
+    [nil, 1, -1, 1.5, 'a' * 300, ['a', [1, {}], []], {'a' => {'b' => [nil, true]}}, MessagePack::ExtType.new(1, 'x' * 70000)].each do |obj|
+      raw = MessagePack.pack(obj)
+      MessagePack.valid?(raw).should == true
+      MessagePack.validate(raw).should == nil
+      MessagePack.valid?(raw[0, raw.bytesize - 1]).should == false
+    end
+
+    raw = MessagePack.pack([1, {'a' => 2}])
+    MessagePack.validate(raw[0, 6]).should == 6   # truncated value of the map
+    MessagePack.validate(raw[0, 4]).should == 3   # truncated key
+    MessagePack.validate("\x92\x01\xC1").should == 2
+    MessagePack.validate('').should == 0
+    MessagePack.validate(raw + "\x01").should == raw.bytesize
+    MessagePack.validate(raw + "\x01", :multiple => true).should == nil
+    MessagePack.validate(raw + "\x92", :multiple => true).should == raw.bytesize + 1
+
+    MessagePack.valid?(MessagePack.pack([[[1]]]), :max_depth => 2).should == false
+    MessagePack.valid?(MessagePack.pack([[[]]]), :max_depth => 2).should == true
+    MessagePack.valid?("\x91" * 1000 + "\x01").should == false
+    MessagePack.valid?("\x91" * 1000 + "\x01", :max_depth => 1000).should == true
+    MessagePack.valid?("\x91" * 1000 + "\x01", :max_depth => 2**50).should == true
+    MessagePack.valid?("\x91" * 1000 + "\x01", :max_depth => 999).should == false
+    MessagePack.validate(MessagePack.pack([1, [1, 2]]), :max_array_size => 1).should == 0
+    MessagePack.validate(MessagePack.pack(['a', 'bc']), :max_str_size => 1).should == 4
+    MessagePack.valid?(MessagePack.pack({1 => 2}), :max_map_size => 0).should == false
+
+    invalid = MessagePack.pack(["\xFF".force_encoding('UTF-8')])
+    MessagePack.valid?(invalid).should == true
+    MessagePack.validate(invalid, :validate_utf8 => true).should == 1
+    MessagePack.valid?(MessagePack.pack(["\xE3\x81\x82".force_encoding('UTF-8')]), :validate_utf8 => true).should == true
+
+    data = MessagePack.pack([{"a" => [1.5, 2**63, "x" * 300]}] * 100)
+    MessagePack.valid?(data)
+    before = GC.stat(:total_allocated_objects)
+    MessagePack.valid?(data)
+    (GC.stat(:total_allocated_objects) - before < 10).should == true
+  end
+
+  class ShapedPoint
+    attr_reader :x, :y
+  end
+
+  ShapedRecord = Struct.new(:id, :name, :tags)
+
+  it 'register_shape builds objects from maps with the keys' do
+    unpacker.register_shape(ShapedPoint, :keys => [:x, "y"])
+    unpacker.register_shape(ShapedRecord)
+    maps = [{"x" => 1, "y" => [2]}, {"y" => 3, "x" => 4}, {"x" => 1}, {"x" => 1, "y" => 2, "z" => 3}]
+    unpacker.feed("\x95" + maps.map {|m| MessagePack.pack(m) }.join + "\x82\xa1x\x01\xa1x\x02")
+    unpacker.feed(MessagePack.pack({"tags" => {"x" => 5, "y" => 6}, "id" => 1, "name" => "a"}))
+
+    points = unpacker.read
+    points[0].class.should == ShapedPoint
+    [points[0].x, points[0].y].should == [1, [2]]
+    [points[1].x, points[1].y].should == [4, 3]
+    points[2].should == {"x" => 1}
+    points[3].should == {"x" => 1, "y" => 2, "z" => 3}
+    points[4].should == {"x" => 2}
+
+    record = unpacker.read
+    record.class.should == ShapedRecord
+    [record.id, record.name].should == [1, "a"]
+    [record.tags.x, record.tags.y].should == [5, 6]
+
+    unpacker = Unpacker.new(:symbolize_keys => true, :freeze => true)
+    unpacker.register_shape(ShapedRecord, :keys => [:id, :name])
+    unpacker.feed(MessagePack.pack({"name" => "b", "id" => 2}))
+    record = unpacker.read
+    record.should == ShapedRecord.new(2, "b", nil)
+    record.frozen?.should == true
+
+    lambda { unpacker.register_shape(ShapedPoint) }.should raise_error(ArgumentError)
+    lambda { unpacker.register_shape(Integer, :keys => [:x]) }.should raise_error(TypeError)
+    lambda { unpacker.register_shape(ShapedRecord, :keys => [:id, :x]) }.should raise_error(ArgumentError)
+    lambda { unpacker.register_shape(ShapedPoint, :keys => ["a-b"]) }.should raise_error(NameError)
+  end
+
+  it 'each_batch yields Arrays of objects' do
+    raw = (1..7).map {|i| MessagePack.pack([i]) }.join
+    batches = []
+    raw.split(//).each do |b|
+      unpacker.feed(b)
+      unpacker.each_batch(3) {|ary| batches << ary }
+    end
+    batches.flatten(1).should == (1..7).map {|i| [i] }
+
+    unpacker.feed(raw)
+    unpacker.each_batch(3).to_a.should == [[[1], [2], [3]], [[4], [5], [6]], [[7]]]
+
+    unpacker = Unpacker.new(StringIO.new(raw), :io_buffer_size => 4)
+    unpacker.each_batch(2).map {|ary| ary.size }.should == [2, 2, 2, 1]
+
+    lambda { unpacker.each_batch(0) {|ary| } }.should raise_error(ArgumentError)
+
+    # batches larger than the initial capacity grow as objects are read
+    unpacker = Unpacker.new
+    unpacker.feed(MessagePack.pack(1) * 3000)
+    unpacker.each_batch(2000).map {|ary| ary.size }.should == [2000, 1000]
+    unpacker.feed(raw)
+    unpacker.each_batch(2**40).to_a.should == [(1..7).map {|i| [i] }]
+  end
+
+  it 'feed_each reads large data without copying it' do
+    objs = [{"a" => "x" * 5000}, ["y" * 300, 1], "z" * 10000]
+    raw = objs.map {|o| MessagePack.pack(o) }.join
+    results = []
+    raw.scan(/.{1,4500}/m).each do |chunk|
+      unpacker.feed_each(chunk) {|obj| results << obj }
+      chunk.replace("\xc1" * chunk.size)
+    end
+    results.should == objs
+
+    data = raw.dup
+    unpacker.feed_each(data) {|obj| data.replace("\xc1" * 10); obj.should == objs.shift }
+    objs.should == []
+    unpacker.buffer.size.should == 0
+  end
+
+  it 'each_event yields tokens without building containers' do
+    packer = MessagePack::Packer.new
+    packer.write([1, {"k" => [nil, true]}, [], {}])
+    packer.write("s".force_encoding('UTF-8'))
+    packer.write(MessagePack::ExtType.new(1, "ab"))
+    raw = packer.to_s
+    expected = [
+      [:array_start, 4],
+        [:value, 1],
+        [:map_start, 1],
+          [:value, "k"],
+          [:array_start, 2], [:value, nil], [:value, true], [:end],
+        [:end],
+        [:array_start, 0], [:end],
+        [:map_start, 0], [:end],
+      [:end],
+      [:value, "s"],
+      [:ext, 1, "ab"],
+    ]
+
+    unpacker.feed(raw)
+    unpacker.each_event.to_a.should == expected
+
+    events = []
+    raw.split(//).each do |b|
+      unpacker.feed(b)
+      unpacker.each_event {|e| events << e }
+    end
+    events.should == expected
+
+    Unpacker.new(StringIO.new(raw)).each_event.to_a.should == expected
+  end
+
+  it 'read deserializes registered types after each_event raised' do
+    io = Object.new
+    reads = 0
+    io.define_singleton_method(:readpartial) do |*args|
+      reads += 1
+      raise IOError, "broken" if reads > 1
+      "\x01"
+    end
+
+    unpacker = Unpacker.new(io)
+    unpacker.register_exttype(1) {|type, data| "ext:#{data}" }
+    events = []
+    lambda { unpacker.each_event {|e| events << e } }.should raise_error(IOError)
+    events.should == [[:value, 1]]
+
+    unpacker.feed(MessagePack.pack(MessagePack::ExtType.new(1, "ab")))
+    unpacker.read.should == "ext:ab"
+  end
+
+  it 'read and each_event raise when switched in the middle of an object' do
+    unpacker.feed(MessagePack.pack([1, 2, 3]))
+    events = []
+    unpacker.each_event {|e| events << e; break if events.size == 2 }
+    events.should == [[:array_start, 3], [:value, 1]]
+    lambda { unpacker.read }.should raise_error(MessagePack::UnpackError)
+    unpacker.each_event.to_a.should == [[:value, 2], [:value, 3], [:end]]
+
+    data = MessagePack.pack([[1, 2], 3])
+    unpacker.feed(data[0, 3])
+    lambda { unpacker.read }.should raise_error(EOFError)
+    lambda { unpacker.each_event {|e| } }.should raise_error(MessagePack::UnpackError)
+    unpacker.feed(data[3..-1])
+    unpacker.read.should == [[1, 2], 3]
+    unpacker.feed(MessagePack.pack([4]))
+    unpacker.each_event.to_a.should == [[:array_start, 1], [:value, 4], [:end]]
+  end
+
+  it 'each_event symbolizes map keys and checks limits' do
+    unpacker = Unpacker.new(:symbolize_keys => true)
+    unpacker.feed(MessagePack.pack({"a" => "b", "c" => {"d" => 1}}))
+    unpacker.each_event.to_a.should == [
+      [:map_start, 2], [:value, :a], [:value, "b"],
+      [:value, :c], [:map_start, 1], [:value, :d], [:value, 1], [:end], [:end]
+    ]
+
+    unpacker = Unpacker.new(:max_depth => 2)
+    unpacker.feed(MessagePack.pack([[[1]]]))
+    lambda { unpacker.each_event {|e| } }.should raise_error(MessagePack::StackError)
+
+    unpacker = Unpacker.new(:max_array_size => 2)
+    unpacker.feed(MessagePack.pack([1, 2, 3]))
+    lambda { unpacker.each_event {|e| } }.should raise_error(MessagePack::LimitError)
+  end
+
   it 'reset clears internal buffer' do
     # 1-element array
     unpacker.feed("\x91")
@@ -215,6 +647,55 @@ describe Unpacker do
     }.should raise_error(MessagePack::StackError)
   end
 
+  it 'max_depth grows the stack up to the limit' do
+    512.times { packer.write_array_header(1) }
+    packer.write(nil)
+    raw = packer.to_s
+
+    unpacker = Unpacker.new(:max_depth => 512)
+    unpacker.feed(raw)
+    obj = unpacker.read
+    511.times { obj = obj[0] }
+    obj.should == [nil]
+
+    unpacker = Unpacker.new(:max_depth => 511)
+    unpacker.feed(raw)
+    lambda { unpacker.read }.should raise_error(MessagePack::StackError)
+
+    lambda { Unpacker.new(:max_depth => 0) }.should raise_error(ArgumentError)
+  end
+
+  it 'size limits reject declared sizes before reading bodies' do
+    {
+      :max_array_size => ["\xdd\xff\xff\xff\xff", [1, 2, 3]],
+      :max_map_size => ["\xdf\xff\xff\xff\xff", {1 => 2, 3 => 4, 5 => 6}],
+      :max_str_size => ["\xdb\xff\xff\xff\xff", "abc".force_encoding('UTF-8')],
+      :max_ext_size => ["\xc9\xff\xff\xff\xff\x01", MessagePack::ExtType.new(1, "abc")],
+    }.each_pair do |name, (huge, ok)|
+      lambda { MessagePack.unpack(huge, name => 3) }.should raise_error(MessagePack::LimitError)
+      MessagePack.unpack(MessagePack.pack(ok), name => 3).should == ok
+      lambda { MessagePack.unpack(MessagePack.pack([ok, ok]), name => 2) }.should raise_error(MessagePack::LimitError)
+    end
+    lambda { MessagePack.unpack("\xc6\x00\x00\x00\x04abcd", :max_str_size => 3) }.should raise_error(MessagePack::LimitError)
+    lambda { Unpacker.new(:max_str_size => -1) }.should raise_error(ArgumentError)
+  end
+
+  it 'size limits apply to read_array_header and read_map_header' do
+    unpacker = Unpacker.new(:max_array_size => 2, :max_map_size => 2)
+    unpacker.feed("\x93\x83")
+    lambda { unpacker.read_array_header }.should raise_error(MessagePack::LimitError)
+    lambda { unpacker.read_map_header }.should raise_error(MessagePack::LimitError)
+  end
+
+  it 'max_buffer_size limits data buffered by feed' do
+    unpacker = Unpacker.new(:max_buffer_size => 8)
+    unpacker.feed("\xa3abc")
+    lambda { unpacker.feed("\xa5abcde") }.should raise_error(MessagePack::LimitError)
+    unpacker.read.should == "abc"
+    unpacker.feed_each("\xa5abcde\xa1x") {|obj| obj.should_not == nil }
+    lambda { unpacker.feed_each("\xa8abcdefgh") {|obj| } }.should raise_error(MessagePack::LimitError)
+  end
+
   it 'read raises invalid byte error' do
     unpacker.feed("\xc1")
     lambda {
@@ -285,6 +766,232 @@ describe Unpacker do
     unpacker.feed(MessagePack.pack(symbolized_hash)).read.should == symbolized_hash
   end
 
+  it 'validate_utf8 accepts valid strings' do
+    unpacker = Unpacker.new(:validate_utf8 => :raise)
+    src = ["ascii", "\xE3\x81\x82", ""].map {|s| s.force_encoding('UTF-8') }
+    unpacker.feed(MessagePack.pack(src))
+    strs = unpacker.read
+    strs.should == src
+    strs.map {|s| s.encoding }.uniq.should == [Encoding::UTF_8]
+    strs.map {|s| s.valid_encoding? }.uniq.should == [true]
+  end
+
+  it 'validate_utf8 raises on invalid strings' do
+    unpacker = Unpacker.new(:validate_utf8 => :raise)
+    unpacker.feed([0xa2, 0xc3, 0x28].pack('C*'))
+    lambda {
+      unpacker.read
+    }.should raise_error(MessagePack::MalformedFormatError)
+  end
+
+  it 'validate_utf8 rejects overlong forms and surrogates' do
+    ["\xC0\xAF", "\xE0\x80\xAF", "\xED\xA0\x80", "\xF4\x90\x80\x80", "\xE3\x81"].each do |bytes|
+      lambda {
+        MessagePack.unpack([0xa0 | bytes.size].pack('C') + bytes, :validate_utf8 => :raise)
+      }.should raise_error(MessagePack::MalformedFormatError)
+    end
+  end
+
+  it 'validate_utf8 :binary returns invalid strings as ASCII-8BIT' do
+    str = MessagePack.unpack([0xa2, 0xc3, 0x28].pack('C*'), :validate_utf8 => :binary)
+    str.should == "\xC3\x28"
+    str.encoding.should == Encoding::ASCII_8BIT
+  end
+
+  it 'validate_utf8 :scrub replaces invalid bytes' do
+    str = MessagePack.unpack([0xa3, 0x61, 0xff, 0x62].pack('C*'), :validate_utf8 => :scrub)
+    str.should == "a\uFFFDb"
+    str.encoding.should == Encoding::UTF_8
+  end
+
+  it 'validate_utf8 checks map keys and strings split across feeds' do
+    long = "\xE3\x81\x82".force_encoding('UTF-8') * 1000
+    raw = MessagePack.pack({"k".force_encoding('UTF-8') => long})
+    unpacker = Unpacker.new(:validate_utf8 => :raise)
+    raw.split(//).each {|b| unpacker.feed(b) }
+    unpacker.read.should == {"k" => long}
+
+    lambda {
+      MessagePack.unpack([0x81, 0xa1, 0xff, 0x01].pack('C*'), :validate_utf8 => :raise)
+    }.should raise_error(MessagePack::MalformedFormatError)
+    MessagePack.unpack([0x81, 0xa1, 0xff, 0x01].pack('C*'), :validate_utf8 => :scrub).should == {"\uFFFD" => 1}
+  end
+
+  it 'validate_utf8 rejects unknown modes' do
+    lambda {
+      Unpacker.new(:validate_utf8 => :ignore)
+    }.should raise_error(ArgumentError)
+  end
+
+  it 'key_cache returns the same frozen String for repeated map keys' do
+    unpacker = Unpacker.new(:key_cache => true)
+    unpacker.feed(MessagePack.pack({"a" => 1, "k" * 65 => 2}) * 2)
+    h1 = unpacker.read
+    h2 = unpacker.read
+    h1.should == {"a" => 1, "k" * 65 => 2}
+    h1.keys[0].frozen?.should == true
+    h1.keys[0].equal?(h2.keys[0]).should == true
+    h1.keys[1].equal?(h2.keys[1]).should == false
+  end
+
+  it 'key_cache distinguishes str and bin keys' do
+    unpacker = Unpacker.new(:key_cache => true)
+    unpacker.feed("\x81\xa1a\x01\x81\xc4\x01a\x02")
+    unpacker.read.keys[0].encoding.should == Encoding::UTF_8
+    unpacker.read.keys[0].encoding.should == Encoding::ASCII_8BIT
+  end
+
+  it 'key_cache validates UTF-8 of keys' do
+    unpacker = Unpacker.new(:key_cache => true, :validate_utf8 => :scrub)
+    unpacker.feed("\x81\xa1\xff\x01" * 2)
+    unpacker.read.keys[0].should == "\uFFFD".force_encoding('UTF-8')
+    unpacker.read.keys[0].should == "\uFFFD".force_encoding('UTF-8')
+
+    unpacker = Unpacker.new(:key_cache => true, :validate_utf8 => :raise)
+    unpacker.feed("\x81\xa1\xff\x01")
+    lambda { unpacker.read }.should raise_error(MessagePack::MalformedFormatError)
+  end
+
+  it 'key_cache returns the same key objects across reads' do
+    data = MessagePack.pack({"key1" => 1, "key2" => 2, "key3" => 3}) * 100
+    [false, true].each do |cache|
+      objs = []
+      Unpacker.new(:key_cache => cache).feed_each(data) {|obj| objs << obj }
+      objs.size.should == 100
+      keys = objs[0].keys
+      objs.all? {|obj| obj.keys.zip(keys).all? {|a, b| a.equal?(b) } }.should == cache
+    end
+  end
+
+  it 'symbolize_keys returns Symbols for str, bin and long keys' do
+    long_key = "k" * 65
+    data = MessagePack.pack({"a" => 1, long_key => 2}) + "\x81\xc4\x01a\x03" + "\x81\xa3\xe3\x81\x82\x04"
+    expected = [{:a => 1, long_key.to_sym => 2}, {:a => 3}, {"\xe3\x81\x82".force_encoding('UTF-8').to_sym => 4}]
+    [true, false].each do |cache|
+      unpacker = Unpacker.new(:symbolize_keys => true, :key_cache => cache)
+      unpacker.feed_each(data) {|obj| }
+      objs = []
+      unpacker.feed_each(data * 2) {|obj| objs << obj }
+      objs.should == expected * 2
+      objs[0].keys[0].should == :a
+      MessagePack.unpack(data[0, data.size - 11], :symbolize_keys => true).should == expected[0]
+    end
+  end
+
+  it 'symbolize_keys creates Symbols of new keys' do
+    key = "symbolize_keys_new_key_#{rand(1 << 30)}"
+    MessagePack.unpack(MessagePack.pack({key => 1}), :symbolize_keys => true).keys[0].to_s.should == key
+    unpacker = Unpacker.new(:symbolize_keys => true)
+    unpacker.feed(MessagePack.pack({key + "x" => 1}) * 2)
+    unpacker.read.keys[0].should == (key + "x").to_sym
+    unpacker.read.keys[0].should == (key + "x").to_sym
+  end
+
+  it 'symbolize_keys reuses Symbols without allocating Strings' do
+    :symbolize_keys_existing_key
+    unpacker = Unpacker.new(:symbolize_keys => true)
+    unpacker.feed((MessagePack.pack({"symbolize_keys_existing_key" => 1}) + MessagePack.pack({1 => 1})) * 2)
+    counts = 4.times.map do
+      before = GC.stat(:total_allocated_objects)
+      unpacker.read
+      GC.stat(:total_allocated_objects) - before
+    end
+    # after warming up, a map with a Symbol key allocates as much as one with an Integer key
+    counts[2].should == counts[3]
+  end
+
+  it 'builds nested containers larger than the embedded value stack' do
+    obj = {"a" => (1..100).to_a, "b" => Hash[(1..100).map {|i| ["k#{i}", [i, {"x" => i}]] }], "c" => [[], {}, [[1]]]}
+    raw = MessagePack.pack([obj, obj])
+    MessagePack.unpack(raw).should == [obj, obj]
+    unpacker = Unpacker.new
+    raw.split(//).each {|b| unpacker.feed(b) }
+    unpacker.read.should == [obj, obj]
+  end
+
+  it 'keeps the last value of duplicated map keys' do
+    MessagePack.unpack("\x83\xa1a\x01\xa1b\x02\xa1a\x03").should == {"a" => 3, "b" => 2}
+    MessagePack.unpack("\x82\xa1a\x01\xa1a\x02", :symbolize_keys => true).should == {:a => 2}
+  end
+
+  it 'keeps values being read alive across GC' do
+    obj = [Hash[(1..20).map {|i| ["k#{i}", "v#{i}"] }], (1..20).map {|i| "e#{i}" }]
+    raw = MessagePack.pack(obj)
+    unpacker = Unpacker.new
+    begin
+      GC.stress = true
+      raw.split(//).each {|b| unpacker.feed(b); unpacker.each {|o| @o = o } }
+    ensure
+      GC.stress = false
+    end
+    @o.should == obj
+  end
+
+  def each_object(obj, &block)
+    yield obj
+    case obj
+    when Array
+      obj.each {|e| each_object(e, &block) }
+    when Hash
+      obj.each_pair {|k, v| each_object(k, &block); each_object(v, &block) }
+    when MessagePack::ExtType
+      each_object(obj.data, &block)
+    end
+  end
+
+  it 'freeze returns deeply frozen objects' do
+    obj = {"a" => ["str".force_encoding('UTF-8'), "bin", [], {}, 1.5, nil], "b" => {"c" => [1, ["x" * 300]]}, "" => ""}
+    raw = MessagePack.pack(obj) + MessagePack.pack([MessagePack::ExtType.new(1, "payload")])
+
+    unpacker = Unpacker.new(:freeze => true)
+    raw.split(//).each {|b| unpacker.feed(b) }
+    results = [unpacker.read, unpacker.read, MessagePack.unpack(MessagePack.pack(obj), :freeze => true)]
+    results[0].should == obj
+    results[1].should == [MessagePack::ExtType.new(1, "payload")]
+    results[2].should == obj
+    [results[0], results[2]].each do |result|
+      each_object(result) {|o| o.frozen?.should == true }
+      Ractor.shareable?(result).should == true if defined?(Ractor)
+    end
+    results[1].frozen?.should == true
+
+    MessagePack.unpack(MessagePack.pack(obj))["a"].frozen?.should == false
+  end
+
+  it 'freeze leaves payloads and results of extended types as they are' do
+    cached = "cached"
+    unpacker = Unpacker.new(:freeze => true)
+    unpacker.register_exttype(1) {|nr, data| data.force_encoding("UTF-8") }
+    unpacker.register_exttype(2) {|nr, data| cached }
+    unpacker.feed(MessagePack.pack([MessagePack::ExtType.new(1, "a"), MessagePack::ExtType.new(2, "b")]))
+    result = unpacker.read
+    result.should == ["a", "cached"]
+    result.frozen?.should == true
+    result[0].encoding.should == Encoding::UTF_8
+    result[0].frozen?.should == false
+    cached.frozen?.should == false
+  end
+
+  it 'bignum_exttype decodes Integers beyond 64-bit' do
+    values = [2**64, -(2**63) - 1, 2**128 + 1, -(2**256), 1, -1]
+    raw = values.map {|v| MessagePack.pack(v, :bignum_exttype => 1) }.join
+    unpacker = Unpacker.new(:bignum_exttype => 1)
+    raw.split(//).each {|b| unpacker.feed(b) }
+    unpacker.each.to_a.should == values
+  end
+
+  it 'bignum_exttype rejects malformed payload' do
+    lambda {
+      MessagePack.unpack([0xd4, 0x01, 0x02].pack('C*'), :bignum_exttype => 1)
+    }.should raise_error(MessagePack::MalformedFormatError)
+  end
+
+  it 'bignum exttype is unpacked as ExtType without bignum_exttype option' do
+    obj = MessagePack.unpack(MessagePack.pack(2**64, :bignum_exttype => 1))
+    obj.class.should == MessagePack::ExtType
+    obj.type.should == 1
+  end
+
   it "msgpack str 8 type" do
     MessagePack.unpack([0xd9, 0x00].pack('C*')).should == ""
     MessagePack.unpack([0xd9, 0x00].pack('C*')).encoding.should == Encoding::UTF_8
@@ -461,5 +1168,65 @@ describe Unpacker do
     unpacker.feed("\xD5Yyy").unpack.should == {89 => "yy"}
   end
 
+  it "should apply exttypes registered after reading extended types" do
+    Unpacker.default_exttype = false
+    lambda{ unpacker.feed("\xD5Zab").unpack }.should raise_error(MessagePack::UnpackError)
+    Unpacker.register_exttype(90) { |nr, data| [:class, data] }
+    unpacker.feed("\xD5Zab").unpack.should == [:class, "ab"]
+    unpacker.register_exttype(90) { |nr, data| [:instance, data] }
+    unpacker.feed("\xD5Zab").unpack.should == [:instance, "ab"]
+    unpacker.register_exttype(90, nil)
+    unpacker.feed("\xD5Zab").unpack.should == [:class, "ab"]
+    callable = Object.new
+    def callable.call(nr, data); [:callable, data]; end
+    unpacker.register_exttype(90, callable)
+    unpacker.feed("\xD5Zab").unpack.should == [:callable, "ab"]
+    block = proc { |nr, data| [:proc, data] }
+    def block.call(nr, data); [:singleton, data]; end
+    unpacker.register_exttype(90, block)
+    unpacker.feed("\xD5Zab").unpack.should == [:singleton, "ab"]
+  end
+
+  it "should pass extended type payloads as shared frozen Strings" do
+    payload = "x" * 5000
+    data = MessagePack.pack(ExtType.new(91, payload)) + MessagePack.pack(ExtType.new(91, "ab"))
+    unpacker.register_exttype(91, :payload => :shared) { |nr, data| data }
+    results = []
+    unpacker.feed_each(data) {|obj| results << obj }
+    results.should == [payload, "ab"]
+    results.each {|s| s.frozen?.should == true }
+    results.each {|s| s.encoding.should == Encoding::BINARY }
+  end
+
+  it "should pass extended type payloads as Buffers" do
+    payload = "y" * 10000
+    data = MessagePack.pack(ExtType.new(92, payload))
+    unpacker.register_exttype(92, :payload => :buffer) { |nr, data| data }
+    buffer = nil
+    unpacker.feed_each(data) {|obj| buffer = obj }
+    buffer.class.should == MessagePack::Buffer
+    buffer.size.should == payload.size
+    buffer.read_all.should == payload
+  end
+
+  it "should pass extended type payloads as Buffers when fed in pieces" do
+    payload = (0...1000).map {|i| (i % 256).chr }.join
+    data = MessagePack.pack(ExtType.new(93, payload)) + MessagePack.pack(ExtType.new(93, ""))
+    unpacker.register_exttype(93, :payload => :buffer) { |nr, data| data.read_all }
+    results = []
+    data.each_char {|c| unpacker.feed_each(c) {|obj| results << obj } }
+    results.should == [payload, ""]
+  end
+
+  it "should reset the payload mode when an exttype is registered again" do
+    unpacker.register_exttype(94, :payload => :buffer) { |nr, data| data.class }
+    unpacker.feed("\xD5^ab").unpack.should == MessagePack::Buffer
+    unpacker.register_exttype(94) { |nr, data| data.class }
+    unpacker.feed("\xD5^ab").unpack.should == String
+    lambda{ unpacker.register_exttype(94, :payload => :unknown) { } }.should raise_error(ArgumentError)
+    lambda{ unpacker.register_exttype(94, :paylod => :shared) { } }.should raise_error(ArgumentError)
+    lambda{ Unpacker.register_exttype(94, :payload => :shared, :copy => true) { } }.should raise_error(ArgumentError)
+  end
+
 end
 